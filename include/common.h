@@ -11,12 +11,37 @@
 #include <unistd.h>
 
 typedef enum { MATCHING = 1, NON_MATCHING } ni_mode_t;
-typedef enum { LATENCY = 1, BANDWIDTH } benchmark_type_t;
+typedef enum { LATENCY = 1, BANDWIDTH, LOADED_LATENCY } benchmark_type_t;
 typedef enum { PUT = 1, GET } operation_t;
 typedef enum { COUNTING = 1, FULL } event_type_t;
 typedef enum { COLD = 1, HOT } page_state_t;
 typedef enum { COLD_CACHE = 1, HOT_CACHE } cache_state_t;
-typedef enum { ONE_SIDED = 1, PINGPONG } latency_pattern_t;
+typedef enum { ONE_SIDED = 1, PINGPONG, WS_SWEEP, STREAM } latency_pattern_t;
+typedef enum { BASE_PAGES = 1, THP_PAGES, HUGETLB_2M, HUGETLB_1G } page_backing_t;
+typedef enum { RECOLD_DONTNEED = 1, RECOLD_PAGEOUT } recold_t;
+typedef enum {
+	BACKING_LAZY = 1,
+	BACKING_POPULATE,
+	BACKING_MLOCK,
+	BACKING_MLOCKALL,
+	BACKING_THREAD
+} memory_backing_t;
+typedef enum { LINEAR = 1, PAIRWISE, RANDOMIZED } a2a_schedule_t;
+typedef enum { INTRA_NODE = 1, INTER_NODE } locality_t;
+typedef enum { ZERO_BYTE_OP = 1, CT_INC_OP, NULL_OP } calibration_op_t;
+typedef enum { CI_MEDIAN = 1, CI_MEAN } ci_stat_t;
+typedef enum { RAW_PUT = 1, EAGER, RENDEZVOUS, AUTO_PROTOCOL } protocol_t;
+typedef enum {
+	MATCH_SPECIFIC = 1,
+	MATCH_ANY_SOURCE,
+	MATCH_ANY_TAG,
+	MATCH_ANY,
+	MATCH_MIXED
+} match_pattern_t;
+typedef enum { EXHAUST_EQ = 1, EXHAUST_LIST } exhaust_t;
+typedef enum { STREAM_COPY = 1, STREAM_TRIAD } stream_kernel_t;
+typedef enum { STRIPE_ROUND_ROBIN = 1, STRIPE_LEAST_LOADED } stripe_schedule_t;
+typedef enum { ME_POST_SERIAL = 1, ME_POST_BATCHED, ME_POST_NO_LINK } me_post_t;
 
 typedef struct {
 	ni_mode_t ni_mode;
@@ -31,6 +56,37 @@ typedef struct {
 	size_t min_msg_size;
 	size_t max_msg_size;
 	size_t cache_size;
+	int calibrate;
+	int adaptive;
+	double ci_width;
+	double time_budget;
+	ci_stat_t ci_stat;
+	const char* timeline_path;
+	size_t timeline_size;
+	int timeline_interval;
+	me_post_t me_post;
+	int append_rate;
+	int double_buffer;
+	size_t eager_limit;
+	int unexpected;
+	int list_depth;
+	size_t slab_size;
+	int num_slabs;
+	int min_list_length;
+	int max_list_length;
+	exhaust_t exhaust;
+	int burst;
+	int capacity;
+	size_t probe_size;
+	int stream_threads;
+	stream_kernel_t stream_kernel;
+	double stream_intensity;
+	size_t stream_size;
+	int num_nis;
+	size_t chunk_size;
+	stripe_schedule_t schedule;
+	int min_pts;
+	int max_pts;
 } benchmark_opts_t;
 
 typedef struct {
@@ -42,8 +98,68 @@ typedef struct {
 	page_state_t remote_state;
 	operation_t op;
 	latency_pattern_t pattern;
+	size_t min_ws;
+	size_t max_ws;
+	page_backing_t page_backing;
+	int span;
+	size_t stream_size;
+	int window_size;
+	int populate;
+	recold_t recold;
+	int pool_size;
+	int registration;
+	memory_backing_t backing;
 } memory_benchmark_opts_t;
 
+typedef struct {
+	double* samples;
+	size_t count;
+	size_t capacity;
+	size_t next_check;
+	size_t warmup;
+	double ci_width;
+	double target_width;
+	double time_budget;
+	double deadline;
+	ci_stat_t stat;
+	int converged;
+} adaptive_sampler_t;
+
+typedef struct {
+	double timestamp;
+	double latency;
+	size_t msg_size;
+	const char* func;
+	size_t interval;
+} timeline_sample_t;
+
+typedef struct {
+	double start;
+	double end;
+	int cpu;
+	long nvcsw;
+	long nivcsw;
+	unsigned long irq_cpu;
+	unsigned long irq_total;
+} timeline_interval_t;
+
+typedef struct {
+	timeline_sample_t* samples;
+	timeline_interval_t* intervals;
+	size_t capacity;
+	size_t num_intervals;
+	size_t count;
+	size_t interval_count;
+	int interval;
+	double epoch;
+	double last_snapshot;
+	long last_nvcsw;
+	long last_nivcsw;
+	unsigned long last_irq_cpu;
+	unsigned long last_irq_total;
+	FILE* interrupts;
+} timeline_t;
+
 typedef struct {
 	ptl_handle_ni_t ni_h;
 	ptl_handle_eq_t eq_h;
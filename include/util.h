@@ -5,10 +5,16 @@
 
 #define MiB 1024UL * 1024UL
 #define _16MiB 16 * MiB
+#define MAX_CACHE_PIDS_SETTINGS 64
 
 int init_p4_ctx(p4_ctx_t* const ctx, const ni_mode_t mode);
+int init_p4_ctx_iface(p4_ctx_t* const ctx, const ni_mode_t mode,
+                      const ptl_interface_t iface);
 void destroy_p4_ctx(p4_ctx_t* const ctx);
 int exchange_ni_address(p4_ctx_t* const ctx, const int my_rank);
+int gather_ni_addresses(p4_ctx_t* const ctx, ptl_process_t* const peers);
+locality_t get_peer_locality(const int peer);
+locality_t get_job_locality();
 int p4_pt_alloc(p4_ctx_t* const ctx, ptl_index_t* const index);
 void p4_pt_free(p4_ctx_t* const ctx, ptl_index_t index);
 int p4_md_alloc_ct(p4_ctx_t* const ctx, ptl_handle_md_t* const md_h,
@@ -27,6 +33,17 @@ int p4_me_insert_list_use_once(p4_ctx_t* const ctx, ptl_handle_me_t* const me_h,
                                void* const* start, ptl_size_t* const length,
                                const int num_entries, const ptl_index_t index,
                                const ptl_handle_ct_t ct_handle);
+int p4_me_insert_list_batched(p4_ctx_t* const ctx, ptl_handle_me_t* const me_h,
+                              void* const* start, ptl_size_t* const length,
+                              const int num_entries, const ptl_index_t index,
+                              const ptl_handle_ct_t ct_handle,
+                              const ptl_match_bits_t match_bits,
+                              const me_post_t post);
+const char* me_post_str(const me_post_t post);
+int p4_me_insert_slab(p4_ctx_t* const ctx, ptl_handle_me_t* const me_h,
+                      void* const start, const ptl_size_t length,
+                      const ptl_index_t index, const ptl_size_t min_free,
+                      void* const user_ptr);
 void p4_me_remove(ptl_handle_me_t me_h);
 int alloc_buffer_init(void** ptr, size_t bytes);
 int p4_le_insert_empty(p4_ctx_t* const ctx, ptl_handle_le_t* const le_h,
@@ -40,4 +57,24 @@ int p4_le_insert_ct_comm(p4_ctx_t* const ctx, ptl_handle_le_t* const le_h,
 int p4_md_alloc_eq_empty(p4_ctx_t* const ctx, ptl_handle_md_t* const md_h);
 void invalidate_cache(int* const cache_buffer, const size_t elements);
 int set_cache_regions(const int pids);
+void set_cache_regions_path(const char* const path);
+int get_cache_regions();
+void save_cache_regions();
+int parse_cache_pids_list(const char* const list, int* const pids,
+                          const int max_pids);
+const char* calibration_op_str(const calibration_op_t op);
+double median(double* const samples, const size_t count);
+int adaptive_init(adaptive_sampler_t* const s, const size_t capacity,
+                  const double target_width, const double time_budget,
+                  const ci_stat_t stat);
+void adaptive_free(adaptive_sampler_t* const s);
+void adaptive_reset(adaptive_sampler_t* const s);
+void adaptive_add(adaptive_sampler_t* const s, const double sample);
+int adaptive_done(adaptive_sampler_t* const s);
+int timeline_init(timeline_t* const tl, const size_t capacity,
+                  const int interval);
+void timeline_free(timeline_t* const tl);
+void timeline_record(timeline_t* const tl, const char* const func,
+                     const size_t msg_size, const double latency);
+int timeline_dump(timeline_t* const tl, const char* const path);
 #endif
@@ -1,14 +1,59 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/userfaultfd.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <time.h>
 #include <unistd.h>
 
 #define ITERATIONS 10000
 #define WARMUP 100
-#define PAGES (ITERATIONS + WARMUP)
+#define PREFAULT_REPETITIONS 10
 #define MiB 1024UL * 1024UL
 #define _16MiB 16 * MiB
+#define HUGE_PAGE_SIZE (2 * MiB)
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+typedef enum {
+	CASE_SINGLE = 1,
+	CASE_THREADS,
+	CASE_THP,
+	CASE_HUGETLB,
+	CASE_PREFAULT,
+	CASE_UFFD
+} pf_case_t;
+
+static const char* const case_names[] = {
+    "", "single", "threads", "thp", "hugetlb", "prefault", "uffd"};
+
+typedef struct {
+	pf_case_t pf_case;
+	int iterations;
+	int warmup;
+	int threads;
+	int private_mappings;
+} pf_opts_t;
+
+typedef struct {
+	int id;
+	char* pages;
+	double* times;
+	double elapsed;
+} pf_thread_t;
+
+static pf_opts_t opts;
+static size_t page_size;
+static pthread_barrier_t start_barrier;
 
 static inline double Wtime() {
 	struct timespec time;
@@ -23,15 +68,33 @@ void invalidate_cache(int* const cache_buffer, const size_t elements) {
 	}
 }
 
-int main(int argc, char* argv[]) {
+void print_sample(const char* mapping,
+                  const size_t size,
+                  const int threads,
+                  const int n,
+                  const double t) {
+	fprintf(stdout,
+	        "%s,%i,%s,%lu,%i,%.6f\n",
+	        case_names[opts.pf_case],
+	        threads,
+	        mapping,
+	        size,
+	        n,
+	        t);
+}
+
+/*
+ * The original benchmark: one 4 KiB page per sample, each in its own
+ * mapping, with the CPU caches polluted before the fault.
+ */
+int run_single() {
 	int* cache_buffer = NULL;
 	size_t cache_buffer_size;
 	void** page_buffer = NULL;
-	size_t page_size = sysconf(_SC_PAGESIZE);
+	const int pages = opts.iterations + opts.warmup;
 	double t0, t;
 
-	srand(time(0));
-	page_buffer = malloc(PAGES * sizeof(void*));
+	page_buffer = calloc(pages, sizeof(void*));
 	if (NULL == page_buffer)
 		goto END;
 
@@ -40,7 +103,7 @@ int main(int argc, char* argv[]) {
 	if (NULL == cache_buffer)
 		goto END;
 
-	for (int i = 0; i < PAGES; ++i) {
+	for (int i = 0; i < pages; ++i) {
 		page_buffer[i] = mmap(NULL,
 		                      page_size,
 		                      PROT_READ | PROT_WRITE,
@@ -53,24 +116,435 @@ int main(int argc, char* argv[]) {
 		}
 	}
 
-	fprintf(stdout, "count,time\n");
-
-	for (int i = 0; i < PAGES; ++i) {
+	for (int i = 0; i < pages; ++i) {
 		int* page = (int*) page_buffer[i];
 		invalidate_cache(cache_buffer, cache_buffer_size / sizeof(int));
 		t0 = Wtime();
-		page[rand() % 1024] = 0x92;
+		page[rand() % (page_size / sizeof(int))] = 0x92;
 		t = Wtime() - t0;
-		fprintf(stdout, "%i,%.6f\n", i, t);
+		if (i >= opts.warmup)
+			print_sample("private", page_size, 1, i - opts.warmup, t);
 	}
 
 END:
-	fflush(stdout);
-	for (int i = 0; i < PAGES; ++i) {
-		if (MAP_FAILED != page_buffer[i])
+	for (int i = 0; NULL != page_buffer && i < pages; ++i) {
+		if (NULL != page_buffer[i] && MAP_FAILED != page_buffer[i])
 			munmap(page_buffer[i], page_size);
 	}
 	free(page_buffer);
 	free(cache_buffer);
 	return 0;
-}
\ No newline at end of file
+}
+
+void* fault_pages(void* arg) {
+	pf_thread_t* const thread = (pf_thread_t*) arg;
+
+	if (opts.private_mappings) {
+		thread->pages = mmap(NULL,
+		                     opts.iterations * page_size,
+		                     PROT_READ | PROT_WRITE,
+		                     MAP_PRIVATE | MAP_ANONYMOUS,
+		                     -1,
+		                     0);
+		if (MAP_FAILED == thread->pages) {
+			fprintf(stderr, "mmaping failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	pthread_barrier_wait(&start_barrier);
+
+	const double start = Wtime();
+	for (int i = 0; i < opts.iterations; ++i) {
+		const double t0 = Wtime();
+		thread->pages[i * page_size] = 0x92;
+		thread->times[i] = Wtime() - t0;
+	}
+	thread->elapsed = Wtime() - start;
+	return NULL;
+}
+
+/*
+ * T threads fault iterations pages each, released together by a barrier. In
+ * the shared case every thread owns a slice of one mapping, in the private
+ * case every thread has its own mapping; both go through the same mm, so the
+ * difference is the contention on mmap_lock and the page table locks.
+ */
+int run_threads() {
+	pthread_t* tids = malloc(opts.threads * sizeof(pthread_t));
+	pf_thread_t* threads = calloc(opts.threads, sizeof(pf_thread_t));
+	const size_t bytes = (size_t) opts.threads * opts.iterations * page_size;
+	char* shared = MAP_FAILED;
+	double elapsed = 0.0;
+	int eret = -1;
+
+	if (NULL == tids || NULL == threads)
+		goto END;
+
+	if (!opts.private_mappings) {
+		shared = mmap(NULL,
+		              bytes,
+		              PROT_READ | PROT_WRITE,
+		              MAP_PRIVATE | MAP_ANONYMOUS,
+		              -1,
+		              0);
+		if (MAP_FAILED == shared) {
+			fprintf(stderr, "mmaping failed\n");
+			goto END;
+		}
+	}
+
+	// all allocations before the first thread, which waits for the others
+	for (int t = 0; t < opts.threads; ++t) {
+		threads[t].id = t;
+		threads[t].times = malloc(opts.iterations * sizeof(double));
+		if (NULL == threads[t].times)
+			goto END;
+		if (MAP_FAILED != shared)
+			threads[t].pages =
+			    shared + (size_t) t * opts.iterations * page_size;
+	}
+
+	pthread_barrier_init(&start_barrier, NULL, opts.threads);
+	for (int t = 0; t < opts.threads; ++t)
+		pthread_create(&tids[t], NULL, fault_pages, &threads[t]);
+	for (int t = 0; t < opts.threads; ++t) {
+		pthread_join(tids[t], NULL);
+		if (threads[t].elapsed > elapsed)
+			elapsed = threads[t].elapsed;
+	}
+	pthread_barrier_destroy(&start_barrier);
+
+	for (int t = 0; t < opts.threads; ++t) {
+		for (int i = 0; i < opts.iterations; ++i)
+			print_sample(opts.private_mappings ? "private" : "shared",
+			             page_size,
+			             opts.threads,
+			             t * opts.iterations + i,
+			             threads[t].times[i]);
+		if (opts.private_mappings)
+			munmap(threads[t].pages, opts.iterations * page_size);
+	}
+	fprintf(stderr,
+	        "%i threads: %.0f faults/s\n",
+	        opts.threads,
+	        (double) opts.threads * opts.iterations / (elapsed * 1e-9));
+	eret = 0;
+
+END:
+	for (int t = 0; NULL != threads && t < opts.threads; ++t)
+		free(threads[t].times);
+	if (MAP_FAILED != shared)
+		munmap(shared, bytes);
+	free(threads);
+	free(tids);
+	return eret;
+}
+
+/*
+ * First touch of iterations 2 MiB pages, either transparent huge pages in an
+ * aligned MADV_HUGEPAGE range or hugetlbfs pages from the reserved pool.
+ */
+int run_huge_pages() {
+	const size_t bytes = opts.iterations * HUGE_PAGE_SIZE;
+	const int thp = CASE_THP == opts.pf_case;
+	size_t mapped = thp ? bytes + HUGE_PAGE_SIZE : bytes;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	char* base;
+	char* pages;
+
+	if (!thp)
+		flags |= MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+
+	base = mmap(NULL, mapped, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (MAP_FAILED == base) {
+		fprintf(stderr,
+		        "mmaping failed%s\n",
+		        thp ? "" : ", are 2 MiB hugetlb pages reserved?");
+		return -1;
+	}
+	pages = thp ? (char*) (((uintptr_t) base + HUGE_PAGE_SIZE - 1) &
+	                       ~(HUGE_PAGE_SIZE - 1))
+	            : base;
+	if (thp && 0 != madvise(pages, bytes, MADV_HUGEPAGE))
+		fprintf(stderr, "MADV_HUGEPAGE failed, THP may be disabled\n");
+
+	for (int i = 0; i < opts.iterations; ++i) {
+		const double t0 = Wtime();
+		pages[i * HUGE_PAGE_SIZE] = 0x92;
+		const double t = Wtime() - t0;
+		print_sample(thp ? "thp" : "hugetlb_2m", HUGE_PAGE_SIZE, 1, i, t);
+	}
+
+	munmap(base, mapped);
+	return 0;
+}
+
+/*
+ * Prefault throughput of a region of iterations pages, reported per page:
+ * mmap with MAP_POPULATE, madvise(MADV_WILLNEED) followed by the touch, and
+ * the plain first-touch baseline.
+ */
+int run_prefault() {
+	const size_t bytes = opts.iterations * page_size;
+	char* region;
+	double t0;
+
+	for (int r = 0; r < PREFAULT_REPETITIONS; ++r) {
+		t0 = Wtime();
+		region = mmap(NULL,
+		              bytes,
+		              PROT_READ | PROT_WRITE,
+		              MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+		              -1,
+		              0);
+		if (MAP_FAILED == region)
+			return -1;
+		print_sample(
+		    "populate", page_size, 1, r, (Wtime() - t0) / opts.iterations);
+		munmap(region, bytes);
+
+		region = mmap(NULL,
+		              bytes,
+		              PROT_READ | PROT_WRITE,
+		              MAP_PRIVATE | MAP_ANONYMOUS,
+		              -1,
+		              0);
+		if (MAP_FAILED == region)
+			return -1;
+		t0 = Wtime();
+		madvise(region, bytes, MADV_WILLNEED);
+		print_sample("willneed_advise",
+		             page_size,
+		             1,
+		             r,
+		             (Wtime() - t0) / opts.iterations);
+		t0 = Wtime();
+		for (size_t p = 0; p < bytes; p += page_size)
+			region[p] = 0x92;
+		print_sample("willneed_touch",
+		             page_size,
+		             1,
+		             r,
+		             (Wtime() - t0) / opts.iterations);
+		munmap(region, bytes);
+
+		region = mmap(NULL,
+		              bytes,
+		              PROT_READ | PROT_WRITE,
+		              MAP_PRIVATE | MAP_ANONYMOUS,
+		              -1,
+		              0);
+		if (MAP_FAILED == region)
+			return -1;
+		t0 = Wtime();
+		for (size_t p = 0; p < bytes; p += page_size)
+			region[p] = 0x92;
+		print_sample(
+		    "lazy_touch", page_size, 1, r, (Wtime() - t0) / opts.iterations);
+		munmap(region, bytes);
+	}
+	return 0;
+}
+
+static int uffd;
+
+/*
+ * A write fault resolved with UFFDIO_ZEROPAGE would map the shared zero page
+ * read-only and fault again for the copy-on-write, so write faults get a copy
+ * of the zeroed page passed in arg instead.
+ */
+void* serve_uffd(void* arg) {
+	struct uffd_msg msg;
+	const char* const zero_page = arg;
+
+	for (int served = 0; served < opts.iterations;) {
+		if (sizeof(msg) != read(uffd, &msg, sizeof(msg)))
+			continue;
+		if (UFFD_EVENT_PAGEFAULT != msg.event)
+			continue;
+		const uintptr_t page = msg.arg.pagefault.address & ~(page_size - 1);
+		if (msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WRITE) {
+			struct uffdio_copy copy = {.dst = page,
+			                           .src = (uintptr_t) zero_page,
+			                           .len = page_size,
+			                           .mode = 0};
+			ioctl(uffd, UFFDIO_COPY, &copy);
+		} else {
+			struct uffdio_zeropage zero = {
+			    .range = {.start = page, .len = page_size}, .mode = 0};
+			ioctl(uffd, UFFDIO_ZEROPAGE, &zero);
+		}
+		++served;
+	}
+	return NULL;
+}
+
+/*
+ * Missing-page faults resolved by a userfaultfd handler thread with a zeroed
+ * page, the path a user-level pager or migration layer adds.
+ */
+int run_uffd() {
+	const size_t bytes = opts.iterations * page_size;
+	pthread_t handler;
+	char* region = MAP_FAILED;
+	char* zero_page = NULL;
+	int eret = -1;
+
+	uffd = syscall(SYS_userfaultfd, O_CLOEXEC);
+	if (0 > uffd) {
+		perror("userfaultfd (needs vm.unprivileged_userfaultfd or "
+		       "CAP_SYS_PTRACE)");
+		return -1;
+	}
+	struct uffdio_api api = {.api = UFFD_API, .features = 0};
+	if (0 != ioctl(uffd, UFFDIO_API, &api)) {
+		perror("UFFDIO_API");
+		goto END;
+	}
+
+	region = mmap(NULL,
+	              bytes,
+	              PROT_READ | PROT_WRITE,
+	              MAP_PRIVATE | MAP_ANONYMOUS,
+	              -1,
+	              0);
+	if (MAP_FAILED == region)
+		goto END;
+	struct uffdio_register reg = {
+	    .range = {.start = (uintptr_t) region, .len = bytes},
+	    .mode = UFFDIO_REGISTER_MODE_MISSING};
+	if (0 != ioctl(uffd, UFFDIO_REGISTER, &reg)) {
+		perror("UFFDIO_REGISTER");
+		goto END;
+	}
+
+	if (0 != posix_memalign((void**) &zero_page, page_size, page_size))
+		goto END;
+	memset(zero_page, 0, page_size);
+
+	// every sample is a write fault, served with UFFDIO_COPY
+	pthread_create(&handler, NULL, serve_uffd, zero_page);
+	for (int i = 0; i < opts.iterations; ++i) {
+		const double t0 = Wtime();
+		region[i * page_size] = 0x92;
+		const double t = Wtime() - t0;
+		print_sample("uffd_copy", page_size, 1, i, t);
+	}
+	pthread_join(handler, NULL);
+	eret = 0;
+
+END:
+	if (MAP_FAILED != region)
+		munmap(region, bytes);
+	free(zero_page);
+	close(uffd);
+	return eret;
+}
+
+void print_help_message() {
+	printf("Usage: pf_bench [options]\n");
+	printf("Options:\n");
+	printf(
+	    "  -c, --case <name>         single, threads, thp, hugetlb, prefault "
+	    "or uffd (default single)\n");
+	printf(
+	    "  -i, --iterations <num>    Pages per thread and case (default "
+	    "10000)\n");
+	printf(
+	    "  -x, --warmup <num>        Warmup pages of the single case (default "
+	    "100)\n");
+	printf(
+	    "  -t, --threads <num>       Faulting threads of the threads case "
+	    "(default 1)\n");
+	printf(
+	    "  -p, --private             One mapping per thread instead of one "
+	    "shared mapping (no argument)\n");
+	printf(
+	    "  -h, --help                Display this help message (no "
+	    "argument)\n");
+}
+
+int main(int argc, char* argv[]) {
+	int eret = -1;
+
+	static const struct option long_opts[] = {
+	    {"case", required_argument, NULL, 'c'},
+	    {"iterations", required_argument, NULL, 'i'},
+	    {"warmup", required_argument, NULL, 'x'},
+	    {"threads", required_argument, NULL, 't'},
+	    {"private", no_argument, NULL, 'p'},
+	    {"help", no_argument, NULL, 'h'}};
+
+	const char* const short_opts = "c:i:x:t:ph";
+
+	opts.pf_case = CASE_SINGLE;
+	opts.iterations = ITERATIONS;
+	opts.warmup = WARMUP;
+	opts.threads = 1;
+	opts.private_mappings = 0;
+
+	while (1) {
+		const int opt = getopt_long(argc, argv, short_opts, long_opts, NULL);
+		if (-1 == opt) {
+			break;
+		}
+		switch (opt) {
+			case 'c':
+				opts.pf_case = 0;
+				for (int c = CASE_SINGLE; c <= CASE_UFFD; ++c)
+					if (0 == strcmp(optarg, case_names[c]))
+						opts.pf_case = c;
+				if (0 == opts.pf_case) {
+					print_help_message();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'i':
+				opts.iterations = atoi(optarg);
+				break;
+			case 'x':
+				opts.warmup = atoi(optarg);
+				break;
+			case 't':
+				opts.threads = atoi(optarg);
+				break;
+			case 'p':
+				opts.private_mappings = 1;
+				break;
+			case 'h':
+				print_help_message();
+				exit(EXIT_SUCCESS);
+			default:
+				print_help_message();
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	srand(time(0));
+
+	fprintf(stdout, "case,threads,mapping,page_size,count,time\n");
+
+	switch (opts.pf_case) {
+		case CASE_SINGLE:
+			eret = run_single();
+			break;
+		case CASE_THREADS:
+			eret = run_threads();
+			break;
+		case CASE_THP:
+		case CASE_HUGETLB:
+			eret = run_huge_pages();
+			break;
+		case CASE_PREFAULT:
+			eret = run_prefault();
+			break;
+		case CASE_UFFD:
+			eret = run_uffd();
+			break;
+	}
+
+	fflush(stdout);
+	return eret;
+}
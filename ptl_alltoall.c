@@ -0,0 +1,408 @@
+#include "common.h"
+#include "util.h"
+#include <getopt.h>
+#include <time.h>
+
+static int rank;
+static int num_ranks;
+static benchmark_opts_t opts;
+static p4_ctx_t ctx;
+static locality_t locality;
+static ptl_process_t* peers;
+static int* order;
+static unsigned int seed;
+
+static const char*
+schedule_name(const a2a_schedule_t schedule)
+{
+  switch(schedule)
+  {
+  case LINEAR:
+    return "linear";
+  case PAIRWISE:
+    return "pairwise";
+  case RANDOMIZED:
+    return "random";
+  }
+  return "unknown";
+}
+
+/*
+ * Fill order[0 .. num_ranks - 2] with the peers this rank puts to, in the
+ * sequence given by the schedule. Linear has every rank start at rank 0,
+ * pairwise uses XOR pairing for power-of-two rank counts and a shifted ring
+ * otherwise, random reshuffles the peers on every call.
+ */
+static void
+build_schedule(const a2a_schedule_t schedule)
+{
+  int n = 0;
+  int pow2 = 0 == (num_ranks & (num_ranks - 1));
+
+  for(int step = 0; step < num_ranks; ++step)
+  {
+    int peer;
+    if(LINEAR == schedule || RANDOMIZED == schedule)
+      peer = step;
+    else
+      peer = pow2 ? rank ^ step : (rank + step) % num_ranks;
+    if(peer != rank)
+      order[n++] = peer;
+  }
+
+  if(RANDOMIZED == schedule)
+  {
+    for(int i = n - 1; i > 0; --i)
+    {
+      int j = rand_r(&seed) % (i + 1);
+      int tmp = order[i];
+      order[i] = order[j];
+      order[j] = tmp;
+    }
+  }
+}
+
+static void
+report(const char* func, const char* schedule, const size_t msg_size,
+       double* const time)
+{
+  if(0 == rank)
+    MPI_Reduce(MPI_IN_PLACE, time, opts.iterations, MPI_DOUBLE, MPI_MAX, 0,
+               MPI_COMM_WORLD);
+  else
+    MPI_Reduce(time, NULL, opts.iterations, MPI_DOUBLE, MPI_MAX, 0,
+               MPI_COMM_WORLD);
+
+  if(0 != rank)
+    return;
+
+  for(int i = 0; i < opts.iterations; ++i)
+  {
+    fprintf(stdout, "%s,%s,%i,%lu,%.4f,%.4f,%s\n", func, schedule, num_ranks,
+            msg_size, time[i] * 1e6,
+            (msg_size * (num_ranks - 1) * 1e-6) / time[i],
+            INTRA_NODE == locality ? "intra" : "inter");
+  }
+  fflush(stdout);
+}
+
+int
+p4_alltoall(const a2a_schedule_t schedule, const size_t msg_size,
+            char* const send_buffer, char* const recv_buffer,
+            double* const time)
+{
+  int eret = -1;
+  ptl_handle_md_t md_h;
+  ptl_handle_le_t le_h;
+  ptl_index_t index;
+  ptl_ct_event_t ct_event;
+  ptl_ct_event_t zero = {.success = 0, .failure = 0};
+  size_t bytes = msg_size * num_ranks;
+  double t0;
+
+  eret = p4_pt_alloc(&ctx, &index);
+  if(PTL_OK != eret)
+    return eret;
+
+  eret = p4_le_insert_ct_comm(&ctx, &le_h, recv_buffer, bytes, index);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "List entry insertion failed\n");
+    p4_pt_free(&ctx, index);
+    return eret;
+  }
+
+  eret = p4_md_alloc_ct(&ctx, &md_h, send_buffer, bytes);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "md alloc failed with %i\n", eret);
+    p4_le_remove(le_h);
+    p4_pt_free(&ctx, index);
+    return eret;
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+  {
+    build_schedule(schedule);
+    MPI_Barrier(MPI_COMM_WORLD);
+    t0 = MPI_Wtime();
+
+    // every rank owns the block at rank * msg_size in the peer's LE
+    for(int p = 0; p < num_ranks - 1; ++p)
+    {
+      eret = PtlPut(md_h, order[p] * msg_size, msg_size, PTL_NO_ACK_REQ,
+                    peers[order[p]], index, 0, rank * msg_size, NULL, 0);
+      if(PTL_OK != eret)
+      {
+        fprintf(stderr, "PtlPut failed with %i\n", eret);
+        MPI_Abort(MPI_COMM_WORLD, eret);
+      }
+    }
+    memcpy(recv_buffer + rank * msg_size, send_buffer + rank * msg_size,
+           msg_size);
+
+    eret = PtlCTWait(ctx.ct_h, (ptl_size_t)(i + 1) * (num_ranks - 1),
+                     &ct_event);
+    if(PTL_OK != eret || ct_event.failure > 0)
+    {
+      fprintf(stderr, "PtlCTWait failed\n");
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+
+    if(i >= opts.warmup)
+      time[i - opts.warmup] = MPI_Wtime() - t0;
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  eret = PtlCTSet(ctx.ct_h, zero);
+  if(PTL_OK != eret)
+    fprintf(stderr, "PtlCTSet failed with %i\n", eret);
+
+  p4_md_free(md_h);
+  p4_le_remove(le_h);
+  p4_pt_free(&ctx, index);
+  return eret;
+}
+
+int
+mpi_alltoall(const size_t msg_size, char* const send_buffer,
+             char* const recv_buffer, double* const time)
+{
+  double t0;
+  for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+  {
+    MPI_Barrier(MPI_COMM_WORLD);
+    t0 = MPI_Wtime();
+    MPI_Alltoall(send_buffer, msg_size, MPI_BYTE, recv_buffer, msg_size,
+                 MPI_BYTE, MPI_COMM_WORLD);
+    if(i >= opts.warmup)
+      time[i - opts.warmup] = MPI_Wtime() - t0;
+  }
+  return 0;
+}
+
+int
+run_alltoall_benchmark(const a2a_schedule_t* schedules, const int num_schedules)
+{
+  int eret = -1;
+  void* send_buffer = NULL;
+  void* recv_buffer = NULL;
+  double* time = malloc(opts.iterations * sizeof(double));
+  if(NULL == time)
+    return -1;
+
+  if(0 == rank)
+    fprintf(stdout,
+            "func,schedule,ranks,msg_size,latency,bandwidth,locality\n");
+
+  for(size_t msg_size = opts.min_msg_size; msg_size <= opts.max_msg_size;
+      msg_size *= 2)
+  {
+    size_t bytes = msg_size * num_ranks;
+    eret = alloc_buffer_init(&send_buffer, bytes);
+    if(0 > eret)
+      break;
+    eret = alloc_buffer_init(&recv_buffer, bytes);
+    if(0 > eret)
+    {
+      free(send_buffer);
+      break;
+    }
+
+    for(int s = 0; s < num_schedules; ++s)
+    {
+      eret = p4_alltoall(schedules[s], msg_size, send_buffer, recv_buffer,
+                         time);
+      if(PTL_OK != eret)
+        break;
+      report("PtlPut", schedule_name(schedules[s]), msg_size, time);
+    }
+
+    if(PTL_OK == eret)
+    {
+      mpi_alltoall(msg_size, send_buffer, recv_buffer, time);
+      report("MPI_Alltoall", "mpi", msg_size, time);
+    }
+
+    free(send_buffer);
+    free(recv_buffer);
+    if(PTL_OK != eret)
+      break;
+  }
+  free(time);
+  return eret;
+}
+
+void
+print_help_message()
+{
+  fprintf(stdout, "Usage: [options]\n");
+  fprintf(stdout, "Options:\n");
+  fprintf(stdout,
+          "  -i, --iterations <value>       Specify the number of iterations "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  -x, --warmup <value>           Specify the number of warmup "
+          "iterations (required argument)\n");
+  fprintf(stdout, "  --msg_size <value>             Specify the block size "
+                  "per peer (required argument)\n");
+  fprintf(stdout,
+          "  --min_msg_size <value>         Specify the minimum block size "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  --max_msg_size <value>         Specify the maximum block size "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  -s, --schedule <value>         linear, pairwise or random; all "
+          "three if omitted (required argument)\n");
+  fprintf(stdout,
+          "  -h, --help                     Display this help message (no "
+          "argument required)\n");
+  fflush(stdout);
+}
+
+void
+print_benchmark_opts(const a2a_schedule_t* schedules, const int num_schedules)
+{
+  fprintf(stderr, "Benchmark Configuration:\n\n");
+  fprintf(stderr, "ranks: %i\n", num_ranks);
+  fprintf(stderr, "locality: %s\n",
+          INTRA_NODE == locality ? "INTRA_NODE" : "INTER_NODE");
+  fprintf(stderr, "schedules:");
+  for(int s = 0; s < num_schedules; ++s)
+    fprintf(stderr, " %s", schedule_name(schedules[s]));
+  fprintf(stderr, "\n");
+  fprintf(stderr, "iterations: %i\n", opts.iterations);
+  fprintf(stderr, "warmup: %i\n", opts.warmup);
+  fprintf(stderr, "min_msg_size: %lu\n", opts.min_msg_size);
+  fprintf(stderr, "max_msg_size: %lu\n\n", opts.max_msg_size);
+  fflush(stderr);
+}
+
+int
+main(int argc, char* argv[])
+{
+  int eret = -1;
+  a2a_schedule_t schedules[3] = {LINEAR, PAIRWISE, RANDOMIZED};
+  int num_schedules = 3;
+
+  static const struct option long_opts[] = {
+      {"iterations", required_argument, NULL, 'i'},
+      {"warmup", required_argument, NULL, 'x'},
+      {"msg_size", required_argument, NULL, 1},
+      {"min_msg_size", required_argument, NULL, 2},
+      {"max_msg_size", required_argument, NULL, 3},
+      {"schedule", required_argument, NULL, 's'},
+      {"help", no_argument, NULL, 'h'}};
+
+  const char* const short_opts = "i:x:s:h";
+
+  opts.ni_mode = NON_MATCHING;
+  opts.op = PUT;
+  opts.event_type = COUNTING;
+  opts.iterations = 100;
+  opts.warmup = 10;
+  opts.min_msg_size = 1;
+  opts.max_msg_size = 1048576;
+
+  while(1)
+  {
+    const int opt = getopt_long(argc, argv, short_opts, long_opts, NULL);
+
+    if(-1 == opt)
+      break;
+
+    switch(opt)
+    {
+    case 'i':
+      opts.iterations = atoi(optarg);
+      break;
+    case 'x':
+      opts.warmup = atoi(optarg);
+      break;
+    case 1:
+      opts.msg_size = atol(optarg);
+      opts.min_msg_size = opts.msg_size;
+      opts.max_msg_size = opts.msg_size;
+      break;
+    case 2:
+      opts.min_msg_size = atol(optarg);
+      break;
+    case 3:
+      opts.max_msg_size = atol(optarg);
+      break;
+    case 's':
+      num_schedules = 1;
+      if(0 == strcmp(optarg, "linear"))
+        schedules[0] = LINEAR;
+      else if(0 == strcmp(optarg, "pairwise"))
+        schedules[0] = PAIRWISE;
+      else if(0 == strcmp(optarg, "random"))
+        schedules[0] = RANDOMIZED;
+      else
+      {
+        print_help_message();
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'h':
+      print_help_message();
+      exit(EXIT_SUCCESS);
+    case '?':
+      print_help_message();
+      exit(EXIT_FAILURE);
+    default:
+      print_help_message();
+      exit(EXIT_FAILURE);
+    }
+  } // end while
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+  if(2 > num_ranks)
+  {
+    fprintf(stdout, "Benchmark requires at least two processes\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  locality = get_job_locality();
+
+  if(0 == rank)
+    print_benchmark_opts(schedules, num_schedules);
+
+  seed = time(0) + rank;
+  peers = malloc(num_ranks * sizeof(ptl_process_t));
+  order = malloc(num_ranks * sizeof(int));
+  if(NULL == peers || NULL == order)
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+
+  PtlInit();
+
+  eret = init_p4_ctx(&ctx, opts.ni_mode);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "init failed with %i\n", eret);
+    goto END;
+  }
+
+  eret = gather_ni_addresses(&ctx, peers);
+  if(MPI_SUCCESS != eret)
+  {
+    fprintf(stderr, "address exchange failed\n");
+    goto END;
+  }
+
+  eret = run_alltoall_benchmark(schedules, num_schedules);
+
+END:
+  destroy_p4_ctx(&ctx);
+  PtlFini();
+  free(peers);
+  free(order);
+  MPI_Finalize();
+  return eret;
+}
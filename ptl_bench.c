@@ -1,15 +1,256 @@
+#define _GNU_SOURCE
 #include "common.h"
 #include "util.h"
 #include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
 
 static int rank;
 static int num_ranks;
 static benchmark_opts_t opts;
 static p4_ctx_t ctx;
+static locality_t locality;
+static adaptive_sampler_t sampler;
+static timeline_t timeline;
+
+static int cache_pids[MAX_CACHE_PIDS_SETTINGS];
+static int num_cache_pids;
+static char pids_column[16];
+static int header_printed;
+
+#define ADAPTIVE_MAX_SAMPLES (1 << 20)
+#define BULK_INDEX 100
+#define STREAM_CHUNK (1 << 16)
+#define STREAM_IDLE_SECONDS 1.0
 
 int* cache_buffer;
 size_t cache_buffer_size;
 
+/*
+ * Host memory load: stream_threads helper threads on the socket of the rank
+ * run a STREAM copy or triad kernel over their own arrays for the whole run.
+ * With an intensity below 1 a thread sleeps after every chunk so that it is
+ * busy for that fraction of the time. The bytes moved are counted per thread
+ * (STREAM convention: 16 per element for copy, 24 for triad).
+ */
+typedef struct
+{
+  pthread_t thread;
+  int cpu;
+  double* a;
+  double* b;
+  double* c;
+  atomic_ulong bytes;
+  char pad[64];
+} stream_worker_t;
+
+static stream_worker_t* stream_workers;
+static atomic_int stream_stop;
+static atomic_int stream_ready;
+static unsigned long stream_bytes_last;
+static double stream_time_last;
+static unsigned long stream_bytes_start;
+static double stream_time_start;
+static char host_column[32];
+
+static double
+stream_clock()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void*
+stream_worker(void* arg)
+{
+  stream_worker_t* const w = (stream_worker_t*)arg;
+  const size_t n = opts.stream_size / sizeof(double);
+  const double scalar = 3.0;
+  size_t start = 0;
+
+  if(0 <= w->cpu)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+
+  // first touch from the thread that uses the arrays
+  for(size_t i = 0; i < n; ++i)
+  {
+    w->a[i] = 1.0;
+    w->b[i] = 2.0;
+    w->c[i] = 0.0;
+  }
+  atomic_fetch_add(&stream_ready, 1);
+
+  while(!atomic_load(&stream_stop))
+  {
+    const size_t end = start + STREAM_CHUNK < n ? start + STREAM_CHUNK : n;
+    const double t0 = stream_clock();
+
+    if(STREAM_COPY == opts.stream_kernel)
+    {
+      for(size_t i = start; i < end; ++i)
+        w->c[i] = w->a[i];
+      atomic_fetch_add(&w->bytes, 2 * sizeof(double) * (end - start));
+    }
+    else
+    {
+      for(size_t i = start; i < end; ++i)
+        w->a[i] = w->b[i] + scalar * w->c[i];
+      atomic_fetch_add(&w->bytes, 3 * sizeof(double) * (end - start));
+    }
+    start = n == end ? 0 : end;
+
+    if(opts.stream_intensity < 1.0)
+    {
+      const double busy = stream_clock() - t0;
+      const double idle =
+          busy * (1.0 - opts.stream_intensity) / opts.stream_intensity;
+      struct timespec ts = {.tv_sec = (time_t)idle,
+                            .tv_nsec = (long)((idle - (time_t)idle) * 1e9)};
+      nanosleep(&ts, NULL);
+    }
+  }
+  return NULL;
+}
+
+static int
+cpu_package(const int cpu)
+{
+  char path[128];
+  int package = -1;
+
+  snprintf(path, sizeof(path),
+           "/sys/devices/system/cpu/cpu%i/topology/physical_package_id", cpu);
+  FILE* const file = fopen(path, "r");
+  if(NULL == file)
+    return -1;
+  if(1 != fscanf(file, "%i", &package))
+    package = -1;
+  fclose(file);
+  return package;
+}
+
+static unsigned long
+stream_bytes()
+{
+  unsigned long bytes = 0;
+  for(int t = 0; t < opts.stream_threads; ++t)
+    bytes += atomic_load(&stream_workers[t].bytes);
+  return bytes;
+}
+
+// host bandwidth in MB/s since the previous call
+static double
+stream_bandwidth()
+{
+  const unsigned long bytes = stream_bytes();
+  const double now = stream_clock();
+  const double bandwidth =
+      (bytes - stream_bytes_last) * 1e-6 / (now - stream_time_last);
+  stream_bytes_last = bytes;
+  stream_time_last = now;
+  return bandwidth;
+}
+
+/*
+ * The workers publish their bytes once per chunk, so host_bw is measured over
+ * a whole pass (one message size) instead of per row: the pass starts the
+ * interval, the column is updated when the pass ends and printed on all rows
+ * of that pass.
+ */
+static void
+start_host_pass()
+{
+  if(0 < opts.stream_threads)
+    stream_bandwidth();
+}
+
+static void
+update_host_column()
+{
+  if(0 < opts.stream_threads)
+    snprintf(host_column, sizeof(host_column), ",%.1f", stream_bandwidth());
+}
+
+/*
+ * Starts the helper threads on the other CPUs of the package this rank runs
+ * on (unpinned if the topology cannot be read) and returns the bandwidth the
+ * load reaches on its own, before any communication.
+ */
+static double
+start_stream_load()
+{
+  const int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  const int my_cpu = sched_getcpu();
+  const int my_package = cpu_package(my_cpu);
+  int next = my_cpu;
+
+  stream_workers = calloc(opts.stream_threads, sizeof(stream_worker_t));
+  if(NULL == stream_workers)
+    return -1.0;
+
+  for(int t = 0; t < opts.stream_threads; ++t)
+  {
+    stream_worker_t* const w = &stream_workers[t];
+
+    w->cpu = -1;
+    for(int i = 1; 0 <= my_package && i <= cpus; ++i)
+    {
+      const int cpu = (next + i) % cpus;
+      if(cpu != my_cpu && my_package == cpu_package(cpu))
+      {
+        w->cpu = cpu;
+        next = cpu;
+        break;
+      }
+    }
+
+    w->a = malloc(opts.stream_size);
+    w->b = malloc(opts.stream_size);
+    w->c = malloc(opts.stream_size);
+    if(NULL == w->a || NULL == w->b || NULL == w->c ||
+       0 != pthread_create(&w->thread, NULL, stream_worker, w))
+      return -1.0;
+  }
+
+  while(atomic_load(&stream_ready) < opts.stream_threads)
+    sched_yield();
+
+  stream_bandwidth();
+  struct timespec ts = {.tv_sec = (time_t)STREAM_IDLE_SECONDS, .tv_nsec = 0};
+  nanosleep(&ts, NULL);
+  const double bandwidth = stream_bandwidth();
+  stream_bytes_start = stream_bytes_last;
+  stream_time_start = stream_time_last;
+  return bandwidth;
+}
+
+// stops the helper threads and returns their bandwidth since the start
+static double
+stop_stream_load()
+{
+  const double bandwidth = (stream_bytes() - stream_bytes_start) * 1e-6 /
+                           (stream_clock() - stream_time_start);
+
+  atomic_store(&stream_stop, 1);
+  for(int t = 0; t < opts.stream_threads; ++t)
+  {
+    pthread_join(stream_workers[t].thread, NULL);
+    free(stream_workers[t].c);
+    free(stream_workers[t].b);
+    free(stream_workers[t].a);
+  }
+  free(stream_workers);
+  return bandwidth;
+}
+
 static inline void
 wait_for_completion(const ptl_size_t wait_for)
 {
@@ -41,6 +282,175 @@ wait_for_completion(const ptl_size_t wait_for)
   }
 }
 
+// the header is printed once even if the benchmark runs for several settings
+static void
+print_header(const char* const columns)
+{
+  if(0 != rank || header_printed)
+    return;
+  fprintf(stdout, "%s%s%s\n", columns,
+          0 < opts.stream_threads ? ",host_bw" : "",
+          0 < num_cache_pids ? ",cache_pids" : "");
+  header_printed = 1;
+}
+
+// with a host load the rows of a pass are held back until its end
+static inline int
+hold_samples()
+{
+  return opts.adaptive || 0 < opts.stream_threads;
+}
+
+static inline int
+keep_sampling(const int i)
+{
+  if(0 == i)
+  {
+    start_host_pass();
+    if(hold_samples())
+      adaptive_reset(&sampler);
+  }
+  if(!opts.adaptive)
+    return i < opts.iterations + opts.warmup;
+  return !adaptive_done(&sampler);
+}
+
+static void
+print_sample(const char* const func, const size_t msg_size, const double t)
+{
+  if(LATENCY == opts.type)
+    fprintf(stdout, "%s,%lu,%.4f,%s%s%s\n", func, msg_size, t * 1e6,
+            INTRA_NODE == locality ? "intra" : "inter", host_column,
+            pids_column);
+  else
+    fprintf(stdout, "%s,%lu,%.4f,%s%s%s\n", func, msg_size,
+            (msg_size * opts.window_size * 1e-6) / t,
+            INTRA_NODE == locality ? "intra" : "inter", host_column,
+            pids_column);
+  fflush(stdout);
+}
+
+static inline void
+report_sample(const char* const func, const size_t msg_size, const double t)
+{
+  if(NULL != opts.timeline_path)
+    timeline_record(&timeline, func, msg_size, t);
+  if(hold_samples())
+    adaptive_add(&sampler, t);
+  else
+    print_sample(func, msg_size, t);
+}
+
+/*
+ * Prints the held rows of a pass. Of an adaptive run only the stationary part
+ * is printed, the warmup is dropped.
+ */
+static void
+report_pass(const char* const func, const size_t msg_size)
+{
+  if(!hold_samples())
+    return;
+  update_host_column();
+  for(size_t s = sampler.warmup; s < sampler.count; ++s)
+    print_sample(func, msg_size, sampler.samples[s]);
+  if(!opts.adaptive)
+    return;
+  fprintf(stderr, "%s,%lu: %lu samples, %lu warmup, ci width %.4f (%s)\n",
+          func, msg_size, sampler.count - sampler.warmup, sampler.warmup,
+          sampler.ci_width, sampler.converged ? "converged" : "budget");
+  fflush(stderr);
+}
+
+/*
+ * Issues one timed operation and waits for its completion. op is 0 for the
+ * put or get of the benchmark, the calibration ops replace it: a CT increment
+ * on the local CT (waited on directly, the EQ never sees it) or nothing.
+ */
+static inline int
+issue_latency_op(const calibration_op_t op, const ptl_handle_md_t md_h,
+                 const size_t msg_size, const ptl_index_t index,
+                 const ptl_match_bits_t match_bits)
+{
+  ptl_ct_event_t ct_event;
+  ptl_ct_event_t one = {.success = 1, .failure = 0};
+  int eret;
+
+  if(CT_INC_OP == op)
+  {
+    eret = PtlCTInc(ctx.ct_h, one);
+    if(PTL_OK == eret)
+      eret = PtlCTWait(ctx.ct_h, 1, &ct_event);
+    return eret;
+  }
+  if(NULL_OP == op)
+    return PTL_OK;
+
+  if(PUT == opts.op)
+    eret = PtlPut(md_h, 0, msg_size, PTL_ACK_REQ, ctx.peer_addr, index,
+                  match_bits, 0, NULL, 0);
+  else
+    eret = PtlGet(md_h, 0, msg_size, ctx.peer_addr, index, match_bits, 0,
+                  NULL);
+  if(PTL_OK == eret)
+    wait_for_completion(1);
+  return eret;
+}
+
+/*
+ * The timed loop of the latency benchmarks, shared with the calibration so
+ * that both measure the same code. If min_t and sum are given, the smallest
+ * and the sum of the reported samples are returned in them.
+ */
+static void
+time_latency_pass(const char* const func, const calibration_op_t op,
+                  const ptl_handle_md_t md_h, const size_t msg_size,
+                  const ptl_index_t index, const ptl_match_bits_t match_bits,
+                  double* const min_t, double* const sum)
+{
+  ptl_ct_event_t zero = {.success = 0, .failure = 0};
+  double t0, t;
+  int eret;
+
+  for(int i = 0; keep_sampling(i); ++i)
+  {
+    if(opts.cache_state == COLD_CACHE)
+    {
+      invalidate_cache(cache_buffer, cache_buffer_size);
+    }
+    if(i >= opts.warmup)
+    {
+      t0 = MPI_Wtime();
+    }
+
+    eret = issue_latency_op(op, md_h, msg_size, index, match_bits);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "%s failed with %i\n", func, eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+
+    if(i >= opts.warmup)
+    {
+      t = MPI_Wtime() - t0;
+      report_sample(func, msg_size, t);
+      if(NULL != min_t && (i == opts.warmup || t < *min_t))
+        *min_t = t;
+      if(NULL != sum)
+        *sum += t;
+    }
+    if(COUNTING == opts.event_type || CT_INC_OP == op)
+    {
+      eret = PtlCTSet(ctx.ct_h, zero);
+      if(PTL_OK != eret)
+      {
+        fprintf(stderr, "PtlCTSet failed with %i\n", eret);
+        MPI_Abort(MPI_COMM_WORLD, eret);
+      }
+    }
+  }
+  report_pass(func, msg_size);
+}
+
 int
 p4_put_latency()
 {
@@ -49,11 +459,7 @@ p4_put_latency()
   ptl_handle_le_t le_h;
   ptl_handle_me_t me_h;
   ptl_index_t index;
-  ptl_ct_event_t ct_event;
-  ptl_ct_event_t zero = {.success = 0, .failure = 0};
-  ptl_event_t event;
   void* buffer = NULL;
-  double t0, t;
 
   eret = p4_pt_alloc(&ctx, &index);
   if(PTL_OK != eret)
@@ -61,8 +467,7 @@ p4_put_latency()
   ptl_match_bits_t match_bits = opts.ni_mode == MATCHING ? 0xDEADBEEF : 0;
 
   // print header
-  if(0 == rank)
-    fprintf(stdout, "func,msg_size,latency\n");
+  print_header("func,msg_size,latency,locality");
 
   for(size_t msg_size = opts.min_msg_size; msg_size <= opts.max_msg_size;
       msg_size *= 2)
@@ -103,46 +508,8 @@ p4_put_latency()
         return eret;
       }
 
-      for(int i = 0; i < opts.iterations + opts.warmup; ++i)
-      {
-        if(opts.cache_state == COLD_CACHE)
-        {
-          invalidate_cache(cache_buffer, cache_buffer_size);
-        }
-        if(i >= opts.warmup)
-        {
-          t0 = MPI_Wtime();
-        }
-
-        eret = PtlPut(md_h, 0, msg_size, PTL_ACK_REQ, ctx.peer_addr, index,
-                      match_bits, 0, NULL, 0);
-
-        if(PTL_OK != eret)
-        {
-          fprintf(stderr, "PtlPut failed with %i\n", eret);
-          p4_md_free(md_h);
-          free(buffer);
-          return eret;
-        }
-
-        wait_for_completion(1);
-
-        if(i >= opts.warmup)
-        {
-          t = MPI_Wtime() - t0;
-          fprintf(stdout, "put,%lu,%.4f\n", msg_size, t * 1e6);
-          fflush(stdout);
-        }
-      }
-      if(0 == rank && COUNTING == opts.event_type)
-      {
-        eret = PtlCTSet(ctx.ct_h, zero);
-        if(PTL_OK != eret)
-        {
-          fprintf(stderr, "PtlCTSet failed %i\n", eret);
-          return eret;
-        }
-      }
+      time_latency_pass("put", 0, md_h, msg_size, index, match_bits, NULL,
+                        NULL);
       p4_md_free(md_h);
     }
     MPI_Barrier(MPI_COMM_WORLD);
@@ -155,6 +522,7 @@ p4_put_latency()
     }
     free(buffer);
   }
+  p4_pt_free(&ctx, index);
   return 0;
 }
 
@@ -166,19 +534,14 @@ p4_get_latency()
   ptl_handle_le_t le_h;
   ptl_handle_me_t me_h;
   ptl_index_t index;
-  ptl_ct_event_t ct_event;
-  ptl_ct_event_t zero = {.success = 0, .failure = 0};
-  ptl_event_t event;
   void* buffer = NULL;
-  double t0, t;
 
   eret = p4_pt_alloc(&ctx, &index);
   if(PTL_OK != eret)
     return eret;
   ptl_match_bits_t match_bits = opts.ni_mode == MATCHING ? 0xDEADBEEF : 0;
   // print header
-  if(0 == rank)
-    fprintf(stdout, "func,msg_size,latency\n");
+  print_header("func,msg_size,latency,locality");
 
   for(size_t msg_size = opts.min_msg_size; msg_size <= opts.max_msg_size;
       msg_size *= 2)
@@ -213,43 +576,8 @@ p4_get_latency()
         return eret;
       }
 
-      for(int i = 0; i < opts.iterations + opts.warmup; ++i)
-      {
-        if(opts.cache_state == COLD_CACHE)
-        {
-          invalidate_cache(cache_buffer, cache_buffer_size);
-        }
-        if(i >= opts.warmup)
-        {
-          t0 = MPI_Wtime();
-        }
-        eret = PtlGet(md_h, 0, msg_size, ctx.peer_addr, index, match_bits, 0,
-                      NULL);
-        if(PTL_OK != eret)
-        {
-          p4_md_free(md_h);
-          free(buffer);
-          return eret;
-        }
-
-        wait_for_completion(1);
-
-        if(i >= opts.warmup)
-        {
-          t = MPI_Wtime() - t0;
-          fprintf(stdout, "get,%lu,%.4f\n", msg_size, t * 1e6);
-          fflush(stdout);
-        }
-      }
-      if(0 == rank && COUNTING == opts.event_type)
-      {
-        eret = PtlCTSet(ctx.ct_h, zero);
-        if(PTL_OK != eret)
-        {
-          fprintf(stderr, "PtlCTSet failed with %i\n");
-          return eret;
-        }
-      }
+      time_latency_pass("get", 0, md_h, msg_size, index, match_bits, NULL,
+                        NULL);
       p4_md_free(md_h);
     }
     MPI_Barrier(MPI_COMM_WORLD);
@@ -262,6 +590,91 @@ p4_get_latency()
     }
     free(buffer);
   }
+  p4_pt_free(&ctx, index);
+  return 0;
+}
+
+/*
+ * Runs the latency loop with the communication replaced by a zero-byte
+ * operation, a PtlCTInc on the local CT and no operation at all. The rows are
+ * appended to the latency results so that the harness overhead (loop, cache
+ * checks, timer reads, completion polling) can be subtracted from them.
+ */
+int
+p4_latency_calibration()
+{
+  int eret = -1;
+  ptl_handle_md_t md_h;
+  ptl_handle_le_t le_h;
+  ptl_handle_me_t me_h;
+  ptl_index_t index;
+  const calibration_op_t calibration_ops[] = {ZERO_BYTE_OP, CT_INC_OP,
+                                              NULL_OP};
+  void* buffer = NULL;
+
+  // rank 1 waits in the final barrier, every failure has to abort
+  eret = p4_pt_alloc(&ctx, &index);
+  if(PTL_OK != eret || 0 > alloc_buffer_init(&buffer, 1))
+  {
+    fprintf(stderr, "Failed to set up the calibration\n");
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+  ptl_match_bits_t match_bits = opts.ni_mode == MATCHING ? 0xDEADBEEF : 0;
+
+  if(1 == rank)
+  {
+    if(MATCHING == opts.ni_mode)
+      eret = p4_me_insert_persistent(&ctx, &me_h, buffer, 1, index);
+    else
+      eret = p4_le_insert(&ctx, &le_h, buffer, 1, index);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "List entry insertion failed\n");
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  if(0 == rank)
+  {
+    if(COUNTING == opts.event_type)
+      eret = p4_md_alloc_ct(&ctx, &md_h, buffer, 1);
+    else
+      eret = p4_md_alloc_eq(&ctx, &md_h, buffer, 1);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "md alloc failed with %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+
+    for(int c = 0; c < 3; ++c)
+    {
+      const calibration_op_t op = calibration_ops[c];
+      const char* const func = calibration_op_str(op);
+      double min_t = 0.0;
+      double sum = 0.0;
+
+      // the zero-byte operation is the regular put or get without payload
+      time_latency_pass(func, ZERO_BYTE_OP == op ? 0 : op, md_h, 0, index,
+                        match_bits, &min_t, &sum);
+      if(!opts.adaptive && 0 < opts.iterations)
+        fprintf(stderr, "%s: floor %.4f us, mean %.4f us\n", func,
+                min_t * 1e6, sum * 1e6 / opts.iterations);
+    }
+    fflush(stderr);
+    p4_md_free(md_h);
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+  if(1 == rank)
+  {
+    if(MATCHING == opts.ni_mode)
+      p4_me_remove(me_h);
+    else
+      p4_le_remove(le_h);
+  }
+  free(buffer);
+  p4_pt_free(&ctx, index);
   return 0;
 }
 
@@ -289,8 +702,7 @@ p4_put_bandwidth()
   }
   ptl_match_bits_t match_bits = opts.ni_mode == MATCHING ? 0xDEADBEEF : 0;
   // print header
-  if(0 == rank)
-    fprintf(stdout, "func,msg_size,bandwidth\n");
+  print_header("func,msg_size,bandwidth,locality");
 
   for(size_t msg_size = opts.min_msg_size; msg_size <= opts.max_msg_size;
       msg_size *= 2)
@@ -334,7 +746,7 @@ p4_put_bandwidth()
         return eret;
       }
 
-      for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+      for(int i = 0; keep_sampling(i); ++i)
       {
         if(opts.cache_state == COLD_CACHE)
         {
@@ -364,9 +776,7 @@ p4_put_bandwidth()
         if(i >= opts.warmup)
         {
           t = MPI_Wtime() - t0;
-          fprintf(stdout, "put,%lu,%.4f\n", msg_size,
-                  (msg_size * opts.window_size * 1e-6) / t);
-          fflush(stdout);
+          report_sample("put", msg_size, t);
         }
         if(0 == rank && COUNTING == opts.event_type)
         {
@@ -379,6 +789,7 @@ p4_put_bandwidth()
           }
         }
       }
+      report_pass("put", msg_size);
       p4_md_free(md_h);
     }
     MPI_Barrier(MPI_COMM_WORLD);
@@ -391,6 +802,7 @@ p4_put_bandwidth()
     }
     free(buffer);
   }
+  p4_pt_free(&ctx, index);
   return 0;
 }
 
@@ -414,8 +826,7 @@ p4_get_bandwidth()
     return eret;
   ptl_match_bits_t match_bits = opts.ni_mode == MATCHING ? 0xDEADBEEF : 0;
   // print header
-  if(0 == rank)
-    fprintf(stdout, "func,msg_size,bandwidth\n");
+  print_header("func,msg_size,bandwidth,locality");
 
   for(size_t msg_size = opts.min_msg_size; msg_size <= opts.max_msg_size;
       msg_size *= 2)
@@ -452,7 +863,7 @@ p4_get_bandwidth()
         return eret;
       }
 
-      for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+      for(int i = 0; keep_sampling(i); ++i)
       {
         if(opts.cache_state == COLD_CACHE)
         {
@@ -481,9 +892,7 @@ p4_get_bandwidth()
         if(i >= opts.warmup)
         {
           t = MPI_Wtime() - t0;
-          fprintf(stdout, "get,%lu,%.4f\n", msg_size,
-                  (msg_size * opts.window_size * 1e-6) / t);
-          fflush(stdout);
+          report_sample("get", msg_size, t);
         }
 
         if(0 == rank && COUNTING == opts.event_type)
@@ -496,6 +905,7 @@ p4_get_bandwidth()
           }
         }
       }
+      report_pass("get", msg_size);
       p4_md_free(md_h);
     }
     MPI_Barrier(MPI_COMM_WORLD);
@@ -508,9 +918,275 @@ p4_get_bandwidth()
     }
     free(buffer);
   }
+  p4_pt_free(&ctx, index);
+  return 0;
+}
+
+// keeps window_size bulk puts in flight
+static void
+top_up_bulk(const ptl_handle_md_t md_h, const ptl_handle_ct_t ct_h,
+            const size_t bulk_size, const ptl_match_bits_t match_bits,
+            ptl_size_t* const issued)
+{
+  ptl_ct_event_t ct_event;
+  int eret = PtlCTGet(ct_h, &ct_event);
+  if(PTL_OK != eret || ct_event.failure > 0)
+  {
+    fprintf(stderr, "PtlCTGet failed\n");
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+  while(*issued - ct_event.success < (ptl_size_t)opts.window_size)
+  {
+    eret = PtlPut(md_h, 0, bulk_size, PTL_ACK_REQ, ctx.peer_addr, BULK_INDEX,
+                  match_bits, 0, NULL, 0);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "PtlPut failed with %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+    ++*issued;
+  }
+}
+
+/*
+ * Latency of probe_size puts or gets while a stream of bulk puts runs next to
+ * them on its own PT, MD and CT. The bulk size sweeps the message size range
+ * after a first pass without load (bulk_size 0); the initiator tops the
+ * stream up to window_size puts before every probe and while it polls for the
+ * probe to complete, so the probe always queues behind a full window.
+ */
+int
+p4_loaded_latency()
+{
+  int eret = -1;
+  ptl_handle_md_t md_h;
+  ptl_handle_md_t bulk_md_h;
+  ptl_handle_le_t le_h;
+  ptl_handle_le_t bulk_le_h;
+  ptl_handle_me_t me_h;
+  ptl_handle_me_t bulk_me_h;
+  ptl_handle_ct_t bulk_ct;
+  ptl_index_t index;
+  ptl_index_t bulk_index;
+  ptl_ct_event_t ct_event;
+  ptl_ct_event_t zero = {.success = 0, .failure = 0};
+  void* buffer = NULL;
+  void* bulk_buffer = NULL;
+  double* time = NULL;
+  ptl_size_t issued, done;
+  double t0, t_start, elapsed;
+
+  eret = p4_pt_alloc(&ctx, &index);
+  if(PTL_OK != eret)
+    return eret;
+  eret = PtlPTAlloc(ctx.ni_h, 0, ctx.eq_h, BULK_INDEX, &bulk_index);
+  if(PTL_OK != eret)
+    return eret;
+  eret = PtlCTAlloc(ctx.ni_h, &bulk_ct);
+  if(PTL_OK != eret)
+    return eret;
+  ptl_match_bits_t match_bits = opts.ni_mode == MATCHING ? 0xDEADBEEF : 0;
+
+  time = malloc(opts.iterations * sizeof(double));
+  if(NULL == time || 0 > alloc_buffer_init(&buffer, opts.probe_size) ||
+     0 > alloc_buffer_init(&bulk_buffer, opts.max_msg_size))
+    return -1;
+
+  // every bulk put lands at offset 0 of the same entry
+  if(1 == rank)
+  {
+    if(MATCHING == opts.ni_mode)
+    {
+      eret = p4_me_insert_persistent(&ctx, &me_h, buffer, opts.probe_size,
+                                     index);
+      if(PTL_OK == eret)
+        eret = p4_me_insert_persistent(&ctx, &bulk_me_h, bulk_buffer,
+                                       opts.max_msg_size, bulk_index);
+    }
+    else
+    {
+      eret = p4_le_insert(&ctx, &le_h, buffer, opts.probe_size, index);
+      if(PTL_OK == eret)
+        eret = p4_le_insert(&ctx, &bulk_le_h, bulk_buffer, opts.max_msg_size,
+                            bulk_index);
+    }
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "List entry insertion failed\n");
+      return eret;
+    }
+  }
+  else
+  {
+    ptl_md_t md = {.start = bulk_buffer,
+                   .length = opts.max_msg_size,
+                   .options = PTL_MD_EVENT_CT_ACK |
+                              PTL_MD_EVENT_SUCCESS_DISABLE,
+                   .eq_handle = PTL_EQ_NONE,
+                   .ct_handle = bulk_ct};
+    eret = p4_md_alloc_ct(&ctx, &md_h, buffer, opts.probe_size);
+    if(PTL_OK == eret)
+      eret = PtlMDBind(ctx.ni_h, &md, &bulk_md_h);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "md alloc failed with %i\n", eret);
+      return eret;
+    }
+    print_header("func,bulk_size,probe_size,latency,locality");
+    fprintf(stderr, "func,bulk_size,probe_size,median,p99,max,"
+                    "bulk_bandwidth\n");
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  for(size_t bulk_size = 0; bulk_size <= opts.max_msg_size;
+      bulk_size = 0 == bulk_size ? opts.min_msg_size : 2 * bulk_size)
+  {
+    if(0 == rank)
+    {
+      const char* const func = PUT == opts.op ? "put" : "get";
+
+      issued = 0;
+      done = 0;
+      PtlCTSet(ctx.ct_h, zero);
+      PtlCTSet(bulk_ct, zero);
+      start_host_pass();
+      t_start = MPI_Wtime();
+
+      for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+      {
+        if(opts.cache_state == COLD_CACHE)
+        {
+          invalidate_cache(cache_buffer, cache_buffer_size);
+        }
+        if(0 < bulk_size)
+          top_up_bulk(bulk_md_h, bulk_ct, bulk_size, match_bits, &issued);
+
+        t0 = MPI_Wtime();
+        if(PUT == opts.op)
+          eret = PtlPut(md_h, 0, opts.probe_size, PTL_ACK_REQ, ctx.peer_addr,
+                        index, match_bits, 0, NULL, 0);
+        else
+          eret = PtlGet(md_h, 0, opts.probe_size, ctx.peer_addr, index,
+                        match_bits, 0, NULL);
+        if(PTL_OK != eret)
+        {
+          fprintf(stderr, "%s failed with %i\n", func, eret);
+          MPI_Abort(MPI_COMM_WORLD, eret);
+        }
+        ++done;
+
+        // without a stream to feed, the probe is waited for, not polled
+        if(0 == bulk_size)
+          eret = PtlCTWait(ctx.ct_h, done, &ct_event);
+        else
+        {
+          do
+          {
+            top_up_bulk(bulk_md_h, bulk_ct, bulk_size, match_bits, &issued);
+            eret = PtlCTGet(ctx.ct_h, &ct_event);
+          } while(PTL_OK == eret && 0 == ct_event.failure &&
+                  ct_event.success < done);
+        }
+        if(PTL_OK != eret || ct_event.failure > 0)
+        {
+          fprintf(stderr, "probe completion failed\n");
+          MPI_Abort(MPI_COMM_WORLD, eret);
+        }
+
+        if(i >= opts.warmup)
+          time[i - opts.warmup] = MPI_Wtime() - t0;
+      }
+
+      elapsed = MPI_Wtime() - t_start;
+      PtlCTGet(bulk_ct, &ct_event);
+      const double bandwidth = ct_event.success * bulk_size * 1e-6 / elapsed;
+      eret = PtlCTWait(bulk_ct, issued, &ct_event);
+      if(PTL_OK != eret || ct_event.failure > 0)
+      {
+        fprintf(stderr, "PtlCTWait failed\n");
+        MPI_Abort(MPI_COMM_WORLD, eret);
+      }
+
+      update_host_column();
+      for(int i = 0; i < opts.iterations; ++i)
+        fprintf(stdout, "%s,%lu,%lu,%.4f,%s%s%s\n", func, bulk_size,
+                opts.probe_size, time[i] * 1e6,
+                INTRA_NODE == locality ? "intra" : "inter", host_column,
+                pids_column);
+      fflush(stdout);
+
+      // median() leaves the samples sorted
+      const double med = median(time, opts.iterations);
+      fprintf(stderr, "%s,%lu,%lu,%.4f,%.4f,%.4f,%.4f\n", func, bulk_size,
+              opts.probe_size, med * 1e6,
+              time[(size_t)(0.99 * (opts.iterations - 1))] * 1e6,
+              time[opts.iterations - 1] * 1e6, bandwidth);
+      fflush(stderr);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+  }
+
+  if(0 == rank)
+  {
+    PtlMDRelease(bulk_md_h);
+    p4_md_free(md_h);
+  }
+  else if(MATCHING == opts.ni_mode)
+  {
+    p4_me_remove(bulk_me_h);
+    p4_me_remove(me_h);
+  }
+  else
+  {
+    p4_le_remove(bulk_le_h);
+    p4_le_remove(le_h);
+  }
+  PtlCTFree(bulk_ct);
+  PtlPTFree(ctx.ni_h, bulk_index);
+  p4_pt_free(&ctx, index);
+  free(bulk_buffer);
+  free(buffer);
+  free(time);
   return 0;
 }
 
+// host bandwidth of every rank without and with the communication
+static void
+report_stream_load(const double idle, const double run)
+{
+  const double mine[2] = {idle, run};
+  double* all = malloc(2 * num_ranks * sizeof(double));
+  if(NULL == all)
+    return;
+
+  MPI_Gather(mine, 2, MPI_DOUBLE, all, 2, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  if(0 == rank)
+  {
+    fprintf(stderr, "rank,host_bw_idle,host_bw_run,host_bw_ratio\n");
+    for(int r = 0; r < num_ranks; ++r)
+      fprintf(stderr, "%i,%.1f,%.1f,%.3f\n", r, all[2 * r],
+              all[2 * r + 1], all[2 * r + 1] / all[2 * r]);
+    fflush(stderr);
+  }
+  free(all);
+}
+
+// writes the cache pids setting on every node and tags the following rows
+static void
+apply_cache_pids(const int pids)
+{
+  if(0 > set_cache_regions(pids))
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  snprintf(pids_column, sizeof(pids_column), ",%i", pids);
+  if(0 == rank)
+  {
+    fprintf(stderr, "cache_pids: %i\n", pids);
+    fflush(stderr);
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+}
+
 void
 print_help_message()
 {
@@ -522,6 +1198,22 @@ print_help_message()
                   "argument required)\n");
   fprintf(stdout, "  -g, --get                      Enable get operation (no "
                   "argument required)\n");
+  fprintf(stdout,
+          "  -l, --loaded                   Measure probe latency under a "
+          "stream of bulk puts of each message size (no argument "
+          "required)\n");
+  fprintf(stdout, "  --probe_size <value>           Size of the probe messages "
+                  "in loaded mode (default 8)\n");
+  fprintf(stdout,
+          "  --stream_threads <value>       Run a STREAM kernel in this many "
+          "helper threads per rank during the run (default 0)\n");
+  fprintf(stdout, "  --stream_kernel <value>        STREAM kernel: copy, triad "
+                  "(default copy)\n");
+  fprintf(stdout,
+          "  --stream_intensity <value>     Fraction of the time the helper "
+          "threads are busy (default 1.0)\n");
+  fprintf(stdout, "  --stream_size <value>          Size of each STREAM array "
+                  "in MiB (default 32)\n");
   fprintf(stdout,
           "  -i, --iterations <value>       Specify the number of iterations "
           "(required argument)\n");
@@ -547,6 +1239,37 @@ print_help_message()
   fprintf(stdout,
           "  -f, --full                     Enable full mode (no argument "
           "required)\n");
+  fprintf(stdout,
+          "  -a, --adaptive                 Sample each message size until the "
+          "95%% CI is narrow enough or the time budget is spent; warmup is "
+          "detected automatically (no argument required)\n");
+  fprintf(stdout,
+          "  --ci_width <value>             Target relative width of the CI in "
+          "adaptive mode (default 0.02)\n");
+  fprintf(stdout,
+          "  --time_budget <value>          Seconds per message size in "
+          "adaptive mode (default 10)\n");
+  fprintf(stdout, "  --ci_mean                      Use the CI of the mean "
+                  "instead of the median (no argument required)\n");
+  fprintf(stdout,
+          "  --timeline <file>              Record every sample with the "
+          "context switches and interrupts of its interval and write them to "
+          "<file> after the run (required argument)\n");
+  fprintf(stdout,
+          "  --timeline_interval <value>    Samples per interval (default "
+          "100)\n");
+  fprintf(stdout, "  --timeline_size <value>        Capacity of the timeline "
+                  "ring buffer in samples (default 65536)\n");
+  fprintf(stdout,
+          "  --calibrate                    Append zero-byte, CT increment and "
+          "null operation rows measuring the harness overhead (latency "
+          "only)\n");
+  fprintf(stdout, "  -p, --pids <value>             Write the v2p cache pids "
+                  "setting before the run\n");
+  fprintf(stdout, "  --pids_sweep <list>            Re-run the benchmark for "
+                  "each comma separated cache pids setting\n");
+  fprintf(stdout, "  --pids_path <path>             Cache pids sysfs file "
+                  "(default $PTLBENCH_V2P_CACHE_PIDS or the build default)\n");
   fprintf(stdout,
           "  -h, --help                     Display this help message (no "
           "argument required)\n");
@@ -560,7 +1283,10 @@ print_benchmark_opts()
   fprintf(stderr, "ni_mode: %s\n",
           opts.ni_mode == MATCHING ? "MATCHING" : "NON MATCHING");
   fprintf(stderr, "op: %s\n", opts.op == PUT ? "PUT" : "GET");
-  fprintf(stderr, "type: %s\n", opts.type == LATENCY ? "LATENCY" : "BANDWIDTH");
+  fprintf(stderr, "type: %s\n",
+          opts.type == LATENCY
+              ? "LATENCY"
+              : (opts.type == BANDWIDTH ? "BANDWIDTH" : "LOADED_LATENCY"));
   fprintf(stderr, "event_type: %s\n",
           opts.event_type == COUNTING ? "COUNTING" : "FULL");
   fprintf(stderr, "iterations: %i\n", opts.iterations);
@@ -569,7 +1295,25 @@ print_benchmark_opts()
   fprintf(stderr, "msg_size: %i\n", opts.msg_size);
   fprintf(stderr, "min_msg_size: %i\n", opts.min_msg_size);
   fprintf(stderr, "max_msg_size: %i\n", opts.max_msg_size);
+  if(LOADED_LATENCY == opts.type)
+    fprintf(stderr, "probe_size: %lu\n", opts.probe_size);
+  if(0 < opts.stream_threads)
+    fprintf(stderr, "stream: %i threads, %s, intensity %.2f, %lu MiB arrays\n",
+            opts.stream_threads,
+            STREAM_COPY == opts.stream_kernel ? "copy" : "triad",
+            opts.stream_intensity, opts.stream_size / MiB);
+  else
+    fprintf(stderr, "stream: NO\n");
   fprintf(stderr, "cache_size: %lu\n", opts.cache_size);
+  fprintf(stderr, "locality: %s\n",
+          INTRA_NODE == locality ? "INTRA_NODE" : "INTER_NODE");
+  fprintf(stderr, "calibrate: %s\n", opts.calibrate ? "YES" : "NO");
+  if(opts.adaptive)
+    fprintf(stderr, "adaptive: %s ci width %.4f, time budget %.1f s\n",
+            CI_MEAN == opts.ci_stat ? "mean" : "median", opts.ci_width,
+            opts.time_budget);
+  else
+    fprintf(stderr, "adaptive: NO\n");
   fprintf(stderr, "cache_state: %s\n\n",
           opts.cache_state == COLD_CACHE ? "COLD_CACHE" : "HOT_CACHE");
   fflush(stderr);
@@ -579,6 +1323,7 @@ int
 main(int argc, char* argv[])
 {
   int eret = -1;
+  double stream_idle = 0.0;
 
   static const struct option long_opts[] = {
       {"matching", no_argument, NULL, 'm'},
@@ -594,9 +1339,25 @@ main(int argc, char* argv[])
       {"cold_cache", no_argument, NULL, 4},
       {"full", no_argument, NULL, 'f'},
       {"pids", required_argument, NULL, 'p'},
+      {"calibrate", no_argument, NULL, 5},
+      {"adaptive", no_argument, NULL, 'a'},
+      {"ci_width", required_argument, NULL, 6},
+      {"time_budget", required_argument, NULL, 7},
+      {"ci_mean", no_argument, NULL, 8},
+      {"timeline", required_argument, NULL, 9},
+      {"timeline_interval", required_argument, NULL, 10},
+      {"timeline_size", required_argument, NULL, 11},
+      {"pids_sweep", required_argument, NULL, 12},
+      {"pids_path", required_argument, NULL, 13},
+      {"loaded", no_argument, NULL, 'l'},
+      {"probe_size", required_argument, NULL, 14},
+      {"stream_threads", required_argument, NULL, 15},
+      {"stream_kernel", required_argument, NULL, 16},
+      {"stream_intensity", required_argument, NULL, 17},
+      {"stream_size", required_argument, NULL, 18},
       {"help", no_argument, NULL, 'h'}};
 
-  const char* const short_opts = "mbgi:x:w:c:fp:h";
+  const char* const short_opts = "mbgli:x:w:c:fp:ah";
 
   opts.ni_mode = NON_MATCHING;
   opts.op = PUT;
@@ -610,6 +1371,16 @@ main(int argc, char* argv[])
   opts.event_type = COUNTING;
   opts.cache_size = _16MiB;
   opts.cache_state = HOT_CACHE;
+  opts.ci_width = 0.02;
+  opts.time_budget = 10.0;
+  opts.ci_stat = CI_MEDIAN;
+  opts.timeline_path = NULL;
+  opts.timeline_size = 65536;
+  opts.timeline_interval = 100;
+  opts.probe_size = 8;
+  opts.stream_kernel = STREAM_COPY;
+  opts.stream_intensity = 1.0;
+  opts.stream_size = 32 * MiB;
 
   while(1)
   {
@@ -629,6 +1400,9 @@ main(int argc, char* argv[])
     case 'g':
       opts.op = GET;
       break;
+    case 'l':
+      opts.type = LOADED_LATENCY;
+      break;
     case 'i':
       opts.iterations = atoi(optarg);
       break;
@@ -640,7 +1414,8 @@ main(int argc, char* argv[])
       opts.cache_size *= MiB;
       break;
     case 'p':
-      set_cache_regions(atoi(optarg));
+      cache_pids[0] = atoi(optarg);
+      num_cache_pids = 1;
       break;
     case 1:
       opts.msg_size = atoi(optarg);
@@ -656,6 +1431,71 @@ main(int argc, char* argv[])
     case 4:
       opts.cache_state = COLD_CACHE;
       break;
+    case 5:
+      opts.calibrate = 1;
+      break;
+    case 'a':
+      opts.adaptive = 1;
+      break;
+    case 6:
+      opts.ci_width = atof(optarg);
+      break;
+    case 7:
+      opts.time_budget = atof(optarg);
+      break;
+    case 8:
+      opts.ci_stat = CI_MEAN;
+      break;
+    case 9:
+      opts.timeline_path = optarg;
+      break;
+    case 10:
+      opts.timeline_interval = atoi(optarg);
+      break;
+    case 11:
+      opts.timeline_size = atol(optarg);
+      break;
+    case 12:
+      num_cache_pids =
+          parse_cache_pids_list(optarg, cache_pids, MAX_CACHE_PIDS_SETTINGS);
+      if(0 >= num_cache_pids)
+      {
+        print_help_message();
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 13:
+      set_cache_regions_path(optarg);
+      break;
+    case 14:
+      opts.probe_size = atol(optarg);
+      break;
+    case 15:
+      opts.stream_threads = atoi(optarg);
+      break;
+    case 16:
+      if(0 == strcmp(optarg, "copy"))
+        opts.stream_kernel = STREAM_COPY;
+      else if(0 == strcmp(optarg, "triad"))
+        opts.stream_kernel = STREAM_TRIAD;
+      else
+      {
+        print_help_message();
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 17:
+      opts.stream_intensity = atof(optarg);
+      if(0.0 >= opts.stream_intensity || 1.0 < opts.stream_intensity)
+      {
+        print_help_message();
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 18:
+      opts.stream_size = atol(optarg);
+      opts.stream_size *= MiB;
+      break;
     case 'w':
       opts.window_size = atol(optarg);
       break;
@@ -674,6 +1514,17 @@ main(int argc, char* argv[])
     }
   } // end while
 
+  // the calibration rows are appended to the latency results only
+  if(opts.calibrate && LATENCY != opts.type)
+  {
+    print_help_message();
+    exit(EXIT_FAILURE);
+  }
+
+  // warmup is detected from the samples themselves
+  if(opts.adaptive)
+    opts.warmup = 0;
+
   MPI_Init(&argc, &argv);
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
@@ -684,9 +1535,30 @@ main(int argc, char* argv[])
     MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
   }
 
+  locality = get_peer_locality((rank + 1) % 2);
+
   if(0 == rank)
     print_benchmark_opts();
 
+  if(hold_samples() && 0 == rank &&
+     0 > adaptive_init(&sampler,
+                       opts.adaptive ? ADAPTIVE_MAX_SAMPLES : opts.iterations,
+                       opts.ci_width, opts.time_budget, opts.ci_stat))
+  {
+    fprintf(stderr, "Failed to allocate the sample buffer\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  // only the initiator records samples
+  if(1 == rank)
+    opts.timeline_path = NULL;
+  if(NULL != opts.timeline_path &&
+     0 > timeline_init(&timeline, opts.timeline_size, opts.timeline_interval))
+  {
+    fprintf(stderr, "Failed to allocate the timeline\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
   PtlInit();
 
   eret = init_p4_ctx(&ctx, opts.ni_mode);
@@ -709,30 +1581,71 @@ main(int argc, char* argv[])
     goto END;
   }
 
-  if(LATENCY == opts.type)
+  // every node saves its setting before any rank overwrites it
+  if(0 < num_cache_pids)
   {
-    if(opts.op == PUT)
-    {
-      p4_put_latency();
-    }
-    else
+    save_cache_regions();
+    MPI_Barrier(MPI_COMM_WORLD);
+  }
+
+  if(0 < opts.stream_threads)
+  {
+    stream_idle = start_stream_load();
+    if(0.0 > stream_idle)
     {
-      p4_get_latency();
+      fprintf(stderr, "Failed to start the STREAM threads\n");
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
+    MPI_Barrier(MPI_COMM_WORLD);
   }
-  else if(BANDWIDTH == opts.type)
+
+  for(int s = 0; s < num_cache_pids || 0 == s; ++s)
   {
-    if(opts.op == PUT)
+    if(0 < num_cache_pids)
+      apply_cache_pids(cache_pids[s]);
+
+    if(LATENCY == opts.type)
+    {
+      if(opts.op == PUT)
+      {
+        p4_put_latency();
+      }
+      else
+      {
+        p4_get_latency();
+      }
+      if(opts.calibrate)
+      {
+        eret = p4_latency_calibration();
+      }
+    }
+    else if(BANDWIDTH == opts.type)
     {
-      eret = p4_put_bandwidth();
+      if(opts.op == PUT)
+      {
+        eret = p4_put_bandwidth();
+      }
+      else
+      {
+        p4_get_bandwidth();
+      }
     }
-    else
+    else if(LOADED_LATENCY == opts.type)
     {
-      p4_get_bandwidth();
+      eret = p4_loaded_latency();
     }
   }
 
+  if(0 < opts.stream_threads)
+    report_stream_load(stream_idle, stop_stream_load());
+
 END:
+  if(NULL != opts.timeline_path)
+  {
+    timeline_dump(&timeline, opts.timeline_path);
+    timeline_free(&timeline);
+  }
+  adaptive_free(&sampler);
   destroy_p4_ctx(&ctx);
   PtlFini();
   MPI_Finalize();
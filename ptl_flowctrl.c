@@ -0,0 +1,574 @@
+#include "common.h"
+#include "util.h"
+#include <getopt.h>
+#include <stdint.h>
+
+static int rank;
+static int num_ranks;
+static benchmark_opts_t opts;
+static p4_ctx_t ctx;
+static locality_t locality;
+
+/*
+ * Flow control episodes on a PTL_PT_FLOWCTRL portal table. Rank 0 puts a
+ * burst of messages with acknowledgements to rank 1, whose PT can take only
+ * capacity of them: either its EQ has capacity slots and is not drained
+ * during the burst, or capacity use-once entries are posted on the overflow
+ * list. The message that finds no room disables the PT, it and every later
+ * one is acknowledged with PTL_NI_PT_DISABLED. Rank 0 reports the number of
+ * failed puts to rank 1, which drains its EQ up to PTL_EVENT_PT_DISABLED,
+ * posts new entries and calls PtlPTEnable. Rank 0 then retransmits the failed
+ * puts, until a round goes through without a failure.
+ */
+#define FLOW_INDEX 37
+
+typedef struct
+{
+  double rate;
+  int episodes;
+  int naks;
+  double recovery;
+  double target_recovery;
+} flow_sample_t;
+
+static void* buffer;
+static ptl_handle_md_t send_md;
+static ptl_handle_eq_t flow_eq;
+static ptl_handle_me_t flow_me;
+static ptl_handle_me_t* entries;
+static int* linked;
+static int* pending;
+static int* failed;
+
+static const char*
+exhaust_name(const exhaust_t exhaust)
+{
+  switch(exhaust)
+  {
+  case EXHAUST_EQ:
+    return "eq";
+  case EXHAUST_LIST:
+    return "list";
+  }
+  return "unknown";
+}
+
+static void
+post_entries()
+{
+  ptl_me_t me = {.start = buffer,
+                 .length = opts.msg_size,
+                 .options = PTL_ME_OP_PUT | PTL_ME_USE_ONCE |
+                            PTL_ME_EVENT_LINK_DISABLE |
+                            PTL_ME_EVENT_COMM_DISABLE |
+                            PTL_ME_UNEXPECTED_HDR_DISABLE,
+                 .ct_handle = PTL_CT_NONE,
+                 .uid = PTL_UID_ANY,
+                 .match_id = {.phys = {.nid = PTL_NID_ANY, .pid = PTL_PID_ANY}},
+                 .match_bits = 0,
+                 .ignore_bits = ~0ULL,
+                 .min_free = 0};
+
+  for(int i = 0; i < opts.capacity; ++i)
+  {
+    linked[i] = 1;
+    int eret = PtlMEAppend(ctx.ni_h, FLOW_INDEX, &me, PTL_OVERFLOW_LIST,
+                           &linked[i], &entries[i]);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "PtlMEAppend failed with %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+  }
+}
+
+/*
+ * Consumed entries report PTL_EVENT_AUTO_UNLINK, their handles are stale from
+ * then on. Returns 1 for the unlink and free events of the entries.
+ */
+static int
+track_entry(const ptl_event_t* const event)
+{
+  if(PTL_EVENT_AUTO_UNLINK == event->type)
+    *(int*)event->user_ptr = 0;
+  return PTL_EVENT_AUTO_UNLINK == event->type ||
+         PTL_EVENT_AUTO_FREE == event->type;
+}
+
+/*
+ * Target side of an episode: consumes the events in front of the disable
+ * event, gives the PT new resources and enables it again.
+ */
+static void
+recover()
+{
+  ptl_event_t event;
+
+  while(1)
+  {
+    int eret = PtlEQWait(flow_eq, &event);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "PtlEQWait failed with %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+    if(PTL_EVENT_PT_DISABLED == event.type)
+      break;
+    if(EXHAUST_LIST == opts.exhaust && track_entry(&event))
+      continue;
+    if(EXHAUST_EQ != opts.exhaust || PTL_EVENT_PUT != event.type)
+    {
+      fprintf(stderr, "Unexpected event %i\n", event.type);
+      MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+  }
+
+  if(EXHAUST_LIST == opts.exhaust)
+    post_entries();
+
+  int eret = PtlPTEnable(ctx.ni_h, FLOW_INDEX);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "PtlPTEnable failed with %i\n", eret);
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+}
+
+/*
+ * Puts count messages and collects their acknowledgements. The ids of the
+ * failed puts go to failed, the time of the first failure to first_nak.
+ */
+static int
+send_round(const int count, double* const first_nak)
+{
+  ptl_event_t event;
+  int num_failed = 0;
+
+  for(int i = 0; i < count; ++i)
+  {
+    int eret =
+        PtlPut(send_md, 0, opts.msg_size, PTL_ACK_REQ, ctx.peer_addr,
+               FLOW_INDEX, pending[i], 0, (void*)(uintptr_t)pending[i], 0);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "PtlPut failed with %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+  }
+
+  for(int i = 0; i < count; ++i)
+  {
+    int eret = PtlEQWait(ctx.eq_h, &event);
+    if(PTL_OK != eret || PTL_EVENT_ACK != event.type)
+    {
+      fprintf(stderr, "PtlEQWait failed with %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+    if(PTL_NI_PT_DISABLED == event.ni_fail_type)
+    {
+      if(0 == num_failed)
+        *first_nak = MPI_Wtime();
+      failed[num_failed++] = (uintptr_t)event.user_ptr;
+    }
+    else if(PTL_NI_OK != event.ni_fail_type)
+    {
+      fprintf(stderr, "Put failed with %i\n", event.ni_fail_type);
+      MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+  }
+  return num_failed;
+}
+
+static void
+send_burst(const int burst, flow_sample_t* const sample)
+{
+  double first_nak = 0.0;
+  int count = burst;
+  int enabled;
+
+  for(int i = 0; i < burst; ++i)
+    pending[i] = i;
+  sample->episodes = 0;
+  sample->naks = 0;
+  sample->recovery = 0.0;
+
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  const double t0 = MPI_Wtime();
+  while(1)
+  {
+    const int num_failed = send_round(count, &first_nak);
+    MPI_Send(&num_failed, 1, MPI_INT, 1, 0, MPI_COMM_WORLD);
+    if(0 == num_failed)
+      break;
+
+    MPI_Recv(&enabled, 1, MPI_INT, 1, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    sample->recovery += MPI_Wtime() - first_nak;
+    ++sample->episodes;
+    sample->naks += num_failed;
+
+    int* const swap = pending;
+    pending = failed;
+    failed = swap;
+    count = num_failed;
+  }
+  sample->rate = burst / (MPI_Wtime() - t0);
+
+  MPI_Recv(&sample->target_recovery, 1, MPI_DOUBLE, 1, 0, MPI_COMM_WORLD,
+           MPI_STATUS_IGNORE);
+}
+
+static void
+serve_burst()
+{
+  ptl_event_t event;
+  double recovery = 0.0;
+  int num_failed;
+  const int enabled = 1;
+
+  if(EXHAUST_LIST == opts.exhaust)
+    post_entries();
+
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  while(1)
+  {
+    MPI_Recv(&num_failed, 1, MPI_INT, 0, 0, MPI_COMM_WORLD,
+             MPI_STATUS_IGNORE);
+    if(0 == num_failed)
+      break;
+
+    const double t0 = MPI_Wtime();
+    recover();
+    recovery += MPI_Wtime() - t0;
+    MPI_Send(&enabled, 1, MPI_INT, 0, 0, MPI_COMM_WORLD);
+  }
+
+  // the last round went through, start the next burst with a clean PT
+  while(PTL_OK == PtlEQGet(flow_eq, &event))
+    track_entry(&event);
+  if(EXHAUST_LIST == opts.exhaust)
+  {
+    for(int i = 0; i < opts.capacity; ++i)
+      if(linked[i])
+        PtlMEUnlink(entries[i]);
+  }
+
+  MPI_Send(&recovery, 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+}
+
+/*
+ * Runs iterations + warmup bursts of the given size. Returns the median
+ * message rate of rank 0.
+ */
+static double
+run_burst(const char* const func, const int burst,
+          flow_sample_t* const samples, double* const scratch)
+{
+  flow_sample_t sample;
+
+  for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+  {
+    if(0 == rank)
+      send_burst(burst, &sample);
+    else
+      serve_burst();
+    if(0 == rank && i >= opts.warmup)
+      samples[i - opts.warmup] = sample;
+  }
+
+  if(0 != rank)
+    return 0.0;
+
+  for(int i = 0; i < opts.iterations; ++i)
+    fprintf(stdout, "%s,%s,%i,%i,%.1f,%i,%i,%.4f,%.4f,%s\n", func,
+            exhaust_name(opts.exhaust), burst, opts.capacity,
+            samples[i].rate, samples[i].episodes, samples[i].naks,
+            samples[i].recovery * 1e6, samples[i].target_recovery * 1e6,
+            INTRA_NODE == locality ? "intra" : "inter");
+  fflush(stdout);
+
+  for(int i = 0; i < opts.iterations; ++i)
+    scratch[i] = samples[i].rate;
+  return median(scratch, opts.iterations);
+}
+
+int
+run_flowctrl_benchmark()
+{
+  const int fitting = 1 < opts.capacity / 2 ? opts.capacity / 2 : 1;
+  flow_sample_t* samples = malloc(opts.iterations * sizeof(flow_sample_t));
+  double* scratch = malloc(opts.iterations * sizeof(double));
+  if(NULL == samples || NULL == scratch)
+    return -1;
+
+  if(0 == rank)
+    fprintf(stdout, "func,exhaust,burst,capacity,rate,episodes,naks,"
+                    "recovery,target_recovery,locality\n");
+
+  // a burst that fits sets the rate the episode is compared to
+  const double base_rate = run_burst("no_overflow", fitting, samples, scratch);
+  const double rate = run_burst("overflow", opts.burst, samples, scratch);
+
+  if(0 == rank)
+  {
+    for(int i = 0; i < opts.iterations; ++i)
+      scratch[i] = samples[i].recovery;
+    const double recovery = median(scratch, opts.iterations);
+    for(int i = 0; i < opts.iterations; ++i)
+      scratch[i] = samples[i].target_recovery;
+    const double target_recovery = median(scratch, opts.iterations);
+
+    fprintf(stderr, "exhaust,no_overflow_rate,overflow_rate,collapse,"
+                    "recovery,target_recovery\n");
+    fprintf(stderr, "%s,%.1f,%.1f,%.2f,%.4f,%.4f\n",
+            exhaust_name(opts.exhaust), base_rate, rate, base_rate / rate,
+            recovery * 1e6, target_recovery * 1e6);
+    fflush(stderr);
+  }
+
+  free(scratch);
+  free(samples);
+  return 0;
+}
+
+static int
+setup_flowctrl()
+{
+  ptl_index_t index;
+  int eret = -1;
+
+  if(0 > alloc_buffer_init(&buffer, opts.msg_size))
+    return -1;
+
+  if(0 == rank)
+  {
+    pending = malloc(opts.burst * sizeof(int));
+    failed = malloc(opts.burst * sizeof(int));
+    if(NULL == pending || NULL == failed)
+      return -1;
+    return p4_md_alloc_eq(&ctx, &send_md, buffer, opts.msg_size);
+  }
+
+  entries = malloc(opts.capacity * sizeof(ptl_handle_me_t));
+  linked = malloc(opts.capacity * sizeof(int));
+  if(NULL == entries || NULL == linked)
+    return -1;
+
+  // with the list exhausted, the EQ also holds an unlink and a free event of
+  // every entry and must not be the resource that runs out
+  eret = PtlEQAlloc(ctx.ni_h,
+                    EXHAUST_LIST == opts.exhaust ? 4 * opts.capacity
+                                                 : opts.capacity,
+                    &flow_eq);
+  if(PTL_OK != eret)
+    return eret;
+
+  eret = PtlPTAlloc(ctx.ni_h, PTL_PT_FLOWCTRL, flow_eq, FLOW_INDEX, &index);
+  if(PTL_OK != eret || EXHAUST_LIST == opts.exhaust)
+    return eret;
+
+  // every put raises an event into the small EQ
+  ptl_me_t me = {.start = buffer,
+                 .length = opts.msg_size,
+                 .options = PTL_ME_OP_PUT | PTL_ME_EVENT_LINK_DISABLE,
+                 .ct_handle = PTL_CT_NONE,
+                 .uid = PTL_UID_ANY,
+                 .match_id = {.phys = {.nid = PTL_NID_ANY, .pid = PTL_PID_ANY}},
+                 .match_bits = 0,
+                 .ignore_bits = ~0ULL,
+                 .min_free = 0};
+  return PtlMEAppend(ctx.ni_h, FLOW_INDEX, &me, PTL_PRIORITY_LIST, NULL,
+                     &flow_me);
+}
+
+static void
+free_flowctrl()
+{
+  if(0 == rank)
+  {
+    p4_md_free(send_md);
+    free(failed);
+    free(pending);
+  }
+  else
+  {
+    if(EXHAUST_EQ == opts.exhaust)
+      PtlMEUnlink(flow_me);
+    PtlPTFree(ctx.ni_h, FLOW_INDEX);
+    PtlEQFree(flow_eq);
+    free(linked);
+    free(entries);
+  }
+  free(buffer);
+}
+
+void
+print_help_message()
+{
+  fprintf(stdout, "Usage: [options]\n");
+  fprintf(stdout, "Options:\n");
+  fprintf(stdout,
+          "  -i, --iterations <value>       Specify the number of iterations "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  -x, --warmup <value>           Specify the number of warmup "
+          "iterations (required argument)\n");
+  fprintf(stdout, "  --msg_size <value>             Specify the message size "
+                  "(required argument)\n");
+  fprintf(stdout,
+          "  -b, --burst <value>            Number of puts in a burst "
+          "(default 1024)\n");
+  fprintf(stdout,
+          "  -c, --capacity <value>         EQ slots or overflow entries of "
+          "the target (default 64)\n");
+  fprintf(stdout,
+          "  -r, --exhaust <value>          Resource to exhaust: eq, list "
+          "(default eq)\n");
+  fprintf(stdout,
+          "  -h, --help                     Display this help message (no "
+          "argument required)\n");
+  fflush(stdout);
+}
+
+void
+print_benchmark_opts()
+{
+  fprintf(stderr, "Benchmark Configuration:\n\n");
+  fprintf(stderr, "locality: %s\n",
+          INTRA_NODE == locality ? "INTRA_NODE" : "INTER_NODE");
+  fprintf(stderr, "iterations: %i\n", opts.iterations);
+  fprintf(stderr, "warmup: %i\n", opts.warmup);
+  fprintf(stderr, "msg_size: %lu\n", opts.msg_size);
+  fprintf(stderr, "burst: %i\n", opts.burst);
+  fprintf(stderr, "capacity: %i\n", opts.capacity);
+  fprintf(stderr, "exhaust: %s\n\n", exhaust_name(opts.exhaust));
+  fflush(stderr);
+}
+
+int
+main(int argc, char* argv[])
+{
+  int eret = -1;
+
+  static const struct option long_opts[] = {
+      {"iterations", required_argument, NULL, 'i'},
+      {"warmup", required_argument, NULL, 'x'},
+      {"msg_size", required_argument, NULL, 1},
+      {"burst", required_argument, NULL, 'b'},
+      {"capacity", required_argument, NULL, 'c'},
+      {"exhaust", required_argument, NULL, 'r'},
+      {"help", no_argument, NULL, 'h'}};
+
+  const char* const short_opts = "i:x:b:c:r:h";
+
+  opts.ni_mode = MATCHING;
+  opts.iterations = 100;
+  opts.warmup = 10;
+  opts.msg_size = 8;
+  opts.burst = 1024;
+  opts.capacity = 64;
+  opts.exhaust = EXHAUST_EQ;
+
+  while(1)
+  {
+    const int opt = getopt_long(argc, argv, short_opts, long_opts, NULL);
+
+    if(-1 == opt)
+      break;
+
+    switch(opt)
+    {
+    case 'i':
+      opts.iterations = atoi(optarg);
+      break;
+    case 'x':
+      opts.warmup = atoi(optarg);
+      break;
+    case 1:
+      opts.msg_size = atol(optarg);
+      break;
+    case 'b':
+      opts.burst = atoi(optarg);
+      break;
+    case 'c':
+      opts.capacity = atoi(optarg);
+      break;
+    case 'r':
+      if(0 == strcmp(optarg, "eq"))
+        opts.exhaust = EXHAUST_EQ;
+      else if(0 == strcmp(optarg, "list"))
+        opts.exhaust = EXHAUST_LIST;
+      else
+      {
+        print_help_message();
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'h':
+      print_help_message();
+      exit(EXIT_SUCCESS);
+    case '?':
+      print_help_message();
+      exit(EXIT_FAILURE);
+    default:
+      print_help_message();
+      exit(EXIT_FAILURE);
+    }
+  } // end while
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+  if(2 != num_ranks)
+  {
+    fprintf(stdout, "Benchmark requires exactly two processes\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  // the acknowledgements of a burst must fit the EQ of rank 0
+  if(2 > opts.capacity || opts.burst <= opts.capacity || 4096 <= opts.burst)
+  {
+    fprintf(stdout, "capacity must be at least 2 and below burst, burst "
+                    "below 4096\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  locality = get_peer_locality((rank + 1) % 2);
+
+  if(0 == rank)
+    print_benchmark_opts();
+
+  PtlInit();
+
+  eret = init_p4_ctx(&ctx, opts.ni_mode);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "init failed with %i\n", eret);
+    goto END;
+  }
+
+  eret = exchange_ni_address(&ctx, rank);
+  if(0 > eret)
+  {
+    fprintf(stderr, " exchange failed\n");
+    goto END;
+  }
+
+  eret = setup_flowctrl();
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "flow control setup failed with %i\n", eret);
+    goto END;
+  }
+
+  eret = run_flowctrl_benchmark();
+  free_flowctrl();
+
+END:
+  destroy_p4_ctx(&ctx);
+  PtlFini();
+  MPI_Finalize();
+  return eret;
+}
@@ -0,0 +1,399 @@
+#include "common.h"
+#include "util.h"
+#include <getopt.h>
+
+static int rank;
+static int num_ranks;
+static benchmark_opts_t opts;
+static p4_ctx_t ctx;
+static ptl_process_t* peers;
+
+typedef enum { LOOPBACK = 1, SAME_NODE, REMOTE_NODE } path_t;
+
+static const char*
+path_name(const path_t path)
+{
+  switch(path)
+  {
+  case LOOPBACK:
+    return "loopback";
+  case SAME_NODE:
+    return "same_node";
+  case REMOTE_NODE:
+    return "remote_node";
+  }
+  return "unknown";
+}
+
+static void
+report(const char* func, const path_t path, const char* mode,
+       const size_t msg_size, const double value)
+{
+  fprintf(stdout, "%s,%s,%s,%s,%lu,%.4f\n", func, path_name(path),
+          REMOTE_NODE == path ? "inter" : "intra", mode, msg_size, value);
+  fflush(stdout);
+}
+
+/*
+ * Rank 0 puts into the persistent LE of the target and waits for the acks on
+ * its CT. The target is passive; for the loopback path rank 0 targets its own
+ * NI so the data leaves and re-enters through the same NIC.
+ */
+static void
+p4_put_path(const path_t path, const int target, const ptl_handle_md_t md_h,
+            const ptl_index_t index, ptl_size_t* const acks)
+{
+  int eret = -1;
+  ptl_ct_event_t ct_event;
+  double t0, t;
+
+  for(size_t msg_size = opts.min_msg_size; msg_size <= opts.max_msg_size;
+      msg_size *= 2)
+  {
+    for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+    {
+      t0 = MPI_Wtime();
+      eret = PtlPut(md_h, 0, msg_size, PTL_ACK_REQ, peers[target], index, 0, 0,
+                    NULL, 0);
+      if(PTL_OK != eret)
+      {
+        fprintf(stderr, "PtlPut failed with %i\n", eret);
+        MPI_Abort(MPI_COMM_WORLD, eret);
+      }
+      eret = PtlCTWait(ctx.ct_h, ++(*acks), &ct_event);
+      if(PTL_OK != eret || ct_event.failure > 0)
+      {
+        fprintf(stderr, "PtlCTWait failed\n");
+        MPI_Abort(MPI_COMM_WORLD, eret);
+      }
+      t = MPI_Wtime() - t0;
+      if(i >= opts.warmup)
+        report("PtlPut", path, "latency", msg_size, t * 1e6);
+    }
+
+    for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+    {
+      t0 = MPI_Wtime();
+      for(int w = 0; w < opts.window_size; ++w)
+      {
+        eret = PtlPut(md_h, w * msg_size, msg_size, PTL_ACK_REQ,
+                      peers[target], index, 0, w * msg_size, NULL, 0);
+        if(PTL_OK != eret)
+        {
+          fprintf(stderr, "PtlPut failed with %i\n", eret);
+          MPI_Abort(MPI_COMM_WORLD, eret);
+        }
+      }
+      *acks += opts.window_size;
+      eret = PtlCTWait(ctx.ct_h, *acks, &ct_event);
+      if(PTL_OK != eret || ct_event.failure > 0)
+      {
+        fprintf(stderr, "PtlCTWait failed\n");
+        MPI_Abort(MPI_COMM_WORLD, eret);
+      }
+      t = MPI_Wtime() - t0;
+      if(i >= opts.warmup)
+        report("PtlPut", path, "bandwidth", msg_size,
+               (msg_size * opts.window_size * 1e-6) / t);
+    }
+  }
+}
+
+/*
+ * Same pattern over MPI point-to-point: the message (or a window of messages)
+ * is acknowledged by a zero-byte reply, mirroring the Portals4 ack. Between
+ * ranks on one node this goes through the MPI shared-memory transport.
+ */
+static void
+mpi_path(const path_t path, const int target, char* const send_buffer,
+         char* const recv_buffer, MPI_Request* const reqs)
+{
+  double t0, t;
+
+  for(size_t msg_size = opts.min_msg_size; msg_size <= opts.max_msg_size;
+      msg_size *= 2)
+  {
+    for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+    {
+      if(0 == rank)
+      {
+        t0 = MPI_Wtime();
+        MPI_Send(send_buffer, msg_size, MPI_BYTE, target, 0, MPI_COMM_WORLD);
+        MPI_Recv(NULL, 0, MPI_BYTE, target, 1, MPI_COMM_WORLD,
+                 MPI_STATUS_IGNORE);
+        t = MPI_Wtime() - t0;
+        if(i >= opts.warmup)
+          report("MPI", path, "latency", msg_size, t * 1e6);
+      }
+      else
+      {
+        MPI_Recv(recv_buffer, msg_size, MPI_BYTE, 0, 0, MPI_COMM_WORLD,
+                 MPI_STATUS_IGNORE);
+        MPI_Send(NULL, 0, MPI_BYTE, 0, 1, MPI_COMM_WORLD);
+      }
+    }
+
+    for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+    {
+      if(0 == rank)
+      {
+        t0 = MPI_Wtime();
+        for(int w = 0; w < opts.window_size; ++w)
+          MPI_Isend(send_buffer + w * msg_size, msg_size, MPI_BYTE, target, 0,
+                    MPI_COMM_WORLD, reqs + w);
+        MPI_Waitall(opts.window_size, reqs, MPI_STATUSES_IGNORE);
+        MPI_Recv(NULL, 0, MPI_BYTE, target, 1, MPI_COMM_WORLD,
+                 MPI_STATUS_IGNORE);
+        t = MPI_Wtime() - t0;
+        if(i >= opts.warmup)
+          report("MPI", path, "bandwidth", msg_size,
+                 (msg_size * opts.window_size * 1e-6) / t);
+      }
+      else
+      {
+        for(int w = 0; w < opts.window_size; ++w)
+          MPI_Irecv(recv_buffer + w * msg_size, msg_size, MPI_BYTE, 0, 0,
+                    MPI_COMM_WORLD, reqs + w);
+        MPI_Waitall(opts.window_size, reqs, MPI_STATUSES_IGNORE);
+        MPI_Send(NULL, 0, MPI_BYTE, 0, 1, MPI_COMM_WORLD);
+      }
+    }
+  }
+}
+
+int
+run_locality_benchmark()
+{
+  int eret = -1;
+  ptl_handle_md_t md_h;
+  ptl_handle_le_t le_h;
+  ptl_index_t index;
+  ptl_size_t acks = 0;
+  void* send_buffer = NULL;
+  void* recv_buffer = NULL;
+  MPI_Request* reqs = NULL;
+  int* on_node = NULL;
+  int targets[3] = {0, -1, -1};
+  path_t paths[3] = {LOOPBACK, SAME_NODE, REMOTE_NODE};
+  size_t bytes = opts.window_size * opts.max_msg_size;
+
+  // classify every rank relative to rank 0
+  on_node = malloc(num_ranks * sizeof(int));
+  reqs = malloc(opts.window_size * sizeof(MPI_Request));
+  if(NULL == on_node || NULL == reqs)
+    goto FREE;
+  on_node[rank] = INTRA_NODE == get_peer_locality(0);
+  MPI_Allgather(MPI_IN_PLACE, 1, MPI_INT, on_node, 1, MPI_INT, MPI_COMM_WORLD);
+  for(int r = num_ranks - 1; r > 0; --r)
+  {
+    if(on_node[r])
+      targets[1] = r;
+    else
+      targets[2] = r;
+  }
+
+  if(0 == rank)
+  {
+    fprintf(stderr, "same_node peer: %i\n", targets[1]);
+    fprintf(stderr, "remote_node peer: %i\n\n", targets[2]);
+    fprintf(stdout, "func,path,locality,mode,msg_size,value\n");
+  }
+
+  eret = p4_pt_alloc(&ctx, &index);
+  if(PTL_OK != eret)
+    goto FREE;
+
+  if(0 > alloc_buffer_init(&send_buffer, bytes) ||
+     0 > alloc_buffer_init(&recv_buffer, bytes))
+  {
+    eret = -1;
+    goto PT_FREE;
+  }
+
+  eret = p4_le_insert(&ctx, &le_h, recv_buffer, bytes, index);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "List entry insertion failed\n");
+    goto PT_FREE;
+  }
+
+  if(0 == rank)
+  {
+    eret = p4_md_alloc_ct(&ctx, &md_h, send_buffer, bytes);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "md alloc failed with %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  for(int p = 0; p < 3; ++p)
+  {
+    if(0 > targets[p])
+      continue;
+    if(0 == rank)
+      p4_put_path(paths[p], targets[p], md_h, index, &acks);
+    if(LOOPBACK != paths[p] && (0 == rank || targets[p] == rank))
+      mpi_path(paths[p], targets[p], send_buffer, recv_buffer, reqs);
+    MPI_Barrier(MPI_COMM_WORLD);
+  }
+
+  if(0 == rank)
+    p4_md_free(md_h);
+  p4_le_remove(le_h);
+
+PT_FREE:
+  p4_pt_free(&ctx, index);
+
+FREE:
+  free(send_buffer);
+  free(recv_buffer);
+  free(on_node);
+  free(reqs);
+  return eret;
+}
+
+void
+print_help_message()
+{
+  fprintf(stdout, "Usage: [options]\n");
+  fprintf(stdout, "Options:\n");
+  fprintf(stdout,
+          "  -i, --iterations <value>       Specify the number of iterations "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  -x, --warmup <value>           Specify the number of warmup "
+          "iterations (required argument)\n");
+  fprintf(stdout, "  --msg_size <value>             Specify the message size "
+                  "(required argument)\n");
+  fprintf(stdout,
+          "  --min_msg_size <value>         Specify the minimum message size "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  --max_msg_size <value>         Specify the maximum message size "
+          "(required argument)\n");
+  fprintf(stdout, "  -w, --window_size <value>      Specify the window size "
+                  "(required argument)\n");
+  fprintf(stdout,
+          "  -h, --help                     Display this help message (no "
+          "argument required)\n");
+  fflush(stdout);
+}
+
+void
+print_benchmark_opts()
+{
+  fprintf(stderr, "Benchmark Configuration:\n\n");
+  fprintf(stderr, "ni_mode: %s\n",
+          opts.ni_mode == MATCHING ? "MATCHING" : "NON MATCHING");
+  fprintf(stderr, "ranks: %i\n", num_ranks);
+  fprintf(stderr, "iterations: %i\n", opts.iterations);
+  fprintf(stderr, "warmup: %i\n", opts.warmup);
+  fprintf(stderr, "window_size: %i\n", opts.window_size);
+  fprintf(stderr, "min_msg_size: %lu\n", opts.min_msg_size);
+  fprintf(stderr, "max_msg_size: %lu\n\n", opts.max_msg_size);
+  fflush(stderr);
+}
+
+int
+main(int argc, char* argv[])
+{
+  int eret = -1;
+
+  static const struct option long_opts[] = {
+      {"iterations", required_argument, NULL, 'i'},
+      {"warmup", required_argument, NULL, 'x'},
+      {"msg_size", required_argument, NULL, 1},
+      {"min_msg_size", required_argument, NULL, 2},
+      {"max_msg_size", required_argument, NULL, 3},
+      {"window_size", required_argument, NULL, 'w'},
+      {"help", no_argument, NULL, 'h'}};
+
+  const char* const short_opts = "i:x:w:h";
+
+  opts.ni_mode = NON_MATCHING;
+  opts.iterations = 10;
+  opts.warmup = 10;
+  opts.window_size = 64;
+  opts.min_msg_size = 1;
+  opts.max_msg_size = 1048576;
+
+  while(1)
+  {
+    const int opt = getopt_long(argc, argv, short_opts, long_opts, NULL);
+
+    if(-1 == opt)
+      break;
+
+    switch(opt)
+    {
+    case 'i':
+      opts.iterations = atoi(optarg);
+      break;
+    case 'x':
+      opts.warmup = atoi(optarg);
+      break;
+    case 1:
+      opts.msg_size = atol(optarg);
+      opts.min_msg_size = opts.msg_size;
+      opts.max_msg_size = opts.msg_size;
+      break;
+    case 2:
+      opts.min_msg_size = atol(optarg);
+      break;
+    case 3:
+      opts.max_msg_size = atol(optarg);
+      break;
+    case 'w':
+      opts.window_size = atoi(optarg);
+      break;
+    case 'h':
+      print_help_message();
+      exit(EXIT_SUCCESS);
+    case '?':
+      print_help_message();
+      exit(EXIT_FAILURE);
+    default:
+      print_help_message();
+      exit(EXIT_FAILURE);
+    }
+  } // end while
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+  peers = malloc(num_ranks * sizeof(ptl_process_t));
+  if(NULL == peers)
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+
+  if(0 == rank)
+    print_benchmark_opts();
+
+  PtlInit();
+
+  eret = init_p4_ctx(&ctx, opts.ni_mode);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "init failed with %i\n", eret);
+    goto END;
+  }
+
+  eret = gather_ni_addresses(&ctx, peers);
+  if(MPI_SUCCESS != eret)
+  {
+    fprintf(stderr, "address exchange failed\n");
+    goto END;
+  }
+
+  eret = run_locality_benchmark();
+
+END:
+  destroy_p4_ctx(&ctx);
+  PtlFini();
+  free(peers);
+  MPI_Finalize();
+  return eret;
+}
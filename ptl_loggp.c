@@ -0,0 +1,571 @@
+#include "common.h"
+#include "util.h"
+#include <getopt.h>
+
+static int rank;
+static int num_ranks;
+static benchmark_opts_t opts;
+static p4_ctx_t ctx;
+static locality_t locality;
+
+/*
+ * LogGP parameters of PtlPut and PtlGet, with counting and with full
+ * events. For every message size rank 0 measures
+ *   o_s: the time for the call to return, averaged over a window,
+ *   gap: the time per message of a window until all have completed,
+ *   rtt: the time of a single operation until its completion is consumed,
+ * and rank 1 measures
+ *   o_r: the time to consume one completion (a PtlCTGet or a PtlEQGet) of a
+ *        window that has already been delivered.
+ * The fit takes g as the gap of the smallest message, G as the slope of the
+ * gap over the upper half of the sizes, o_s and o_r of the smallest message,
+ * and L from the intercept a of a straight line through rtt, which is made
+ * of the two one-way latencies between o_s and o_r: L = (a - o_s - o_r) / 2.
+ */
+typedef struct
+{
+  double o_s;
+  double o_r;
+  double rtt;
+  double gap;
+} loggp_point_t;
+
+static void* buffer;
+static ptl_index_t pt_index;
+
+/*
+ * Least squares line through (x[i], y[i]). Returns the slope and stores the
+ * intercept.
+ */
+static double
+linear_fit(const double* const x, const double* const y, const int n,
+           double* const intercept)
+{
+  double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+
+  for(int i = 0; i < n; ++i)
+  {
+    sx += x[i];
+    sy += y[i];
+    sxx += x[i] * x[i];
+    sxy += x[i] * y[i];
+  }
+  const double d = n * sxx - sx * sx;
+  const double slope = 0.0 == d ? 0.0 : (n * sxy - sx * sy) / d;
+  *intercept = (sy - slope * sx) / n;
+  return slope;
+}
+
+static void
+append_entry(ptl_handle_le_t* const le_h, ptl_handle_me_t* const me_h,
+             const ptl_size_t length, const event_type_t events)
+{
+  ptl_event_t event;
+  int eret = -1;
+
+  // counting events go to the CT of the context, full ones to its EQ
+  const int counting = COUNTING == events;
+
+  if(MATCHING == opts.ni_mode)
+  {
+    ptl_me_t me = {.start = buffer,
+                   .length = length,
+                   .options = PTL_ME_OP_PUT | PTL_ME_OP_GET |
+                              PTL_ME_EVENT_UNLINK_DISABLE |
+                              (counting ? PTL_ME_EVENT_COMM_DISABLE |
+                                              PTL_ME_EVENT_CT_COMM
+                                        : 0),
+                   .ct_handle = ctx.ct_h,
+                   .uid = PTL_UID_ANY,
+                   .match_id = {.phys = {.nid = PTL_NID_ANY,
+                                         .pid = PTL_PID_ANY}},
+                   .match_bits = 0xDEADBEEF,
+                   .ignore_bits = 0,
+                   .min_free = 0};
+    eret = PtlMEAppend(ctx.ni_h, pt_index, &me, PTL_PRIORITY_LIST,
+                       NULL, me_h);
+  }
+  else
+  {
+    ptl_le_t le = {.start = buffer,
+                   .length = length,
+                   .options = PTL_LE_OP_PUT | PTL_LE_OP_GET |
+                              PTL_LE_EVENT_UNLINK_DISABLE |
+                              (counting ? PTL_LE_EVENT_COMM_DISABLE |
+                                              PTL_LE_EVENT_CT_COMM
+                                        : 0),
+                   .ct_handle = ctx.ct_h,
+                   .uid = PTL_UID_ANY};
+    eret = PtlLEAppend(ctx.ni_h, pt_index, &le, PTL_PRIORITY_LIST,
+                       NULL, le_h);
+  }
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "append failed with %i\n", eret);
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+
+  PtlEQWait(ctx.eq_h, &event);
+  if(PTL_EVENT_LINK != event.type || PTL_NI_OK != event.ni_fail_type)
+  {
+    fprintf(stderr, "Failed to link entry\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+}
+
+static int
+issue(ptl_handle_md_t md_h, const operation_t op, const ptl_size_t offset,
+      const size_t msg_size)
+{
+  ptl_match_bits_t match_bits = opts.ni_mode == MATCHING ? 0xDEADBEEF : 0;
+
+  if(PUT == op)
+    return PtlPut(md_h, offset, msg_size, PTL_ACK_REQ, ctx.peer_addr,
+                  pt_index, match_bits, offset, NULL, 0);
+  return PtlGet(md_h, offset, msg_size, ctx.peer_addr, pt_index,
+                match_bits, offset, NULL);
+}
+
+/*
+ * Consumes one completion. With counting events the count has to reach
+ * *done + 1, with full events the next event is taken from the EQ.
+ */
+static void
+consume(const event_type_t events, ptl_size_t* const done)
+{
+  ptl_ct_event_t ct_event;
+  ptl_event_t event;
+  int eret = -1;
+
+  if(COUNTING == events)
+  {
+    do
+    {
+      eret = PtlCTGet(ctx.ct_h, &ct_event);
+    } while(PTL_OK == eret && ct_event.failure == 0 &&
+            ct_event.success <= *done);
+    if(PTL_OK != eret || ct_event.failure > 0)
+    {
+      fprintf(stderr, "PtlCTGet failed\n");
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+  }
+  else
+  {
+    do
+    {
+      eret = PtlEQGet(ctx.eq_h, &event);
+    } while(PTL_EQ_EMPTY == eret);
+    if(PTL_OK != eret || PTL_NI_OK != event.ni_fail_type)
+    {
+      fprintf(stderr, "PtlEQGet failed with %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+  }
+  ++*done;
+}
+
+/*
+ * Measures one message size. Rank 0 returns the medians, rank 1 only takes
+ * part.
+ */
+static loggp_point_t
+run_size(ptl_handle_md_t md_h, const operation_t op,
+         const event_type_t events, const size_t msg_size, double* const o_s,
+         double* const o_r, double* const rtt, double* const gap)
+{
+  ptl_size_t done = 0;
+  loggp_point_t point = {0.0, 0.0, 0.0, 0.0};
+  ptl_ct_event_t zero = {.success = 0, .failure = 0};
+  int eret = -1;
+
+  PtlCTSet(ctx.ct_h, zero);
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  // o_s and gap on rank 0, o_r on rank 1 once the window has arrived
+  for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+  {
+    double t_issue = 0.0;
+    double t_gap = 0.0;
+    double t_recv = 0.0;
+
+    if(0 == rank)
+    {
+      const double t0 = MPI_Wtime();
+      for(int w = 0; w < opts.window_size; ++w)
+      {
+        const double t1 = MPI_Wtime();
+        eret = issue(md_h, op, w * msg_size, msg_size);
+        t_issue += MPI_Wtime() - t1;
+        if(PTL_OK != eret)
+        {
+          fprintf(stderr, "issue failed with %i\n", eret);
+          MPI_Abort(MPI_COMM_WORLD, eret);
+        }
+      }
+      for(int w = 0; w < opts.window_size; ++w)
+        consume(events, &done);
+      t_gap = MPI_Wtime() - t0;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if(1 == rank)
+    {
+      const double t0 = MPI_Wtime();
+      for(int w = 0; w < opts.window_size; ++w)
+        consume(events, &done);
+      t_recv = MPI_Wtime() - t0;
+      MPI_Send(&t_recv, 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+    }
+    else
+      MPI_Recv(&t_recv, 1, MPI_DOUBLE, 1, 0, MPI_COMM_WORLD,
+               MPI_STATUS_IGNORE);
+
+    if(0 == rank && i >= opts.warmup)
+    {
+      o_s[i - opts.warmup] = t_issue * 1e6 / opts.window_size;
+      gap[i - opts.warmup] = t_gap * 1e6 / opts.window_size;
+      o_r[i - opts.warmup] = t_recv * 1e6 / opts.window_size;
+    }
+  }
+
+  // rtt of single operations; rank 1 drains their completions afterwards
+  if(0 == rank)
+  {
+    for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+    {
+      const double t0 = MPI_Wtime();
+      eret = issue(md_h, op, 0, msg_size);
+      if(PTL_OK != eret)
+      {
+        fprintf(stderr, "issue failed with %i\n", eret);
+        MPI_Abort(MPI_COMM_WORLD, eret);
+      }
+      consume(events, &done);
+      const double t = MPI_Wtime() - t0;
+      if(i >= opts.warmup)
+        rtt[i - opts.warmup] = t * 1e6;
+    }
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+  if(1 == rank)
+  {
+    for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+      consume(events, &done);
+    return point;
+  }
+
+  point.o_s = median(o_s, opts.iterations);
+  point.o_r = median(o_r, opts.iterations);
+  point.rtt = median(rtt, opts.iterations);
+  point.gap = median(gap, opts.iterations);
+  return point;
+}
+
+static int
+run_mode(const operation_t op, const event_type_t events)
+{
+  const char* const func = PUT == op ? "PtlPut" : "PtlGet";
+  const char* const ev = COUNTING == events ? "counting" : "full";
+  const size_t bytes = opts.window_size * opts.max_msg_size;
+  // only the initiator binds an MD, the target passes the invalid handle on
+  ptl_handle_md_t md_h = PTL_INVALID_HANDLE;
+  ptl_handle_le_t le_h;
+  ptl_handle_me_t me_h;
+  int eret = -1;
+  int n = 0;
+
+  for(size_t msg_size = opts.min_msg_size; msg_size <= opts.max_msg_size;
+      msg_size *= 2)
+    ++n;
+
+  double* samples = malloc(4 * opts.iterations * sizeof(double));
+  double* sizes = malloc(n * sizeof(double));
+  double* y = malloc(n * sizeof(double));
+  loggp_point_t* points = malloc(n * sizeof(loggp_point_t));
+  if(NULL == samples || NULL == sizes || NULL == y ||
+     NULL == points)
+  {
+    free(samples);
+    free(sizes);
+    free(y);
+    free(points);
+    return -1;
+  }
+
+  if(1 == rank)
+    append_entry(&le_h, &me_h, bytes, events);
+  else
+  {
+    if(COUNTING == events)
+      eret = p4_md_alloc_ct(&ctx, &md_h, buffer, bytes);
+    else
+      eret = p4_md_alloc_eq(&ctx, &md_h, buffer, bytes);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "PtlMDBind failed with %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+  }
+
+  int k = 0;
+  for(size_t msg_size = opts.min_msg_size; msg_size <= opts.max_msg_size;
+      msg_size *= 2, ++k)
+  {
+    sizes[k] = msg_size;
+    points[k] = run_size(md_h, op, events, msg_size, samples,
+                         samples + opts.iterations,
+                         samples + 2 * opts.iterations,
+                         samples + 3 * opts.iterations);
+    if(0 == rank)
+    {
+      fprintf(stdout, "%s,%s,%lu,%.4f,%.4f,%.4f,%.4f,%s\n", func, ev,
+              msg_size, points[k].o_s, points[k].o_r, points[k].rtt,
+              points[k].gap, INTRA_NODE == locality ? "intra" : "inter");
+      fflush(stdout);
+    }
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  if(1 == rank)
+  {
+    if(MATCHING == opts.ni_mode)
+      p4_me_remove(me_h);
+    else
+      p4_le_remove(le_h);
+  }
+  else
+  {
+    p4_md_free(md_h);
+
+    double a = 0.0;
+    double g_intercept = 0.0;
+
+    for(int i = 0; i < n; ++i)
+      y[i] = points[i].rtt;
+    linear_fit(sizes, y, n, &a);
+
+    const int upper = n / 2;
+    for(int i = upper; i < n; ++i)
+      y[i] = points[i].gap;
+    double G = linear_fit(sizes + upper, y + upper, n - upper, &g_intercept);
+    if(1 == n - upper)
+      G = points[upper].gap / sizes[upper];
+
+    double L = (a - points[0].o_s - points[0].o_r) / 2;
+    if(0.0 > L)
+      L = 0.0;
+
+    fprintf(stderr, "%s,%s,%.4f,%.4f,%.4f,%.4f,%.4e\n", func, ev, L,
+            points[0].o_s, points[0].o_r, points[0].gap, G);
+    fflush(stderr);
+  }
+
+  free(samples);
+  free(sizes);
+  free(y);
+  free(points);
+  return 0;
+}
+
+int
+run_loggp_benchmark()
+{
+  const operation_t ops[] = {PUT, GET};
+  const event_type_t events[] = {COUNTING, FULL};
+
+  if(0 > alloc_buffer_init(&buffer, opts.window_size * opts.max_msg_size))
+    return -1;
+
+  if(0 == rank)
+  {
+    fprintf(stdout, "func,events,msg_size,o_s,o_r,rtt,gap,locality\n");
+    fprintf(stderr, "func,events,L,o_s,o_r,g,G\n");
+  }
+
+  for(int i = 0; i < 2; ++i)
+  {
+    for(int j = 0; j < 2; ++j)
+    {
+      if(0 > run_mode(ops[i], events[j]))
+      {
+        free(buffer);
+        return -1;
+      }
+    }
+  }
+
+  free(buffer);
+  return 0;
+}
+
+void
+print_help_message()
+{
+  fprintf(stdout, "Usage: [options]\n");
+  fprintf(stdout, "Options:\n");
+  fprintf(stdout, "  -m, --matching                 Enable matching mode (no "
+                  "argument required)\n");
+  fprintf(stdout,
+          "  -i, --iterations <value>       Specify the number of iterations "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  -x, --warmup <value>           Specify the number of warmup "
+          "iterations (required argument)\n");
+  fprintf(stdout, "  --msg_size <value>             Specify the message size "
+                  "(required argument)\n");
+  fprintf(stdout,
+          "  --min_msg_size <value>         Specify the minimum message size "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  --max_msg_size <value>         Specify the maximum message size "
+          "(required argument)\n");
+  fprintf(stdout, "  -w, --window_size <value>      Specify the window size "
+                  "(required argument)\n");
+  fprintf(stdout,
+          "  -h, --help                     Display this help message (no "
+          "argument required)\n");
+  fflush(stdout);
+}
+
+void
+print_benchmark_opts()
+{
+  fprintf(stderr, "Benchmark Configuration:\n\n");
+  fprintf(stderr, "ni_mode: %s\n",
+          opts.ni_mode == MATCHING ? "MATCHING" : "NON MATCHING");
+  fprintf(stderr, "locality: %s\n",
+          INTRA_NODE == locality ? "INTRA_NODE" : "INTER_NODE");
+  fprintf(stderr, "iterations: %i\n", opts.iterations);
+  fprintf(stderr, "warmup: %i\n", opts.warmup);
+  fprintf(stderr, "window_size: %i\n", opts.window_size);
+  fprintf(stderr, "min_msg_size: %lu\n", opts.min_msg_size);
+  fprintf(stderr, "max_msg_size: %lu\n\n", opts.max_msg_size);
+  fflush(stderr);
+}
+
+int
+main(int argc, char* argv[])
+{
+  int eret = -1;
+
+  static const struct option long_opts[] = {
+      {"matching", no_argument, NULL, 'm'},
+      {"iterations", required_argument, NULL, 'i'},
+      {"warmup", required_argument, NULL, 'x'},
+      {"msg_size", required_argument, NULL, 1},
+      {"min_msg_size", required_argument, NULL, 2},
+      {"max_msg_size", required_argument, NULL, 3},
+      {"window_size", required_argument, NULL, 'w'},
+      {"help", no_argument, NULL, 'h'}};
+
+  const char* const short_opts = "mi:x:w:h";
+
+  opts.ni_mode = NON_MATCHING;
+  opts.iterations = 100;
+  opts.warmup = 10;
+  opts.window_size = 64;
+  opts.min_msg_size = 8;
+  opts.max_msg_size = 1048576;
+
+  while(1)
+  {
+    const int opt = getopt_long(argc, argv, short_opts, long_opts, NULL);
+
+    if(-1 == opt)
+      break;
+
+    switch(opt)
+    {
+    case 'm':
+      opts.ni_mode = MATCHING;
+      break;
+    case 'i':
+      opts.iterations = atoi(optarg);
+      break;
+    case 'x':
+      opts.warmup = atoi(optarg);
+      break;
+    case 1:
+      opts.msg_size = atol(optarg);
+      opts.min_msg_size = opts.msg_size;
+      opts.max_msg_size = opts.msg_size;
+      break;
+    case 2:
+      opts.min_msg_size = atol(optarg);
+      break;
+    case 3:
+      opts.max_msg_size = atol(optarg);
+      break;
+    case 'w':
+      opts.window_size = atoi(optarg);
+      break;
+    case 'h':
+      print_help_message();
+      exit(EXIT_SUCCESS);
+    case '?':
+      print_help_message();
+      exit(EXIT_FAILURE);
+    default:
+      print_help_message();
+      exit(EXIT_FAILURE);
+    }
+  } // end while
+
+  // full events of a window or of the rtt pass must fit the EQ of the context
+  if(1 > opts.iterations || 1 > opts.window_size ||
+     4096 < opts.window_size || 4096 < opts.iterations + opts.warmup ||
+     0 == opts.min_msg_size || opts.min_msg_size > opts.max_msg_size)
+  {
+    print_help_message();
+    exit(EXIT_FAILURE);
+  }
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+  if(2 != num_ranks)
+  {
+    fprintf(stdout, "Benchmark requires exactly two processes\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  locality = get_peer_locality((rank + 1) % 2);
+
+  if(0 == rank)
+    print_benchmark_opts();
+
+  PtlInit();
+
+  eret = init_p4_ctx(&ctx, opts.ni_mode);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "init failed with %i\n", eret);
+    goto END;
+  }
+
+  eret = exchange_ni_address(&ctx, rank);
+  if(0 > eret)
+  {
+    fprintf(stderr, " exchange failed\n");
+    goto END;
+  }
+
+  eret = p4_pt_alloc(&ctx, &pt_index);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "pt alloc failed with %i\n", eret);
+    goto END;
+  }
+
+  eret = run_loggp_benchmark();
+
+  p4_pt_free(&ctx, pt_index);
+
+END:
+  destroy_p4_ctx(&ctx);
+  PtlFini();
+  MPI_Finalize();
+  return eret;
+}
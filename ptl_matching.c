@@ -0,0 +1,420 @@
+#include "common.h"
+#include "util.h"
+#include <getopt.h>
+
+static int rank;
+static int num_ranks;
+static benchmark_opts_t opts;
+static p4_ctx_t ctx;
+static locality_t locality;
+static ptl_process_t* peers;
+
+/*
+ * Match bits are laid out like an MPI library would: the communicator context
+ * above bit 32 and the tag below. Wildcard tags ignore the tag half, wildcard
+ * sources post the entry with match_id {NID_ANY, PID_ANY}. Entries of the
+ * list prefix carry another context and never match.
+ */
+#define MATCH_INDEX 40
+#define TAG_MASK 0xFFFFFFFFULL
+#define CONTEXT_BITS (1ULL << 32)
+#define PREFIX_CONTEXT_BITS (2ULL << 32)
+
+static const char*
+match_pattern_name(const match_pattern_t pattern)
+{
+  switch(pattern)
+  {
+  case MATCH_SPECIFIC:
+    return "specific";
+  case MATCH_ANY_SOURCE:
+    return "any_source";
+  case MATCH_ANY_TAG:
+    return "any_tag";
+  case MATCH_ANY:
+    return "any_source_any_tag";
+  case MATCH_MIXED:
+    return "mixed";
+  }
+  return "unknown";
+}
+
+static void
+append_entry(void* const start, const ptl_process_t source,
+             const ptl_match_bits_t match_bits,
+             const ptl_match_bits_t ignore_bits, const unsigned int options,
+             ptl_handle_me_t* const me_h)
+{
+  ptl_me_t me = {.start = start,
+                 .length = opts.msg_size,
+                 .options = PTL_ME_OP_PUT | PTL_ME_EVENT_LINK_DISABLE |
+                            PTL_ME_EVENT_UNLINK_DISABLE |
+                            PTL_ME_EVENT_COMM_DISABLE | PTL_ME_EVENT_CT_COMM |
+                            options,
+                 .ct_handle = ctx.ct_h,
+                 .uid = PTL_UID_ANY,
+                 .match_id = source,
+                 .match_bits = match_bits,
+                 .ignore_bits = ignore_bits,
+                 .min_free = 0};
+
+  int eret = PtlMEAppend(ctx.ni_h, MATCH_INDEX, &me, PTL_PRIORITY_LIST, NULL,
+                         me_h);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "PtlMEAppend failed with %i\n", eret);
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+}
+
+/*
+ * Posts one receive per sender and tag, tag-major so that a sender's entries
+ * are interleaved with the entries of every other sender. Within a tag the
+ * source-specific entries go first: a wildcard ahead of them could take the
+ * message of a sender whose only other entry is specific to someone else.
+ */
+static void
+post_receives(const match_pattern_t pattern, void* const buffer)
+{
+  ptl_handle_me_t me_h;
+  ptl_process_t any;
+  const int any_tag = MATCH_ANY_TAG == pattern || MATCH_ANY == pattern;
+
+  any.phys.nid = PTL_NID_ANY;
+  any.phys.pid = PTL_PID_ANY;
+
+  for(int t = 0; t < opts.window_size; ++t)
+  {
+    for(int wildcard = 0; wildcard < 2; ++wildcard)
+    {
+      for(int s = 1; s < num_ranks; ++s)
+      {
+        const int any_source =
+            MATCH_ANY_SOURCE == pattern || MATCH_ANY == pattern ||
+            (MATCH_MIXED == pattern && 0 == (s + t) % 2);
+        if(any_source != wildcard)
+          continue;
+        append_entry(buffer, any_source ? any : peers[s], CONTEXT_BITS | t,
+                     any_tag ? TAG_MASK : 0, PTL_ME_USE_ONCE, &me_h);
+      }
+    }
+  }
+}
+
+// time holds the time per matched message
+static void
+report(const match_pattern_t pattern, double* const time)
+{
+  for(int i = 0; i < opts.iterations; ++i)
+  {
+    fprintf(stdout, "%s,%i,%i,%i,%lu,%.4f,%.1f,%s\n",
+            match_pattern_name(pattern), num_ranks - 1, opts.window_size,
+            opts.list_depth, opts.msg_size, time[i] * 1e6, 1.0 / time[i],
+            INTRA_NODE == locality ? "intra" : "inter");
+  }
+  fflush(stdout);
+}
+
+/*
+ * Rank 0 posts the receives of an iteration, then every other rank puts one
+ * message per tag to it. The time from the first to the last counted arrival
+ * gives the matching rate of the receiver, independent of barrier skew.
+ */
+int
+run_matching(const match_pattern_t pattern, void* const buffer,
+             double* const time)
+{
+  int eret = -1;
+  ptl_handle_md_t md_h;
+  ptl_ct_event_t ct_event;
+  ptl_ct_event_t zero = {.success = 0, .failure = 0};
+  const ptl_size_t messages = (ptl_size_t)opts.window_size * (num_ranks - 1);
+  double t0;
+
+  if(0 != rank)
+  {
+    ptl_md_t md = {.start = buffer,
+                   .length = opts.msg_size,
+                   .options = PTL_MD_EVENT_SUCCESS_DISABLE,
+                   .eq_handle = PTL_EQ_NONE,
+                   .ct_handle = PTL_CT_NONE};
+    eret = PtlMDBind(ctx.ni_h, &md, &md_h);
+    if(PTL_OK != eret)
+      return eret;
+  }
+  else
+    PtlCTSet(ctx.ct_h, zero);
+
+  for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+  {
+    if(0 == rank)
+      post_receives(pattern, buffer);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    t0 = MPI_Wtime();
+
+    if(0 == rank)
+    {
+      const ptl_size_t base = i * messages;
+      eret = PTL_OK;
+      if(1 < messages)
+      {
+        eret = PtlCTWait(ctx.ct_h, base + 1, &ct_event);
+        t0 = MPI_Wtime();
+      }
+      if(PTL_OK == eret)
+        eret = PtlCTWait(ctx.ct_h, base + messages, &ct_event);
+      if(PTL_OK != eret || ct_event.failure > 0)
+      {
+        fprintf(stderr, "PtlCTWait failed\n");
+        MPI_Abort(MPI_COMM_WORLD, eret);
+      }
+      if(i >= opts.warmup)
+        time[i - opts.warmup] =
+            (MPI_Wtime() - t0) / (1 < messages ? messages - 1 : 1);
+    }
+    else
+    {
+      for(int t = 0; t < opts.window_size; ++t)
+      {
+        eret = PtlPut(md_h, 0, opts.msg_size, PTL_NO_ACK_REQ, peers[0],
+                      MATCH_INDEX, CONTEXT_BITS | t, 0, NULL, 0);
+        if(PTL_OK != eret)
+        {
+          fprintf(stderr, "PtlPut failed with %i\n", eret);
+          MPI_Abort(MPI_COMM_WORLD, eret);
+        }
+      }
+    }
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  if(0 == rank)
+    report(pattern, time);
+  else
+    PtlMDRelease(md_h);
+  return PTL_OK;
+}
+
+int
+run_matching_benchmark(const match_pattern_t* patterns, const int num_patterns)
+{
+  int eret = -1;
+  ptl_index_t index;
+  ptl_handle_me_t* prefix = NULL;
+  void* buffer = NULL;
+  double* time = malloc(opts.iterations * sizeof(double));
+
+  if(NULL == time || 0 > alloc_buffer_init(&buffer, opts.msg_size))
+    return -1;
+
+  eret = PtlPTAlloc(ctx.ni_h, 0, PTL_EQ_NONE, MATCH_INDEX, &index);
+  if(PTL_OK != eret)
+    return eret;
+
+  // entries that every arriving message has to be compared against first
+  if(0 == rank && 0 < opts.list_depth)
+  {
+    prefix = malloc(opts.list_depth * sizeof(ptl_handle_me_t));
+    if(NULL == prefix)
+      return -1;
+    for(int d = 0; d < opts.list_depth; ++d)
+      append_entry(buffer, peers[0], PREFIX_CONTEXT_BITS | d, 0, 0,
+                   &prefix[d]);
+  }
+
+  if(0 == rank)
+    fprintf(stdout, "func,senders,window_size,list_depth,msg_size,latency,"
+                    "rate,locality\n");
+
+  for(int p = 0; p < num_patterns; ++p)
+  {
+    eret = run_matching(patterns[p], buffer, time);
+    if(PTL_OK != eret)
+      break;
+  }
+
+  if(NULL != prefix)
+  {
+    for(int d = 0; d < opts.list_depth; ++d)
+      PtlMEUnlink(prefix[d]);
+    free(prefix);
+  }
+  PtlPTFree(ctx.ni_h, index);
+  free(buffer);
+  free(time);
+  return eret;
+}
+
+void
+print_help_message()
+{
+  fprintf(stdout, "Usage: [options]\n");
+  fprintf(stdout, "Options:\n");
+  fprintf(stdout,
+          "  -i, --iterations <value>       Specify the number of iterations "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  -x, --warmup <value>           Specify the number of warmup "
+          "iterations (required argument)\n");
+  fprintf(stdout, "  --msg_size <value>             Specify the message size "
+                  "(required argument)\n");
+  fprintf(stdout,
+          "  -w, --window_size <value>      Tags, i.e. messages per sender "
+          "and iteration (default 64)\n");
+  fprintf(stdout,
+          "  -d, --list_depth <value>       Non-matching entries ahead of the "
+          "receives (default 0)\n");
+  fprintf(stdout,
+          "  -s, --pattern <value>          specific, any_source, any_tag, "
+          "any or mixed; all five if omitted (required argument)\n");
+  fprintf(stdout,
+          "  -h, --help                     Display this help message (no "
+          "argument required)\n");
+  fflush(stdout);
+}
+
+void
+print_benchmark_opts(const match_pattern_t* patterns, const int num_patterns)
+{
+  fprintf(stderr, "Benchmark Configuration:\n\n");
+  fprintf(stderr, "senders: %i\n", num_ranks - 1);
+  fprintf(stderr, "locality: %s\n",
+          INTRA_NODE == locality ? "INTRA_NODE" : "INTER_NODE");
+  fprintf(stderr, "patterns:");
+  for(int p = 0; p < num_patterns; ++p)
+    fprintf(stderr, " %s", match_pattern_name(patterns[p]));
+  fprintf(stderr, "\n");
+  fprintf(stderr, "iterations: %i\n", opts.iterations);
+  fprintf(stderr, "warmup: %i\n", opts.warmup);
+  fprintf(stderr, "window_size: %i\n", opts.window_size);
+  fprintf(stderr, "list_depth: %i\n", opts.list_depth);
+  fprintf(stderr, "msg_size: %lu\n\n", opts.msg_size);
+  fflush(stderr);
+}
+
+int
+main(int argc, char* argv[])
+{
+  int eret = -1;
+  match_pattern_t patterns[5] = {MATCH_SPECIFIC, MATCH_ANY_SOURCE,
+                                 MATCH_ANY_TAG, MATCH_ANY, MATCH_MIXED};
+  int num_patterns = 5;
+
+  static const struct option long_opts[] = {
+      {"iterations", required_argument, NULL, 'i'},
+      {"warmup", required_argument, NULL, 'x'},
+      {"msg_size", required_argument, NULL, 1},
+      {"window_size", required_argument, NULL, 'w'},
+      {"list_depth", required_argument, NULL, 'd'},
+      {"pattern", required_argument, NULL, 's'},
+      {"help", no_argument, NULL, 'h'}};
+
+  const char* const short_opts = "i:x:w:d:s:h";
+
+  opts.ni_mode = MATCHING;
+  opts.iterations = 100;
+  opts.warmup = 10;
+  opts.window_size = 64;
+  opts.msg_size = 8;
+  opts.list_depth = 0;
+
+  while(1)
+  {
+    const int opt = getopt_long(argc, argv, short_opts, long_opts, NULL);
+
+    if(-1 == opt)
+      break;
+
+    switch(opt)
+    {
+    case 'i':
+      opts.iterations = atoi(optarg);
+      break;
+    case 'x':
+      opts.warmup = atoi(optarg);
+      break;
+    case 1:
+      opts.msg_size = atol(optarg);
+      break;
+    case 'w':
+      opts.window_size = atoi(optarg);
+      break;
+    case 'd':
+      opts.list_depth = atoi(optarg);
+      break;
+    case 's':
+      num_patterns = 1;
+      if(0 == strcmp(optarg, "specific"))
+        patterns[0] = MATCH_SPECIFIC;
+      else if(0 == strcmp(optarg, "any_source"))
+        patterns[0] = MATCH_ANY_SOURCE;
+      else if(0 == strcmp(optarg, "any_tag"))
+        patterns[0] = MATCH_ANY_TAG;
+      else if(0 == strcmp(optarg, "any"))
+        patterns[0] = MATCH_ANY;
+      else if(0 == strcmp(optarg, "mixed"))
+        patterns[0] = MATCH_MIXED;
+      else
+      {
+        print_help_message();
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'h':
+      print_help_message();
+      exit(EXIT_SUCCESS);
+    case '?':
+      print_help_message();
+      exit(EXIT_FAILURE);
+    default:
+      print_help_message();
+      exit(EXIT_FAILURE);
+    }
+  } // end while
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+  if(2 > num_ranks)
+  {
+    fprintf(stdout, "Benchmark requires at least two processes\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  locality = get_job_locality();
+
+  if(0 == rank)
+    print_benchmark_opts(patterns, num_patterns);
+
+  peers = malloc(num_ranks * sizeof(ptl_process_t));
+  if(NULL == peers)
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+
+  PtlInit();
+
+  eret = init_p4_ctx(&ctx, opts.ni_mode);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "init failed with %i\n", eret);
+    goto END;
+  }
+
+  eret = gather_ni_addresses(&ctx, peers);
+  if(MPI_SUCCESS != eret)
+  {
+    fprintf(stderr, "address exchange failed\n");
+    goto END;
+  }
+
+  eret = run_matching_benchmark(patterns, num_patterns);
+
+END:
+  free(peers);
+  destroy_p4_ctx(&ctx);
+  PtlFini();
+  MPI_Finalize();
+  return eret;
+}
@@ -9,6 +9,7 @@
 static int rank;
 static int num_ranks;
 static p4_ctx_t ctx;
+static locality_t locality;
 static benchmark_opts_t opts;
 static char processor_name[MPI_MAX_PROCESSOR_NAME];
 int* cache_buffer;
@@ -17,6 +18,7 @@ int (*communicate)(const ptl_handle_md_t md_h, const ptl_size_t local_offset,
                    const ptl_size_t remote_offset, const ptl_size_t msg_size,
                    const ptl_index_t index, const ptl_ack_req_t req_type,
                    const ptl_match_bits_t);
+void (*complete)(const ptl_size_t wait_for);
 
 int
 put_operation(const ptl_handle_md_t md_h, const ptl_size_t local_offset,
@@ -44,6 +46,25 @@ get_operation(const ptl_handle_md_t md_h, const ptl_size_t local_offset,
   return eret;
 }
 
+int
+ct_inc_operation(const ptl_handle_md_t md_h, const ptl_size_t local_offset,
+                 const ptl_size_t remote_offset, const ptl_size_t msg_size,
+                 const ptl_index_t index, const ptl_ack_req_t req_type,
+                 const ptl_match_bits_t match_bits)
+{
+  ptl_ct_event_t one = {.success = 1, .failure = 0};
+  return PtlCTInc(ctx.ct_h, one);
+}
+
+int
+null_operation(const ptl_handle_md_t md_h, const ptl_size_t local_offset,
+               const ptl_size_t remote_offset, const ptl_size_t msg_size,
+               const ptl_index_t index, const ptl_ack_req_t req_type,
+               const ptl_match_bits_t match_bits)
+{
+  return PTL_OK;
+}
+
 static inline void
 wait_for_completion(const ptl_size_t wait_for)
 {
@@ -60,6 +81,27 @@ wait_for_completion(const ptl_size_t wait_for)
   }
 }
 
+// the CT is never reset inside the timed region, wait for the running total
+static ptl_size_t ct_expected;
+
+void
+wait_for_ct(const ptl_size_t wait_for)
+{
+  ptl_ct_event_t ct_event;
+  ct_expected += wait_for;
+  int eret = PtlCTWait(ctx.ct_h, ct_expected, &ct_event);
+  if(PTL_OK != eret || ct_event.failure > 0)
+  {
+    fprintf(stderr, "PtlCTWait failed\n");
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+}
+
+void
+no_completion(const ptl_size_t wait_for)
+{
+}
+
 typedef struct
 {
   ptl_handle_eq_t eq_h;
@@ -149,133 +191,471 @@ send_cmd(cmd_ctx_t* const cmd)
   }
 }
 
-void
-run_me_non_persistent_benchmark()
+#define READY_INDEX 22
+
+/*
+ * Readiness channel of the double-buffered mode: zero-byte puts from the
+ * target are counted on a CT of the initiator, no event is ever raised.
+ */
+typedef struct
 {
+  ptl_handle_ct_t ct_h;
+  ptl_handle_le_t le_h;
   ptl_handle_md_t md_h;
   ptl_index_t index;
-  ptl_index_t cmd_index;
-  ptl_ct_event_t zero = {.success = 0, .failure = 0};
-  int eret = -1;
-  int distance = -1;
-  double t0, t;
-  cmd_ctx_t cmd;
+} ready_ctx_t;
 
-  ptl_handle_me_t* me_hs = NULL;
-  ptl_size_t* sizes = NULL;
-  void** buffers = NULL;
-  void* send_buffer = NULL;
+void
+setup_ready_channel(p4_ctx_t* const ctx, ready_ctx_t* const ready)
+{
+  int eret = PtlCTAlloc(ctx->ni_h, &ready->ct_h);
+  if(PTL_OK == eret)
+    eret = PtlPTAlloc(ctx->ni_h, 0, PTL_EQ_NONE, READY_INDEX, &ready->index);
 
-  eret = p4_pt_alloc(&ctx, &index);
+  ptl_le_t le = {.start = NULL,
+                 .length = 0,
+                 .options = PTL_LE_OP_PUT | PTL_LE_EVENT_CT_COMM,
+                 .uid = PTL_UID_ANY,
+                 .ct_handle = ready->ct_h};
+  if(PTL_OK == eret)
+    eret = PtlLEAppend(ctx->ni_h, ready->index, &le, PTL_PRIORITY_LIST, NULL,
+                       &ready->le_h);
+
+  ptl_md_t md = {.start = NULL,
+                 .length = 0,
+                 .options = PTL_MD_EVENT_SUCCESS_DISABLE,
+                 .ct_handle = PTL_CT_NONE,
+                 .eq_handle = PTL_EQ_NONE};
+  if(PTL_OK == eret)
+    eret = PtlMDBind(ctx->ni_h, &md, &ready->md_h);
   if(PTL_OK != eret)
   {
-    MPI_Abort(MPI_COMM_WORLD, -1);
+    fprintf(stderr, "Failed to set up the ready channel\n");
+    MPI_Abort(MPI_COMM_WORLD, eret);
   }
+}
 
-  setup_cmd_channel(&ctx, &cmd);
+void
+free_ready_channel(ready_ctx_t* const ready)
+{
+  PtlMDRelease(ready->md_h);
+  PtlLEUnlink(ready->le_h);
+  PtlPTFree(ctx.ni_h, ready->index);
+  PtlCTFree(ready->ct_h);
+}
 
-  communicate = opts.op == PUT ? &put_operation : &get_operation;
-  int iterations = opts.iterations + opts.warmup;
+void
+signal_ready(ready_ctx_t* const ready)
+{
+  int eret = PtlPut(ready->md_h, 0, 0, PTL_NO_ACK_REQ, ctx.peer_addr,
+                    ready->index, 0, 0, NULL, 0);
+  if(PTL_OK != eret)
+    MPI_Abort(MPI_COMM_WORLD, -124);
+}
 
-  me_hs = malloc(opts.window_size * sizeof(ptl_handle_me_t));
-  sizes = malloc(opts.window_size * sizeof(ptl_size_t));
-  buffers = malloc(opts.window_size * sizeof(void*));
+void
+wait_for_ready(ready_ctx_t* const ready, const ptl_size_t count)
+{
+  ptl_ct_event_t ct_event;
+  int eret = PtlCTWait(ready->ct_h, count, &ct_event);
+  if(PTL_OK != eret || ct_event.failure > 0)
+  {
+    fprintf(stderr, "PtlCTWait failed\n");
+    MPI_Abort(MPI_COMM_WORLD, -125);
+  }
+}
+
+#define SET_BIT(set) (1ULL << (62 + (set)))
+
+/*
+ * Double-buffered variant of run_window_iterations. The target keeps two sets
+ * of window_size MEs, each with its own set bit on top of the window
+ * position. The MEs ignore every bit they do not have set, so only the set
+ * bit keeps a message of one set from matching an ME of the other one.
+ * Iteration i consumes set i % 2 while the other one is already posted. The
+ * target re-posts a set as soon as its CT shows it consumed and announces it
+ * on the ready channel, so posting overlaps with the transfers of the other
+ * set.
+ */
+void
+run_double_buffered_iterations(const size_t msg_size, const ptl_index_t index,
+                               ready_ctx_t* const ready,
+                               ptl_handle_me_t* const me_hs,
+                               ptl_size_t* const sizes, void** const buffers)
+{
+  ptl_handle_md_t md_h;
+  ptl_handle_ct_t set_ct[2];
+  ptl_ct_event_t ct_event;
+  ptl_ct_event_t zero = {.success = 0, .failure = 0};
+  int eret = -1;
+  double t0, t;
+  void* send_buffer = NULL;
+  const int window = opts.window_size;
+  const int iterations = opts.iterations + opts.warmup;
+  const char* const func = opts.op == PUT ? "put_double_buffered"
+                                          : "get_double_buffered";
 
   if(0 == rank)
   {
-    fprintf(stdout, "func,window_size,msg_size,bandwidth,latency\n");
-    fflush(stdout);
+    alloc_buffer_init(&send_buffer, msg_size * window);
+    eret = p4_md_alloc_eq(&ctx, &md_h, send_buffer, window * msg_size);
+    if(eret < 0)
+    {
+      fprintf(stderr, "md alloc failed %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+    PtlCTSet(ready->ct_h, zero);
+  }
+  else
+  {
+    for(int i = 0; i < 2 * window; ++i)
+    {
+      sizes[i] = msg_size;
+      alloc_buffer_init(&buffers[i], sizes[i]);
+    }
+    if(PTL_OK != PtlCTAlloc(ctx.ni_h, &set_ct[0]) ||
+       PTL_OK != PtlCTAlloc(ctx.ni_h, &set_ct[1]))
+    {
+      fprintf(stderr, "ct alloc failed\n");
+      MPI_Abort(MPI_COMM_WORLD, -1);
+    }
   }
 
-  for(size_t msg_size = opts.min_msg_size; msg_size <= opts.max_msg_size;
-      msg_size *= 2)
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  if(0 == rank)
   {
-    if(0 == rank)
+    for(int i = 0; i < iterations; ++i)
     {
-      alloc_buffer_init(&send_buffer, msg_size * opts.window_size);
-      eret =
-          p4_md_alloc_eq(&ctx, &md_h, send_buffer, opts.window_size * msg_size);
-      if(eret < 0)
+      const ptl_match_bits_t first_bits = SET_BIT(i % 2) + 1;
+
+      if(i >= opts.warmup)
+      {
+        t0 = MPI_Wtime();
+      }
+
+      wait_for_ready(ready, i + 1);
+
+      for(int w = 0; w < window; ++w)
+      {
+        eret = communicate(md_h, w * msg_size, 0, msg_size, index, PTL_ACK_REQ,
+                           first_bits + w);
+        if(eret < 0)
+        {
+          fprintf(stderr, "comm failed %i\n", eret);
+          MPI_Abort(MPI_COMM_WORLD, eret);
+        }
+      }
+      complete(window);
+
+      if(i >= opts.warmup)
       {
-        fprintf(stderr, "md alloc failed %i\n", eret);
-        MPI_Abort(MPI_COMM_WORLD, eret);
+        t = MPI_Wtime() - t0;
+        fprintf(stdout, "%s,%i,%lu,%.4f,%.4f,%s\n", func, window, msg_size,
+                (msg_size * window * 1e-6) / t, (t * 1e6) / window,
+                INTRA_NODE == locality ? "intra" : "inter");
+        fflush(stdout);
       }
     }
-    else
+    p4_md_free(md_h);
+    free(send_buffer);
+  }
+  else
+  {
+    for(int i = 0; i < iterations + 2; ++i)
     {
-      for(int i = 0; i < opts.window_size; ++i)
+      const int set = i % 2;
+
+      // set i - 2 has to be consumed before it can be posted again
+      if(2 <= i)
       {
-        sizes[i] = msg_size;
-        alloc_buffer_init(&buffers[i], sizes[i]);
+        eret = PtlCTWait(set_ct[set], (i / 2) * window, &ct_event);
+        if(PTL_OK != eret || ct_event.failure > 0)
+        {
+          fprintf(stderr, "PtlCTWait failed\n");
+          MPI_Abort(MPI_COMM_WORLD, eret);
+        }
+      }
+      if(i < iterations)
+      {
+        eret = p4_me_insert_list_batched(
+            &ctx, &me_hs[set * window], &buffers[set * window],
+            &sizes[set * window], window, index, set_ct[set], SET_BIT(set) + 1,
+            opts.me_post);
+        if(0 > eret)
+        {
+          fprintf(stderr, "ME posting failed\n");
+          MPI_Abort(MPI_COMM_WORLD, eret);
+        }
+        signal_ready(ready);
       }
     }
+    for(int i = 0; i < 2 * window; ++i)
+    {
+      free(buffers[i]);
+    }
+    PtlCTFree(set_ct[0]);
+    PtlCTFree(set_ct[1]);
+  }
 
-    MPI_Barrier(MPI_COMM_WORLD);
+  MPI_Barrier(MPI_COMM_WORLD);
+}
+
+/*
+ * One message size of the window benchmark. With a calibration op the
+ * initiator runs the very same loop, the target only hands out the command
+ * and waits for it to come back since no data is ever transferred.
+ */
+void
+run_window_iterations(const size_t msg_size, const ptl_index_t index,
+                      cmd_ctx_t* const cmd, ptl_handle_me_t* const me_hs,
+                      ptl_size_t* const sizes, void** const buffers,
+                      const calibration_op_t calibration)
+{
+  ptl_handle_md_t md_h;
+  int eret = -1;
+  double t0, t;
+  void* send_buffer = NULL;
+  const int iterations = opts.iterations + opts.warmup;
+  const int transfers = 0 == calibration || ZERO_BYTE_OP == calibration;
+  const char* const func = 0 != calibration ? calibration_op_str(calibration)
+                           : opts.op == PUT ? "put"
+                                            : "get";
+
+  if(0 == rank)
+  {
+    alloc_buffer_init(&send_buffer, msg_size * opts.window_size);
+    eret =
+        p4_md_alloc_eq(&ctx, &md_h, send_buffer, opts.window_size * msg_size);
+    if(eret < 0)
+    {
+      fprintf(stderr, "md alloc failed %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+  }
+  else if(transfers)
+  {
+    for(int i = 0; i < opts.window_size; ++i)
+    {
+      sizes[i] = msg_size;
+      alloc_buffer_init(&buffers[i], sizes[i]);
+    }
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
 
-    if(0 == rank)
+  if(0 == rank)
+  {
+    for(int i = 0; i < iterations; ++i)
     {
-      for(int i = 0; i < iterations; ++i)
+      if(i >= opts.warmup)
       {
-        if(i >= opts.warmup)
-        {
-          t0 = MPI_Wtime();
-        }
+        t0 = MPI_Wtime();
+      }
 
-        wait_for_cmd(&cmd);
+      wait_for_cmd(cmd);
 
-        for(int w = 0; w < opts.window_size; ++w)
+      for(int w = 0; w < opts.window_size; ++w)
+      {
+        eret = communicate(md_h, w * msg_size, 0, msg_size, index, PTL_ACK_REQ,
+                           w + 1);
+        if(eret < 0)
         {
-          eret = communicate(md_h, w * msg_size, 0, msg_size, index,
-                             PTL_ACK_REQ, w + 1);
-          if(eret < 0)
-          {
-            fprintf(stderr, "comm failed %i\n", eret);
-            MPI_Abort(MPI_COMM_WORLD, eret);
-          }
+          fprintf(stderr, "comm failed %i\n", eret);
+          MPI_Abort(MPI_COMM_WORLD, eret);
         }
-        wait_for_completion(opts.window_size);
+      }
+      complete(opts.window_size);
 
-        if(i >= opts.warmup)
-        {
-          t = MPI_Wtime() - t0;
-          fprintf(stdout, "%s,%i,%lu,%.4f,%.4f\n",
-                  opts.op == PUT ? "put" : "get", opts.window_size, msg_size,
-                  (msg_size * opts.window_size * 1e-6) / t,
-                  (t * 1e6) / opts.window_size);
-          fflush(stdout);
-        }
+      if(i >= opts.warmup)
+      {
+        t = MPI_Wtime() - t0;
+        fprintf(stdout, "%s,%i,%lu,%.4f,%.4f,%s\n", func, opts.window_size,
+                msg_size, (msg_size * opts.window_size * 1e-6) / t,
+                (t * 1e6) / opts.window_size,
+                INTRA_NODE == locality ? "intra" : "inter");
+        fflush(stdout);
       }
-      p4_md_free(md_h);
+      if(!transfers)
+        send_cmd(cmd);
     }
-    else
+    p4_md_free(md_h);
+    free(send_buffer);
+  }
+  else
+  {
+    for(int i = 0; i < iterations; ++i)
     {
-      for(int i = 0; i < iterations; ++i)
+      if(transfers)
       {
-        p4_me_insert_list_use_once(&ctx, me_hs, buffers, sizes,
-                                   opts.window_size, index, PTL_CT_NONE);
-        send_cmd(&cmd);
+        p4_me_insert_list_batched(&ctx, me_hs, buffers, sizes,
+                                  opts.window_size, index, PTL_CT_NONE, 1,
+                                  opts.me_post);
+        send_cmd(cmd);
         wait_for_completion(opts.window_size);
       }
-      for(int i = 0; i < opts.window_size; ++i){
-	      free(buffers[i]);
+      else
+      {
+        send_cmd(cmd);
+        wait_for_cmd(cmd);
       }
     }
+    if(transfers)
+    {
+      for(int i = 0; i < opts.window_size; ++i)
+      {
+        free(buffers[i]);
+      }
+    }
+  }
+}
+
+void
+run_me_non_persistent_benchmark()
+{
+  ptl_index_t index;
+  int eret = -1;
+  cmd_ctx_t cmd;
+  ready_ctx_t ready;
+
+  ptl_handle_me_t* me_hs = NULL;
+  ptl_size_t* sizes = NULL;
+  void** buffers = NULL;
+
+  eret = p4_pt_alloc(&ctx, &index);
+  if(PTL_OK != eret)
+  {
+    MPI_Abort(MPI_COMM_WORLD, -1);
+  }
+
+  setup_cmd_channel(&ctx, &cmd);
+
+  communicate = opts.op == PUT ? &put_operation : &get_operation;
+  complete = &wait_for_completion;
+
+  // room for the second set of the double-buffered mode
+  me_hs = malloc(2 * opts.window_size * sizeof(ptl_handle_me_t));
+  sizes = malloc(2 * opts.window_size * sizeof(ptl_size_t));
+  buffers = malloc(2 * opts.window_size * sizeof(void*));
+
+  if(opts.double_buffer)
+    setup_ready_channel(&ctx, &ready);
+
+  if(0 == rank)
+  {
+    fprintf(stdout, "func,window_size,msg_size,bandwidth,latency,locality\n");
+    fflush(stdout);
+  }
+
+  for(size_t msg_size = opts.min_msg_size; msg_size <= opts.max_msg_size;
+      msg_size *= 2)
+  {
+    if(opts.double_buffer)
+      run_double_buffered_iterations(msg_size, index, &ready, me_hs, sizes,
+                                     buffers);
+    else
+      run_window_iterations(msg_size, index, &cmd, me_hs, sizes, buffers, 0);
+  }
+
+  if(opts.calibrate)
+  {
+    run_window_iterations(0, index, &cmd, me_hs, sizes, buffers,
+                          ZERO_BYTE_OP);
+
+    ptl_ct_event_t zero = {.success = 0, .failure = 0};
+    PtlCTSet(ctx.ct_h, zero);
+    ct_expected = 0;
+    communicate = &ct_inc_operation;
+    complete = &wait_for_ct;
+    run_window_iterations(0, index, &cmd, me_hs, sizes, buffers, CT_INC_OP);
+
+    communicate = &null_operation;
+    complete = &no_completion;
+    run_window_iterations(0, index, &cmd, me_hs, sizes, buffers, NULL_OP);
   }
 
   MPI_Barrier(MPI_COMM_WORLD);
 
-  if(0 != rank)
+  if(opts.double_buffer)
+    free_ready_channel(&ready);
+  free(me_hs);
+  free(buffers);
+  free(sizes);
+  free_cmd_channel(&cmd);
+  PtlPTFree(ctx.ni_h, index);
+}
+
+/*
+ * ME append throughput of the three posting modes. Only the target side of
+ * the window benchmark is timed: posting a window of use-once MEs until they
+ * can be matched. The entries are unlinked again outside the timed region.
+ */
+void
+run_append_rate_benchmark()
+{
+  ptl_index_t index;
+  int eret = -1;
+  double t0, t;
+  const me_post_t posts[] = {ME_POST_SERIAL, ME_POST_BATCHED, ME_POST_NO_LINK};
+
+  ptl_handle_me_t* me_hs = malloc(opts.window_size * sizeof(ptl_handle_me_t));
+  ptl_size_t* sizes = malloc(opts.window_size * sizeof(ptl_size_t));
+  void** buffers = malloc(opts.window_size * sizeof(void*));
+
+  eret = p4_pt_alloc(&ctx, &index);
+  if(PTL_OK != eret || NULL == me_hs || NULL == sizes || NULL == buffers)
   {
-    for(int i = 0; i < opts.window_size; ++i)
+    MPI_Abort(MPI_COMM_WORLD, -1);
+  }
+
+  for(int i = 0; i < opts.window_size; ++i)
+  {
+    sizes[i] = opts.msg_size;
+    alloc_buffer_init(&buffers[i], sizes[i]);
+  }
+
+  if(0 == rank)
+  {
+    fprintf(stdout, "func,window_size,msg_size,rate,latency,locality\n");
+    fflush(stdout);
+
+    for(size_t p = 0; p < sizeof(posts) / sizeof(posts[0]); ++p)
     {
-      free(buffers[i]);
+      for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+      {
+        t0 = MPI_Wtime();
+        eret = p4_me_insert_list_batched(&ctx, me_hs, buffers, sizes,
+                                         opts.window_size, index, PTL_CT_NONE,
+                                         1, posts[p]);
+        t = MPI_Wtime() - t0;
+        if(0 > eret)
+        {
+          fprintf(stderr, "ME posting failed\n");
+          MPI_Abort(MPI_COMM_WORLD, eret);
+        }
+        for(int w = 0; w < opts.window_size; ++w)
+          p4_me_remove(me_hs[w]);
+
+        // rate in MEs per second, latency per ME in us
+        if(i >= opts.warmup)
+        {
+          fprintf(stdout, "append_%s,%i,%lu,%.1f,%.4f,%s\n",
+                  me_post_str(posts[p]), opts.window_size, sizes[0],
+                  opts.window_size / t, (t * 1e6) / opts.window_size,
+                  INTRA_NODE == locality ? "intra" : "inter");
+          fflush(stdout);
+        }
+      }
     }
   }
 
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  for(int i = 0; i < opts.window_size; ++i)
+    free(buffers[i]);
   free(me_hs);
   free(buffers);
   free(sizes);
-  free_cmd_channel(&cmd);
   PtlPTFree(ctx.ni_h, index);
 }
 
@@ -283,15 +663,22 @@ int
 main(int argc, char* argv[])
 {
   int eret = -1;
+  int cache_pids = -1;
   ptl_ct_event_t zct = {.failure = 0, .success = 0};
   static const struct option long_opts[] = {
       {"iterations", required_argument, NULL, 'i'},
       {"warmup", required_argument, NULL, 'u'},
       {"window-size", required_argument, NULL, 'w'},
       {"get", required_argument, NULL, 'g'},
+      {"calibrate", no_argument, NULL, 1},
+      {"pids", required_argument, NULL, 'p'},
+      {"pids_path", required_argument, NULL, 2},
+      {"post", required_argument, NULL, 3},
+      {"append_rate", no_argument, NULL, 4},
+      {"double_buffer", no_argument, NULL, 5},
       {"help", no_argument, NULL, 'h'}};
 
-  const char* const short_opts = "i:w:u:gh";
+  const char* const short_opts = "i:w:u:gp:h";
 
   opts.ni_mode = NON_MATCHING;
   opts.op = PUT;
@@ -305,6 +692,7 @@ main(int argc, char* argv[])
   opts.event_type = COUNTING;
   opts.cache_size = _16MiB;
   opts.cache_state = HOT_CACHE;
+  opts.me_post = ME_POST_SERIAL;
 
   while(1)
   {
@@ -331,6 +719,31 @@ main(int argc, char* argv[])
     case 'g':
       opts.op = GET;
       break;
+    case 1:
+      opts.calibrate = 1;
+      break;
+    case 'p':
+      cache_pids = atoi(optarg);
+      break;
+    case 2:
+      set_cache_regions_path(optarg);
+      break;
+    case 3:
+      if(0 == strcmp(optarg, "serial"))
+        opts.me_post = ME_POST_SERIAL;
+      else if(0 == strcmp(optarg, "batched"))
+        opts.me_post = ME_POST_BATCHED;
+      else if(0 == strcmp(optarg, "nolink"))
+        opts.me_post = ME_POST_NO_LINK;
+      else
+        exit(EXIT_FAILURE);
+      break;
+    case 4:
+      opts.append_rate = 1;
+      break;
+    case 5:
+      opts.double_buffer = 1;
+      break;
     case 'h':
       // print_help_message();
       exit(EXIT_SUCCESS);
@@ -355,6 +768,8 @@ main(int argc, char* argv[])
     MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
   }
 
+  locality = get_peer_locality((rank + 1) % 2);
+
   PtlInit();
   eret = init_p4_ctx(&ctx, PTL_NI_MATCHING);
   if(PTL_OK != eret)
@@ -378,8 +793,18 @@ main(int argc, char* argv[])
   //  goto END;
   // cache_buffer_size = opts.cache_size / sizeof(int);
 
-  set_cache_regions(1);
-  run_me_non_persistent_benchmark();
+  // the v2p cache pids setting is only touched on request and restored at exit
+  if(0 <= cache_pids)
+  {
+    save_cache_regions();
+    MPI_Barrier(MPI_COMM_WORLD);
+    set_cache_regions(cache_pids);
+    MPI_Barrier(MPI_COMM_WORLD);
+  }
+  if(opts.append_rate)
+    run_append_rate_benchmark();
+  else
+    run_me_non_persistent_benchmark();
 END:
   // free(cache_buffer);
   destroy_p4_ctx(&ctx);
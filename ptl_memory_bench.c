@@ -1,4 +1,5 @@
 #include <getopt.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <time.h>
 #include "common.h"
@@ -7,6 +8,7 @@
 static int rank;
 static int num_ranks;
 static p4_ctx_t ctx;
+static locality_t locality;
 static memory_benchmark_opts_t opts;
 static size_t page_size;
 static char processor_name[MPI_MAX_PROCESSOR_NAME];
@@ -19,13 +21,90 @@ int (*communicate)(const ptl_handle_md_t md_h,
                    const ptl_index_t index,
                    const ptl_ack_req_t req_type);
 
-int get_random_index() {
-	int blocks = page_size / opts.msg_size;
-	return rand() % blocks;
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+
+#define NOTIFY_INDEX 23
+
+static const char* const page_backing_names[] = {"", "base", "thp", "2m", "1g"};
+static const char* const recold_names[] = {"", "dontneed", "pageout"};
+static int cache_pids[MAX_CACHE_PIDS_SETTINGS];
+static int num_cache_pids;
+static char pids_column[16];
+static int header_printed;
+
+/*
+ * Bytes mapped per iteration: enough pages for one message, plus one more
+ * page if the transfer has to straddle a page boundary.
+ */
+static size_t region_size;
+
+/*
+ * The header is printed once even if the selected benchmark is re-run for
+ * several cache pids settings.
+ */
+void print_header(const char* const columns) {
+	if (0 != rank || header_printed)
+		return;
+	fprintf(stdout,
+	        "%s%s\n",
+	        columns,
+	        0 < num_cache_pids ? ",cache_pids" : "");
+	header_printed = 1;
+}
+
+int get_random_index(const size_t bytes) {
+	int blocks = bytes / opts.msg_size;
+	return 0 < blocks ? rand() % blocks : 0;
+}
+
+ptl_size_t get_block_offset() {
+	if (opts.span)
+		return page_size - opts.msg_size / 2;
+	return get_random_index(region_size) * opts.msg_size;
+}
+
+/*
+ * Maps bytes (a multiple of page_size) backed by the selected page size. THP
+ * needs a huge-page aligned range, so the mapping is over-allocated and
+ * trimmed before MADV_HUGEPAGE.
+ */
+void* map_pages(const size_t bytes, const int extra_flags) {
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | extra_flags;
+	char* p;
+
+	switch (opts.page_backing) {
+		case HUGETLB_2M:
+			flags |= MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+			break;
+		case HUGETLB_1G:
+			flags |= MAP_HUGETLB | (30 << MAP_HUGE_SHIFT);
+			break;
+		case THP_PAGES:
+			p = mmap(NULL, bytes + page_size, PROT_READ | PROT_WRITE, flags,
+			         -1, 0);
+			if (MAP_FAILED == p)
+				return p;
+			char* aligned =
+			    (char*) (((uintptr_t) p + page_size - 1) & ~(page_size - 1));
+			if (aligned > p)
+				munmap(p, aligned - p);
+			if (aligned + bytes < p + bytes + page_size)
+				munmap(aligned + bytes, p + page_size - aligned);
+			madvise(aligned, bytes, MADV_HUGEPAGE);
+			return aligned;
+		default:
+			break;
+	}
+	return mmap(NULL, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
 }
 
 void touch_cold_pages(const int n_pages) {
-	size_t ints_per_page = page_size / sizeof(int);
+	size_t ints_per_page = region_size / sizeof(int);
 	int** buffer = (int**) page_buffer;
 	for (int p = 0; p < n_pages; ++p)
 		for (size_t i = 0; i < ints_per_page; ++i) {
@@ -35,19 +114,21 @@ void touch_cold_pages(const int n_pages) {
 
 int get_cold_pages(const int n_pages) {
 	for (int p = 0; p < n_pages; ++p) {
-		page_buffer[p] = mmap(NULL,
-		                      page_size,
-		                      PROT_READ | PROT_WRITE,
-		                      MAP_PRIVATE | MAP_ANONYMOUS,
-		                      -1,
-		                      0);
+		page_buffer[p] = map_pages(region_size, 0);
+		if (MAP_FAILED == page_buffer[p]) {
+			fprintf(stderr,
+			        "Failed to map %lu bytes of %s pages\n",
+			        region_size,
+			        page_backing_names[opts.page_backing]);
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
 	}
+	return 0;
 }
 
 void free_cold_pages(const int n_pages) {
-	size_t page_size = sysconf(_SC_PAGESIZE);
 	for (int i = 0; i < n_pages; ++i) {
-		munmap(page_buffer[i], page_size);
+		munmap(page_buffer[i], region_size);
 	}
 }
 
@@ -92,23 +173,22 @@ void run_one_sided_benchmark() {
 
 	p4_pt_alloc(&ctx, &index);
 
-	if (0 == rank) {
-		// print header
-		fprintf(stdout,
-		        "op,benchmark,local_page_state,remote_page_state,msg_size,latency\n");
-	}
+	// print header
+	print_header(
+	    "op,benchmark,local_page_state,remote_page_state,msg_size,latency,"
+	    "locality,page,span");
 
 	for (int i = 0; i < opts.iterations; ++i) {
 		get_cold_pages(1);
 
 		if (1 == rank) {
-			p4_le_insert(&ctx, &le_h, page_buffer[0], page_size, index);
+			p4_le_insert(&ctx, &le_h, page_buffer[0], region_size, index);
 			if (HOT == opts.remote_state) {
 				touch_cold_pages(1);
 			}
 		}
 		else {
-			p4_md_alloc_eq(&ctx, &md_h, page_buffer[0], page_size);
+			p4_md_alloc_eq(&ctx, &md_h, page_buffer[0], region_size);
 			if (HOT == opts.local_state) {
 				touch_cold_pages(1);
 			}
@@ -117,7 +197,7 @@ void run_one_sided_benchmark() {
 		MPI_Barrier(MPI_COMM_WORLD);
 
 		if (0 == rank) {
-			ptl_size_t block_offset = get_random_index() * opts.msg_size;
+			ptl_size_t block_offset = get_block_offset();
 			invalidate_cache(cache_buffer, cache_buffer_size);
 
 			double t0 = MPI_Wtime();
@@ -131,13 +211,17 @@ void run_one_sided_benchmark() {
 			}
 			double t = MPI_Wtime() - t0;
 			fprintf(stdout,
-			        "%s,%s,%s,%s,%i,%.4f\n",
+			        "%s,%s,%s,%s,%i,%.4f,%s,%s,%i%s\n",
 				opts.op == PUT ? "PtlPut" : "PtlGet",
 				"one_sided",
 			        opts.local_state == COLD ? "cold" : "hot",
 			        opts.remote_state == COLD ? "cold" : "hot",
 			        opts.msg_size,
-			        t * 1e6);
+			        t * 1e6,
+			        INTRA_NODE == locality ? "intra" : "inter",
+			        page_backing_names[opts.page_backing],
+			        opts.span,
+			        pids_column);
 			p4_md_free(md_h);
 		}
 		MPI_Barrier(MPI_COMM_WORLD);
@@ -162,20 +246,20 @@ void run_ping_pong_benchmark() {
 
 	MPI_Barrier(MPI_COMM_WORLD);
 
-	if (0 == rank) {
-		// print header
-		fprintf(stdout,
-		        "op,benchmark,local_page_state,remote_page_state,msg_size,latency\n");
-	}
+	// print header
+	print_header(
+	    "op,benchmark,local_page_state,remote_page_state,msg_size,latency,"
+	    "locality,page,span");
 
 	for (int i = 0; i < opts.iterations; ++i) {
 		get_cold_pages(1);
 
-		p4_le_insert_full_comm(&ctx, &le_h, page_buffer[0], page_size, index);
+		p4_le_insert_full_comm(
+		    &ctx, &le_h, page_buffer[0], region_size, index);
 		if (1 == rank && HOT == opts.remote_state) {
 			touch_cold_pages(1);
 		}
-		p4_md_alloc_eq(&ctx, &md_h, page_buffer[0], page_size);
+		p4_md_alloc_eq(&ctx, &md_h, page_buffer[0], region_size);
 		if (0 == rank && HOT == opts.local_state) {
 			touch_cold_pages(1);
 		}
@@ -183,7 +267,7 @@ void run_ping_pong_benchmark() {
 		MPI_Barrier(MPI_COMM_WORLD);
 
 		if (0 == rank) {
-			ptl_size_t block_offset = get_random_index() * opts.msg_size;
+			ptl_size_t block_offset = get_block_offset();
 			invalidate_cache(cache_buffer, cache_buffer_size);
 
 			double t0 = MPI_Wtime();
@@ -198,13 +282,17 @@ void run_ping_pong_benchmark() {
 
 			double t = MPI_Wtime() - t0;
 			fprintf(stdout,
-			        "%s,%s,%s,%s,%i,%.4f\n",
+			        "%s,%s,%s,%s,%i,%.4f,%s,%s,%i%s\n",
 				"PtlPut",
 				"ping_pong",
 			        opts.local_state == COLD ? "cold" : "hot",
 			        opts.remote_state == COLD ? "cold" : "hot",
 			        opts.msg_size,
-			        t * 1e6);
+			        t * 1e6,
+			        INTRA_NODE == locality ? "intra" : "inter",
+			        page_backing_names[opts.page_backing],
+			        opts.span,
+			        pids_column);
 		}
 		else {
 			PtlEQWait(ctx.eq_h, &event);
@@ -224,6 +312,608 @@ void run_ping_pong_benchmark() {
 	p4_pt_free(&ctx, index);
 }
 
+/*
+ * One region of max_ws bytes is registered once and pre-faulted on both
+ * sides, so the only translation work left is the NIC's v2p lookup. For each
+ * working set the same number of untimed and timed operations go to random
+ * pages inside the first ws bytes; once ws exceeds the reach of the v2p cache
+ * every access misses.
+ */
+void run_ws_sweep_benchmark() {
+	ptl_handle_le_t le_h;
+	ptl_handle_md_t md_h;
+	ptl_index_t index;
+	ptl_event_t event;
+	void* region;
+	ptl_size_t* offsets;
+
+	communicate = opts.op == PUT ? &put_operation : &get_operation;
+
+	opts.max_ws = (opts.max_ws + page_size - 1) & ~(page_size - 1);
+	if (opts.min_ws < region_size)
+		opts.min_ws = region_size;
+
+	p4_pt_alloc(&ctx, &index);
+
+	region = map_pages(opts.max_ws, 0);
+	offsets = malloc(sizeof(ptl_size_t) * opts.iterations);
+	if (MAP_FAILED == region || NULL == offsets) {
+		fprintf(stderr, "Failed to allocate %lu bytes\n", opts.max_ws);
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	for (size_t p = 0; p < opts.max_ws; p += page_size)
+		((volatile char*) region)[p] = 1;
+
+	if (1 == rank)
+		p4_le_insert(&ctx, &le_h, region, opts.max_ws, index);
+	else
+		p4_md_alloc_eq(&ctx, &md_h, region, opts.max_ws);
+
+	// print header
+	print_header("op,benchmark,working_set,msg_size,latency,locality,page");
+
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	if (0 == rank) {
+		for (size_t ws = opts.min_ws; ws <= opts.max_ws; ws *= 2) {
+			// the last page must still hold a whole message
+			const size_t pages = (ws - region_size) / page_size + 1;
+
+			for (int warm = 1; warm >= 0; --warm) {
+				for (int i = 0; i < opts.iterations; ++i)
+					offsets[i] = (rand() % pages) * page_size +
+					             get_random_index(page_size) * opts.msg_size;
+
+				for (int i = 0; i < opts.iterations; ++i) {
+					double t0 = MPI_Wtime();
+
+					communicate(md_h, offsets[i], index, PTL_ACK_REQ);
+
+					PtlEQWait(ctx.eq_h, &event);
+					if (PTL_NI_OK != event.ni_fail_type) {
+						fprintf(stderr,
+						        "%s failed with %i\n",
+						        opts.op == PUT ? "PtlPut" : "PtlGet",
+						        event.ni_fail_type);
+						MPI_Abort(MPI_COMM_WORLD, -1);
+					}
+					double t = MPI_Wtime() - t0;
+					if (warm)
+						continue;
+					fprintf(stdout,
+					        "%s,%s,%lu,%i,%.4f,%s,%s%s\n",
+					        opts.op == PUT ? "PtlPut" : "PtlGet",
+					        "ws_sweep",
+					        ws,
+					        opts.msg_size,
+					        t * 1e6,
+					        INTRA_NODE == locality ? "intra" : "inter",
+					        page_backing_names[opts.page_backing],
+					        pids_column);
+				}
+			}
+		}
+	}
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	if (1 == rank)
+		p4_le_remove(le_h);
+	else
+		p4_md_free(md_h);
+	free(offsets);
+	munmap(region, opts.max_ws);
+	p4_pt_free(&ctx, index);
+}
+
+/*
+ * Streams the whole region once per iteration in windows of window_size
+ * operations. Every iteration maps a fresh region, so with cold pages the NIC
+ * and the host fault pages in while the stream runs; --populate prefaults
+ * both sides with MAP_POPULATE instead. The bandwidth of every window is kept
+ * in memory and printed after the stream to show it over time.
+ */
+void run_stream_benchmark() {
+	ptl_handle_le_t le_h;
+	ptl_handle_md_t md_h;
+	ptl_index_t index;
+	ptl_event_t event;
+	void* region;
+
+	communicate = opts.op == PUT ? &put_operation : &get_operation;
+
+	const size_t bytes = (opts.stream_size + page_size - 1) & ~(page_size - 1);
+	const size_t ops = bytes / opts.msg_size;
+	const size_t windows = (ops + opts.window_size - 1) / opts.window_size;
+	double* elapsed = malloc(sizeof(double) * windows);
+	double* window_time = malloc(sizeof(double) * windows);
+	const char* local_state = opts.populate          ? "populated"
+	                          : HOT == opts.local_state ? "hot"
+	                                                    : "cold";
+	const char* remote_state = opts.populate           ? "populated"
+	                           : HOT == opts.remote_state ? "hot"
+	                                                      : "cold";
+
+	if (0 == ops || NULL == elapsed || NULL == window_time) {
+		fprintf(stderr, "Invalid stream of %lu bytes\n", bytes);
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+
+	p4_pt_alloc(&ctx, &index);
+
+	// print header
+	print_header(
+	    "op,benchmark,local_page_state,remote_page_state,msg_size,"
+	    "iteration,offset,elapsed,bandwidth,locality,page");
+
+	for (int i = 0; i < opts.iterations; ++i) {
+		region = map_pages(bytes, opts.populate ? MAP_POPULATE : 0);
+		if (MAP_FAILED == region) {
+			fprintf(stderr, "Failed to map %lu bytes\n", bytes);
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+
+		if (1 == rank) {
+			p4_le_insert(&ctx, &le_h, region, bytes, index);
+			if (HOT == opts.remote_state)
+				memset(region, 1, bytes);
+		}
+		else {
+			p4_md_alloc_eq(&ctx, &md_h, region, bytes);
+			if (HOT == opts.local_state)
+				memset(region, 1, bytes);
+		}
+
+		MPI_Barrier(MPI_COMM_WORLD);
+
+		if (0 == rank) {
+			const double t_start = MPI_Wtime();
+			double t0 = t_start;
+			size_t op = 0;
+
+			for (size_t w = 0; w < windows; ++w) {
+				const size_t first = op;
+				for (; op < ops && op < first + opts.window_size; ++op)
+					communicate(
+					    md_h, op * opts.msg_size, index, PTL_ACK_REQ);
+				for (size_t c = first; c < op; ++c) {
+					PtlEQWait(ctx.eq_h, &event);
+					if (PTL_NI_OK != event.ni_fail_type) {
+						fprintf(stderr,
+						        "%s failed with %i\n",
+						        opts.op == PUT ? "PtlPut" : "PtlGet",
+						        event.ni_fail_type);
+						MPI_Abort(MPI_COMM_WORLD, -1);
+					}
+				}
+				const double t = MPI_Wtime();
+				window_time[w] = t - t0;
+				elapsed[w] = t - t_start;
+				t0 = t;
+			}
+
+			for (size_t w = 0; w < windows; ++w) {
+				const size_t first = w * opts.window_size;
+				const size_t last = first + opts.window_size < ops
+				                        ? first + opts.window_size
+				                        : ops;
+				const size_t offset = first * opts.msg_size;
+				const size_t window_bytes =
+				    (last - first) * opts.msg_size;
+				fprintf(stdout,
+				        "%s,%s,%s,%s,%i,%i,%lu,%.4f,%.4f,%s,%s%s\n",
+				        opts.op == PUT ? "PtlPut" : "PtlGet",
+				        "stream",
+				        local_state,
+				        remote_state,
+				        opts.msg_size,
+				        i,
+				        offset,
+				        elapsed[w] * 1e6,
+				        window_bytes * 1e-6 / window_time[w],
+				        INTRA_NODE == locality ? "intra" : "inter",
+				        page_backing_names[opts.page_backing],
+				        pids_column);
+			}
+			fprintf(stderr,
+			        "iteration %i: %.4f MB/s over %lu bytes\n",
+			        i,
+			        ops * opts.msg_size * 1e-6 / elapsed[windows - 1],
+			        ops * opts.msg_size);
+			p4_md_free(md_h);
+		}
+
+		MPI_Barrier(MPI_COMM_WORLD);
+		if (1 == rank)
+			p4_le_remove(le_h);
+		munmap(region, bytes);
+	}
+
+	free(elapsed);
+	free(window_time);
+	p4_pt_free(&ctx, index);
+}
+
+/*
+ * Zero-byte put channel that replaces MPI_Barrier in the pooled mode: the
+ * target signals that its region is prepared, the initiator waits on the CT.
+ */
+typedef struct {
+	ptl_index_t index;
+	ptl_handle_ct_t ct_h;
+	ptl_handle_le_t le_h;
+	ptl_handle_md_t md_h;
+} notify_ctx_t;
+
+void setup_notify_channel(notify_ctx_t* const n) {
+	int eret = PtlCTAlloc(ctx.ni_h, &n->ct_h);
+	if (PTL_OK == eret)
+		eret = PtlPTAlloc(
+		    ctx.ni_h, 0, PTL_EQ_NONE, NOTIFY_INDEX, &n->index);
+
+	ptl_le_t le = {.start = NULL,
+	               .length = 0,
+	               .options = PTL_LE_OP_PUT | PTL_LE_EVENT_CT_COMM,
+	               .uid = PTL_UID_ANY,
+	               .ct_handle = n->ct_h};
+	if (PTL_OK == eret)
+		eret = PtlLEAppend(
+		    ctx.ni_h, n->index, &le, PTL_PRIORITY_LIST, NULL, &n->le_h);
+
+	ptl_md_t md = {.start = NULL,
+	               .length = 0,
+	               .options = PTL_MD_EVENT_SUCCESS_DISABLE,
+	               .ct_handle = PTL_CT_NONE,
+	               .eq_handle = PTL_EQ_NONE};
+	if (PTL_OK == eret)
+		eret = PtlMDBind(ctx.ni_h, &md, &n->md_h);
+	if (PTL_OK != eret) {
+		fprintf(stderr, "Failed to set up the notification channel\n");
+		MPI_Abort(MPI_COMM_WORLD, eret);
+	}
+}
+
+void free_notify_channel(notify_ctx_t* const n) {
+	PtlMDRelease(n->md_h);
+	PtlLEUnlink(n->le_h);
+	PtlPTFree(ctx.ni_h, n->index);
+	PtlCTFree(n->ct_h);
+}
+
+void notify_peer(notify_ctx_t* const n) {
+	int eret = PtlPut(
+	    n->md_h, 0, 0, PTL_NO_ACK_REQ, ctx.peer_addr, n->index, 0, 0, NULL, 0);
+	if (PTL_OK != eret)
+		MPI_Abort(MPI_COMM_WORLD, eret);
+}
+
+void wait_for_notification(notify_ctx_t* const n, const ptl_size_t count) {
+	ptl_ct_event_t event;
+	int eret = PtlCTWait(n->ct_h, count, &event);
+	if (PTL_OK != eret || 0 < event.failure)
+		MPI_Abort(MPI_COMM_WORLD, -1);
+}
+
+/*
+ * Drops the pages of one pool region and, if requested, touches them again,
+ * so that every sample starts from the configured page state.
+ */
+void prepare_region(char* const region, const page_state_t state) {
+	madvise(region,
+	        region_size,
+	        RECOLD_PAGEOUT == opts.recold ? MADV_PAGEOUT : MADV_DONTNEED);
+	if (HOT == state)
+		memset(region, 1, region_size);
+}
+
+/*
+ * Both sides map and register a pool of pool_size regions once. Sample i uses
+ * region i % pool_size, which both sides re-cold with madvise() before use.
+ * Readiness of the target is signalled with a zero-byte put instead of a
+ * barrier, and with ping-pong the reply itself completes the sample.
+ */
+void run_pooled_benchmark() {
+	ptl_handle_le_t le_h;
+	ptl_handle_md_t md_h;
+	ptl_index_t index;
+	ptl_event_t event;
+	ptl_ct_event_t ct_event;
+	ptl_ct_event_t zero = {.success = 0, .failure = 0};
+	notify_ctx_t notify;
+	char* pool;
+	char benchmark[32];
+
+	const size_t pool_bytes = region_size * opts.pool_size;
+	const int one_sided = ONE_SIDED == opts.pattern;
+
+	communicate =
+	    one_sided && GET == opts.op ? &get_operation : &put_operation;
+	snprintf(benchmark,
+	         sizeof(benchmark),
+	         "%s_%s",
+	         one_sided ? "one_sided" : "ping_pong",
+	         recold_names[opts.recold]);
+
+	p4_pt_alloc(&ctx, &index);
+	setup_notify_channel(&notify);
+
+	pool = map_pages(pool_bytes, 0);
+	if (MAP_FAILED == pool) {
+		fprintf(stderr, "Failed to map %lu bytes\n", pool_bytes);
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+
+	if (one_sided && 1 == rank)
+		p4_le_insert_ct_comm(&ctx, &le_h, pool, pool_bytes, index);
+	else if (!one_sided)
+		p4_le_insert_full_comm(&ctx, &le_h, pool, pool_bytes, index);
+	if (!one_sided || 0 == rank)
+		p4_md_alloc_eq(&ctx, &md_h, pool, pool_bytes);
+
+	// print header
+	print_header(
+	    "op,benchmark,local_page_state,remote_page_state,msg_size,latency,"
+	    "locality,page,span");
+
+	// the target waits for i + 1 puts, start every call (e.g. of a pids
+	// sweep) from zero
+	if (PTL_OK != PtlCTSet(ctx.ct_h, zero)) {
+		fprintf(stderr, "PtlCTSet failed\n");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	for (int i = 0; i < opts.iterations; ++i) {
+		const size_t base = (i % opts.pool_size) * region_size;
+
+		if (0 == rank) {
+			prepare_region(pool + base, opts.local_state);
+			ptl_size_t block_offset = base + get_block_offset();
+			invalidate_cache(cache_buffer, cache_buffer_size);
+			wait_for_notification(&notify, i + 1);
+
+			double t0 = MPI_Wtime();
+
+			communicate(md_h,
+			            block_offset,
+			            index,
+			            one_sided ? PTL_ACK_REQ : PTL_NO_ACK_REQ);
+
+			PtlEQWait(ctx.eq_h, &event);
+			if (PTL_NI_OK != event.ni_fail_type) {
+				fprintf(stderr, "PtlPut failed with %i\n", event.ni_fail_type);
+				MPI_Abort(MPI_COMM_WORLD, -1);
+			}
+
+			double t = MPI_Wtime() - t0;
+			fprintf(stdout,
+			        "%s,%s,%s,%s,%i,%.4f,%s,%s,%i%s\n",
+			        GET == opts.op && one_sided ? "PtlGet" : "PtlPut",
+			        benchmark,
+			        opts.local_state == COLD ? "cold" : "hot",
+			        opts.remote_state == COLD ? "cold" : "hot",
+			        opts.msg_size,
+			        t * 1e6,
+			        INTRA_NODE == locality ? "intra" : "inter",
+			        page_backing_names[opts.page_backing],
+			        opts.span,
+			        pids_column);
+		}
+		else {
+			prepare_region(pool + base, opts.remote_state);
+			notify_peer(&notify);
+			if (one_sided) {
+				PtlCTWait(ctx.ct_h, i + 1, &ct_event);
+			}
+			else {
+				PtlEQWait(ctx.eq_h, &event);
+				if (PTL_NI_OK != event.ni_fail_type) {
+					fprintf(
+					    stderr, "PtlPut failed with %i\n", event.ni_fail_type);
+					MPI_Abort(MPI_COMM_WORLD, -1);
+				}
+				communicate(
+				    md_h, event.remote_offset, index, PTL_NO_ACK_REQ);
+			}
+		}
+	}
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	if (!one_sided || 0 == rank)
+		p4_md_free(md_h);
+	if (!one_sided || 1 == rank)
+		p4_le_remove(le_h);
+	munmap(pool, pool_bytes);
+	free_notify_channel(&notify);
+	p4_pt_free(&ctx, index);
+}
+
+static const char* const backing_names[] = {
+    "", "lazy", "populate", "mlock", "mlockall", "thread"};
+
+void* touch_region_thread(void* arg) {
+	for (size_t p = 0; p < region_size; p += sysconf(_SC_PAGESIZE))
+		((volatile char*) arg)[p] = 1;
+	return NULL;
+}
+
+/*
+ * Maps one region with the selected backing. lazy leaves it to first touch
+ * (or touches it with -l/-r), the others have every page resident before the
+ * region is registered: prefaulted by the kernel, pinned, or faulted in by a
+ * different thread than the one that registers and communicates.
+ */
+void* map_backed_region(const page_state_t state) {
+	void* region = map_pages(
+	    region_size, BACKING_POPULATE == opts.backing ? MAP_POPULATE : 0);
+	pthread_t thread;
+
+	if (MAP_FAILED == region)
+		return region;
+	switch (opts.backing) {
+		case BACKING_LAZY:
+			if (HOT == state)
+				memset(region, 1, region_size);
+			break;
+		case BACKING_MLOCK:
+			if (0 != mlock(region, region_size)) {
+				perror("mlock");
+				MPI_Abort(MPI_COMM_WORLD, -1);
+			}
+			break;
+		case BACKING_THREAD:
+			pthread_create(&thread, NULL, touch_region_thread, region);
+			pthread_join(thread, NULL);
+			break;
+		default:
+			break;
+	}
+	return region;
+}
+
+/*
+ * Registration and first-use cost of a fresh region per backing. Every
+ * iteration both ranks map a region, the initiator binds an MD and the target
+ * appends an LE, then two operations are timed: the first pays for whatever
+ * the NIC still has to fault or translate, the second is the warm reference.
+ * The target's timings are sent to rank 0 after the iteration.
+ */
+void run_registration_benchmark() {
+	ptl_handle_le_t le_h;
+	ptl_handle_md_t md_h;
+	ptl_index_t index;
+	ptl_event_t event;
+	void* region;
+	double t[8];
+	const char* const ops[] = {"map_local",
+	                           "map_remote",
+	                           "PtlMDBind",
+	                           "PtlLEAppend",
+	                           opts.op == PUT ? "PtlPut_first" : "PtlGet_first",
+	                           opts.op == PUT ? "PtlPut_second" : "PtlGet_second",
+	                           "PtlMDRelease",
+	                           "PtlLEUnlink"};
+	const char* local_state = HOT == opts.local_state ? "hot" : "cold";
+	const char* remote_state = HOT == opts.remote_state ? "hot" : "cold";
+
+	if (BACKING_LAZY != opts.backing) {
+		local_state = backing_names[opts.backing];
+		remote_state = backing_names[opts.backing];
+	}
+
+	communicate = opts.op == PUT ? &put_operation : &get_operation;
+
+	p4_pt_alloc(&ctx, &index);
+
+	if (BACKING_MLOCKALL == opts.backing &&
+	    0 != mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		perror("mlockall");
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+
+	// print header
+	print_header(
+	    "op,benchmark,local_page_state,remote_page_state,msg_size,latency,"
+	    "locality,page,span");
+
+	for (int i = 0; i < opts.iterations; ++i) {
+		double t0 = MPI_Wtime();
+		region = map_backed_region(0 == rank ? opts.local_state
+		                                     : opts.remote_state);
+		if (MAP_FAILED == region) {
+			fprintf(stderr, "Failed to map %lu bytes\n", region_size);
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		t[rank] = MPI_Wtime() - t0;
+
+		t0 = MPI_Wtime();
+		if (0 == rank)
+			p4_md_alloc_eq(&ctx, &md_h, region, region_size);
+		else
+			p4_le_insert(&ctx, &le_h, region, region_size, index);
+		t[2 + rank] = MPI_Wtime() - t0;
+
+		MPI_Barrier(MPI_COMM_WORLD);
+
+		if (0 == rank) {
+			ptl_size_t block_offset = get_block_offset();
+			for (int o = 0; o < 2; ++o) {
+				t0 = MPI_Wtime();
+				communicate(md_h, block_offset, index, PTL_ACK_REQ);
+				PtlEQWait(ctx.eq_h, &event);
+				if (PTL_NI_OK != event.ni_fail_type) {
+					fprintf(stderr,
+					        "%s failed with %i\n",
+					        ops[4 + o],
+					        event.ni_fail_type);
+					MPI_Abort(MPI_COMM_WORLD, -1);
+				}
+				t[4 + o] = MPI_Wtime() - t0;
+			}
+		}
+
+		MPI_Barrier(MPI_COMM_WORLD);
+
+		t0 = MPI_Wtime();
+		if (0 == rank)
+			p4_md_free(md_h);
+		else
+			p4_le_remove(le_h);
+		t[6 + rank] = MPI_Wtime() - t0;
+
+		if (1 == rank) {
+			const double remote[3] = {t[1], t[3], t[7]};
+			MPI_Send(remote, 3, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+		}
+		else {
+			double remote[3];
+			MPI_Recv(remote,
+			         3,
+			         MPI_DOUBLE,
+			         1,
+			         0,
+			         MPI_COMM_WORLD,
+			         MPI_STATUS_IGNORE);
+			t[1] = remote[0];
+			t[3] = remote[1];
+			t[7] = remote[2];
+			for (int o = 0; o < 8; ++o)
+				fprintf(stdout,
+				        "%s,%s,%s,%s,%lu,%.4f,%s,%s,%i%s\n",
+				        ops[o],
+				        "registration",
+				        local_state,
+				        remote_state,
+				        4 <= o && 6 > o ? opts.msg_size : region_size,
+				        t[o] * 1e6,
+				        INTRA_NODE == locality ? "intra" : "inter",
+				        page_backing_names[opts.page_backing],
+				        opts.span,
+				        pids_column);
+		}
+		munmap(region, region_size);
+	}
+
+	if (BACKING_MLOCKALL == opts.backing)
+		munlockall();
+	p4_pt_free(&ctx, index);
+}
+
+/*
+ * Writes the cache pids setting on every node and tags the rows of the next
+ * run with it.
+ */
+void apply_cache_pids(const int pids) {
+	if (0 > set_cache_regions(pids))
+		MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+	snprintf(pids_column, sizeof(pids_column), ",%i", pids);
+	if (0 == rank) {
+		fprintf(stderr, "cache_pids: %i\n", pids);
+		fflush(stderr);
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+}
+
 void print_help_message() {
 	printf("Usage: ptl_memory_bench [options]\n");
 	printf("Options:\n");
@@ -239,6 +929,55 @@ void print_help_message() {
 	printf(
 	    "  -m, --msg_size <size>     Set the message size in bytes (required "
 	    "argument)\n");
+	printf(
+	    "  --pages <base|thp|2m|1g>  Back the buffers with base pages, "
+	    "transparent huge pages or 2 MiB/1 GiB hugetlbfs pages (default "
+	    "base)\n");
+	printf(
+	    "  --span                    Place the message across the first "
+	    "page boundary of a two page region (no argument)\n");
+	printf(
+	    "  -s, --ws_sweep            Sweep the working set of random page "
+	    "accesses inside one registered region (no argument)\n");
+	printf(
+	    "  --min_ws <bytes>          Smallest working set of the sweep "
+	    "(default 4096)\n");
+	printf(
+	    "  --max_ws <bytes>          Largest working set and size of the "
+	    "registered region (default 1 GiB)\n");
+	printf(
+	    "  -b, --stream              Stream over a freshly mapped region and "
+	    "report the bandwidth of every window (no argument)\n");
+	printf(
+	    "  --stream_size <bytes>     Size of the streamed region (default "
+	    "256 MiB)\n");
+	printf(
+	    "  -w, --window <num>        Operations in flight per window in "
+	    "stream mode (default 16)\n");
+	printf(
+	    "  --populate                Prefault the streamed region with "
+	    "MAP_POPULATE (no argument)\n");
+	printf(
+	    "  --pooled <dontneed|pageout>  Register one pool of regions once and "
+	    "re-cold a region with madvise() before every sample\n");
+	printf(
+	    "  --pool_size <num>         Regions in the pool (default 1024)\n");
+	printf(
+	    "  --registration            Time mapping, MD bind/release, LE "
+	    "append/unlink and the first two operations on a fresh region (no "
+	    "argument)\n");
+	printf(
+	    "  --backing <lazy|populate|mlock|mlockall|thread>  How the "
+	    "registered region is backed (default lazy)\n");
+	printf(
+	    "  --pids <num>              Write the v2p cache pids setting before "
+	    "the run\n");
+	printf(
+	    "  --pids_sweep <list>       Re-run the selected benchmark for each "
+	    "comma separated cache pids setting\n");
+	printf(
+	    "  --pids_path <path>        Cache pids sysfs file (default "
+	    "$PTLBENCH_V2P_CACHE_PIDS or the build default)\n");
 	printf(
 	    "  -h, --help                Display this help message (no "
 	    "argument)\n");
@@ -255,9 +994,25 @@ int main(int argc, char* argv[]) {
 	    {"get", no_argument, NULL, 'g'},
 	    {"msg_size", required_argument, NULL, 'm'},
 	    {"ping_pong", no_argument, NULL, 'p'},
+	    {"ws_sweep", no_argument, NULL, 's'},
+	    {"min_ws", required_argument, NULL, 1},
+	    {"max_ws", required_argument, NULL, 2},
+	    {"pages", required_argument, NULL, 3},
+	    {"span", no_argument, NULL, 4},
+	    {"stream", no_argument, NULL, 'b'},
+	    {"stream_size", required_argument, NULL, 5},
+	    {"window", required_argument, NULL, 'w'},
+	    {"populate", no_argument, NULL, 6},
+	    {"pooled", required_argument, NULL, 7},
+	    {"pool_size", required_argument, NULL, 8},
+	    {"registration", no_argument, NULL, 9},
+	    {"backing", required_argument, NULL, 10},
+	    {"pids", required_argument, NULL, 11},
+	    {"pids_sweep", required_argument, NULL, 12},
+	    {"pids_path", required_argument, NULL, 13},
 	    {"help", no_argument, NULL, 'h'}};
 
-	const char* const short_opts = "i:c:m:lrpgh";
+	const char* const short_opts = "i:c:m:w:lrpsbgh";
 
 	opts.iterations = 10;
 	opts.msg_size = 512;
@@ -266,6 +1021,17 @@ int main(int argc, char* argv[]) {
 	opts.local_state = COLD;
 	opts.op = PUT;
 	opts.pattern = ONE_SIDED;
+	opts.min_ws = 4096;
+	opts.max_ws = 1024 * MiB;
+	opts.page_backing = BASE_PAGES;
+	opts.span = 0;
+	opts.stream_size = 256 * MiB;
+	opts.window_size = 16;
+	opts.populate = 0;
+	opts.recold = 0;
+	opts.pool_size = 1024;
+	opts.registration = 0;
+	opts.backing = BACKING_LAZY;
 
 	while (1) {
 		const int opt = getopt_long(argc, argv, short_opts, long_opts, NULL);
@@ -289,6 +1055,93 @@ int main(int argc, char* argv[]) {
 			case 'p':
 				opts.pattern = PINGPONG;
 				break;
+			case 's':
+				opts.pattern = WS_SWEEP;
+				break;
+			case 1:
+				opts.min_ws = strtoull(optarg, NULL, 0);
+				break;
+			case 2:
+				opts.max_ws = strtoull(optarg, NULL, 0);
+				break;
+			case 3:
+				if (0 == strcmp(optarg, "thp"))
+					opts.page_backing = THP_PAGES;
+				else if (0 == strcmp(optarg, "2m"))
+					opts.page_backing = HUGETLB_2M;
+				else if (0 == strcmp(optarg, "1g"))
+					opts.page_backing = HUGETLB_1G;
+				else if (0 == strcmp(optarg, "base"))
+					opts.page_backing = BASE_PAGES;
+				else {
+					print_help_message();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 4:
+				opts.span = 1;
+				break;
+			case 'b':
+				opts.pattern = STREAM;
+				break;
+			case 5:
+				opts.stream_size = strtoull(optarg, NULL, 0);
+				break;
+			case 'w':
+				opts.window_size = atoi(optarg);
+				if (1 > opts.window_size) {
+					print_help_message();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 6:
+				opts.populate = 1;
+				break;
+			case 7:
+				if (0 == strcmp(optarg, "dontneed"))
+					opts.recold = RECOLD_DONTNEED;
+				else if (0 == strcmp(optarg, "pageout"))
+					opts.recold = RECOLD_PAGEOUT;
+				else {
+					print_help_message();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 8:
+				opts.pool_size = atoi(optarg);
+				if (1 > opts.pool_size) {
+					print_help_message();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 9:
+				opts.registration = 1;
+				break;
+			case 10:
+				opts.backing = 0;
+				for (int b = BACKING_LAZY; b <= BACKING_THREAD; ++b)
+					if (0 == strcmp(optarg, backing_names[b]))
+						opts.backing = b;
+				if (0 == opts.backing) {
+					print_help_message();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 11:
+				cache_pids[0] = atoi(optarg);
+				num_cache_pids = 1;
+				break;
+			case 12:
+				num_cache_pids = parse_cache_pids_list(
+				    optarg, cache_pids, MAX_CACHE_PIDS_SETTINGS);
+				if (0 >= num_cache_pids) {
+					print_help_message();
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 13:
+				set_cache_regions_path(optarg);
+				break;
 			case 'l':
 				opts.local_state = HOT;
 				break;
@@ -320,6 +1173,8 @@ int main(int argc, char* argv[]) {
 
 	fprintf(stderr, "Proc %i on %s\n", rank, processor_name);
 
+	locality = get_peer_locality((rank + 1) % 2);
+
 	PtlInit();
 	eret = init_p4_ctx(&ctx, PTL_NI_NO_MATCHING);
 	if (PTL_OK != eret)
@@ -335,7 +1190,24 @@ int main(int argc, char* argv[]) {
 		goto END;
 	cache_buffer_size = opts.cache_size / sizeof(int);
 
-	page_size = sysconf(_SC_PAGESIZE);
+	switch (opts.page_backing) {
+		case THP_PAGES:
+		case HUGETLB_2M:
+			page_size = 2 * MiB;
+			break;
+		case HUGETLB_1G:
+			page_size = 1024 * MiB;
+			break;
+		default:
+			page_size = sysconf(_SC_PAGESIZE);
+	}
+	region_size =
+	    (opts.msg_size + page_size - 1) / page_size * page_size +
+	    (opts.span ? page_size : 0);
+	if (opts.span && opts.msg_size < 2) {
+		fprintf(stderr, "--span needs a message of at least 2 bytes\n");
+		MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+	}
 
 	page_buffer = malloc(sizeof(void*) * opts.iterations);
 	if (NULL == page_buffer)
@@ -343,10 +1215,30 @@ int main(int argc, char* argv[]) {
 
 	srand(time(0));
 
-	if (ONE_SIDED == opts.pattern)
-		run_one_sided_benchmark();
-	else if (PINGPONG == opts.pattern)
-		run_ping_pong_benchmark();
+	// every node saves its setting before any rank overwrites it
+	if (0 < num_cache_pids) {
+		save_cache_regions();
+		MPI_Barrier(MPI_COMM_WORLD);
+	}
+
+	for (int p = 0; p < num_cache_pids || 0 == p; ++p) {
+		if (0 < num_cache_pids)
+			apply_cache_pids(cache_pids[p]);
+
+		if (opts.registration)
+			run_registration_benchmark();
+		else if (opts.recold &&
+		         (ONE_SIDED == opts.pattern || PINGPONG == opts.pattern))
+			run_pooled_benchmark();
+		else if (ONE_SIDED == opts.pattern)
+			run_one_sided_benchmark();
+		else if (PINGPONG == opts.pattern)
+			run_ping_pong_benchmark();
+		else if (WS_SWEEP == opts.pattern)
+			run_ws_sweep_benchmark();
+		else if (STREAM == opts.pattern)
+			run_stream_benchmark();
+	}
 
 END:
 	free(cache_buffer);
@@ -0,0 +1,523 @@
+#include "common.h"
+#include "util.h"
+#include <getopt.h>
+
+static int rank;
+static int num_ranks;
+static benchmark_opts_t opts;
+static p4_ctx_t ctx;
+static locality_t locality;
+
+/*
+ * Traffic spread over several portal table entries, as a runtime that
+ * dedicates a PT to every communicator or thread would generate. Rank 1
+ * allocates pts PT indices starting at MULTI_PT_INDEX, each with one
+ * persistent entry over the same buffer and its own completion object: an
+ * EQ (-f) or a CT. Rank 0 puts a window of messages round-robin over the
+ * indices. Two numbers are taken per iteration: the message rate until
+ * rank 1 has harvested the completions of the window as they arrived, and
+ * the harvest cost on rank 1, i.e. the time per completion to collect a
+ * window that has already been delivered. The setup cost of a PT is
+ * reported in the summary.
+ */
+#define MULTI_PT_INDEX 128
+#define MAX_PTS 128
+
+typedef struct
+{
+  ptl_index_t index;
+  ptl_handle_eq_t eq_h;
+  ptl_handle_ct_t ct_h;
+  ptl_handle_le_t le_h;
+  ptl_handle_me_t me_h;
+  ptl_size_t seen;
+} pt_ctx_t;
+
+static pt_ctx_t pts[MAX_PTS];
+static ptl_handle_eq_t eqs[MAX_PTS];
+
+static void
+append_entry(pt_ctx_t* const pt, void* const buffer, const ptl_size_t length)
+{
+  ptl_event_t event;
+  int eret = -1;
+
+  // in CT mode the PT has no EQ and the entry only counts
+  const int full = FULL == opts.event_type;
+
+  if(MATCHING == opts.ni_mode)
+  {
+    ptl_me_t me = {.start = buffer,
+                   .length = length,
+                   .options = PTL_ME_OP_PUT | PTL_ME_EVENT_UNLINK_DISABLE |
+                              (full ? 0
+                                    : PTL_ME_EVENT_LINK_DISABLE |
+                                          PTL_ME_EVENT_COMM_DISABLE |
+                                          PTL_ME_EVENT_CT_COMM),
+                   .ct_handle = pt->ct_h,
+                   .uid = PTL_UID_ANY,
+                   .match_id = {.phys = {.nid = PTL_NID_ANY,
+                                         .pid = PTL_PID_ANY}},
+                   .match_bits = 0xDEADBEEF,
+                   .ignore_bits = 0,
+                   .min_free = 0};
+    eret = PtlMEAppend(ctx.ni_h, pt->index, &me, PTL_PRIORITY_LIST, NULL,
+                       &pt->me_h);
+  }
+  else
+  {
+    ptl_le_t le = {.start = buffer,
+                   .length = length,
+                   .options = PTL_LE_OP_PUT | PTL_LE_EVENT_UNLINK_DISABLE |
+                              (full ? 0
+                                    : PTL_LE_EVENT_LINK_DISABLE |
+                                          PTL_LE_EVENT_COMM_DISABLE |
+                                          PTL_LE_EVENT_CT_COMM),
+                   .ct_handle = pt->ct_h,
+                   .uid = PTL_UID_ANY};
+    eret = PtlLEAppend(ctx.ni_h, pt->index, &le, PTL_PRIORITY_LIST, NULL,
+                       &pt->le_h);
+  }
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "append on PT %u failed with %i\n", pt->index, eret);
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+
+  if(full)
+  {
+    PtlEQWait(pt->eq_h, &event);
+    if(PTL_EVENT_LINK != event.type || PTL_NI_OK != event.ni_fail_type)
+    {
+      fprintf(stderr, "Failed to link entry on PT %u\n", pt->index);
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+  }
+}
+
+/*
+ * Allocates num_pts PTs with their completion objects and entries. Returns
+ * the time it took in seconds.
+ */
+static double
+setup_pts(const int num_pts, void* const buffer, const ptl_size_t length)
+{
+  int eret = -1;
+  const double t0 = MPI_Wtime();
+
+  for(int k = 0; k < num_pts; ++k)
+  {
+    pt_ctx_t* const pt = &pts[k];
+    pt->eq_h = PTL_EQ_NONE;
+    pt->ct_h = PTL_CT_NONE;
+    pt->seen = 0;
+
+    if(FULL == opts.event_type)
+      eret = PtlEQAlloc(ctx.ni_h, opts.window_size + 1, &pt->eq_h);
+    else
+      eret = PtlCTAlloc(ctx.ni_h, &pt->ct_h);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "completion object %i failed with %i\n", k, eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+    eqs[k] = pt->eq_h;
+
+    eret = PtlPTAlloc(ctx.ni_h, 0, pt->eq_h, MULTI_PT_INDEX + k, &pt->index);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "PtlPTAlloc of index %i failed with %i\n",
+              MULTI_PT_INDEX + k, eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+    append_entry(pt, buffer, length);
+  }
+  return MPI_Wtime() - t0;
+}
+
+static void
+free_pts(const int num_pts)
+{
+  for(int k = 0; k < num_pts; ++k)
+  {
+    if(MATCHING == opts.ni_mode)
+      p4_me_remove(pts[k].me_h);
+    else
+      p4_le_remove(pts[k].le_h);
+    PtlPTFree(ctx.ni_h, pts[k].index);
+    if(FULL == opts.event_type)
+      PtlEQFree(pts[k].eq_h);
+    else
+      PtlCTFree(pts[k].ct_h);
+  }
+}
+
+/*
+ * Collects count completions from the first num_pts PTs, the way a progress
+ * engine would: PtlEQPoll over all EQs, or a scan over all CTs.
+ */
+static void
+harvest(const int num_pts, const int count)
+{
+  ptl_event_t event;
+  ptl_ct_event_t ct_event;
+  unsigned int which;
+  int eret = -1;
+
+  if(FULL == opts.event_type)
+  {
+    for(int i = 0; i < count; ++i)
+    {
+      eret = PtlEQPoll(eqs, num_pts, PTL_TIME_FOREVER, &event, &which);
+      if(PTL_OK != eret || PTL_EVENT_PUT != event.type ||
+         PTL_NI_OK != event.ni_fail_type)
+      {
+        fprintf(stderr, "PtlEQPoll failed with %i\n", eret);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+      }
+    }
+    return;
+  }
+
+  int done = 0;
+  while(done < count)
+  {
+    for(int k = 0; k < num_pts; ++k)
+    {
+      eret = PtlCTGet(pts[k].ct_h, &ct_event);
+      if(PTL_OK != eret || ct_event.failure > 0)
+      {
+        fprintf(stderr, "PtlCTGet failed\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+      }
+      done += ct_event.success - pts[k].seen;
+      pts[k].seen = ct_event.success;
+    }
+  }
+}
+
+static void
+put_window(ptl_handle_md_t md_h, const int num_pts, ptl_size_t* const acks)
+{
+  ptl_ct_event_t ct_event;
+  ptl_match_bits_t match_bits = opts.ni_mode == MATCHING ? 0xDEADBEEF : 0;
+  int eret = -1;
+
+  for(int w = 0; w < opts.window_size; ++w)
+  {
+    eret = PtlPut(md_h, w * opts.msg_size, opts.msg_size, PTL_ACK_REQ,
+                  ctx.peer_addr, MULTI_PT_INDEX + w % num_pts, match_bits,
+                  w * opts.msg_size, NULL, 0);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "PtlPut failed with %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+  }
+  *acks += opts.window_size;
+  eret = PtlCTWait(ctx.ct_h, *acks, &ct_event);
+  if(PTL_OK != eret || ct_event.failure > 0)
+  {
+    fprintf(stderr, "PtlCTWait failed\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+}
+
+/*
+ * One pass with num_pts PTs. Fills rate (messages/s) and cost (us per
+ * completion) on rank 0 and returns the setup time per PT in us.
+ */
+static double
+run_pts(const int num_pts, double* const rate, double* const cost)
+{
+  const size_t bytes = opts.window_size * opts.msg_size;
+  ptl_handle_md_t md_h;
+  ptl_ct_event_t zero = {.success = 0, .failure = 0};
+  ptl_size_t acks = 0;
+  double setup = 0.0;
+  void* buffer = NULL;
+  int eret = -1;
+
+  if(0 > alloc_buffer_init(&buffer, bytes))
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+
+  if(1 == rank)
+    setup = setup_pts(num_pts, buffer, bytes);
+  else
+  {
+    PtlCTSet(ctx.ct_h, zero);
+    eret = p4_md_alloc_ct(&ctx, &md_h, buffer, bytes);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "PtlMDBind failed with %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+  }
+
+  for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+  {
+    double rate_sample = 0.0;
+    double cost_sample = 0.0;
+
+    // completions harvested while the window arrives, until rank 1 reports
+    MPI_Barrier(MPI_COMM_WORLD);
+    if(0 == rank)
+    {
+      const double t0 = MPI_Wtime();
+      put_window(md_h, num_pts, &acks);
+      MPI_Recv(NULL, 0, MPI_BYTE, 1, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+      rate_sample = opts.window_size / (MPI_Wtime() - t0);
+    }
+    else
+    {
+      harvest(num_pts, opts.window_size);
+      MPI_Send(NULL, 0, MPI_BYTE, 0, 1, MPI_COMM_WORLD);
+    }
+
+    // completions of a window that has already been delivered
+    if(0 == rank)
+      put_window(md_h, num_pts, &acks);
+    MPI_Barrier(MPI_COMM_WORLD);
+    if(1 == rank)
+    {
+      const double t0 = MPI_Wtime();
+      harvest(num_pts, opts.window_size);
+      cost_sample = (MPI_Wtime() - t0) * 1e6 / opts.window_size;
+      MPI_Send(&cost_sample, 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD);
+    }
+    else
+      MPI_Recv(&cost_sample, 1, MPI_DOUBLE, 1, 0, MPI_COMM_WORLD,
+               MPI_STATUS_IGNORE);
+
+    if(0 == rank && i >= opts.warmup)
+    {
+      rate[i - opts.warmup] = rate_sample;
+      cost[i - opts.warmup] = cost_sample;
+    }
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  if(1 == rank)
+    free_pts(num_pts);
+  else
+    p4_md_free(md_h);
+  free(buffer);
+
+  setup = setup * 1e6 / num_pts;
+  MPI_Bcast(&setup, 1, MPI_DOUBLE, 1, MPI_COMM_WORLD);
+  return setup;
+}
+
+int
+run_multipt_benchmark()
+{
+  const char* const completion = FULL == opts.event_type ? "eq" : "ct";
+  double* rate = malloc(opts.iterations * sizeof(double));
+  double* cost = malloc(opts.iterations * sizeof(double));
+  if(NULL == rate || NULL == cost)
+    return -1;
+
+  if(0 == rank)
+  {
+    fprintf(stdout, "func,pts,completion,msg_size,rate,harvest,locality\n");
+    fprintf(stderr, "pts,completion,rate,harvest,setup\n");
+  }
+
+  for(int num_pts = opts.min_pts; num_pts <= opts.max_pts;
+      num_pts *= 2)
+  {
+    const double setup = run_pts(num_pts, rate, cost);
+    if(0 != rank)
+      continue;
+
+    for(int i = 0; i < opts.iterations; ++i)
+      fprintf(stdout, "put,%i,%s,%lu,%.4f,%.4f,%s\n", num_pts, completion,
+              opts.msg_size, rate[i], cost[i],
+              INTRA_NODE == locality ? "intra" : "inter");
+    fflush(stdout);
+    fprintf(stderr, "%i,%s,%.4f,%.4f,%.4f\n", num_pts, completion,
+            median(rate, opts.iterations), median(cost, opts.iterations),
+            setup);
+  }
+  if(0 == rank)
+    fflush(stderr);
+
+  free(rate);
+  free(cost);
+  return 0;
+}
+
+void
+print_help_message()
+{
+  fprintf(stdout, "Usage: [options]\n");
+  fprintf(stdout, "Options:\n");
+  fprintf(stdout, "  -m, --matching                 Enable matching mode (no "
+                  "argument required)\n");
+  fprintf(stdout, "  -f, --full                     Give every PT an EQ "
+                  "instead of a CT (no argument required)\n");
+  fprintf(stdout,
+          "  -i, --iterations <value>       Specify the number of iterations "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  -x, --warmup <value>           Specify the number of warmup "
+          "iterations (required argument)\n");
+  fprintf(stdout, "  --msg_size <value>             Specify the message size "
+                  "(required argument)\n");
+  fprintf(stdout, "  -w, --window_size <value>      Specify the window size "
+                  "(required argument)\n");
+  fprintf(stdout, "  -p, --pts <value>              Run with this number of "
+                  "PTs only\n");
+  fprintf(stdout, "  --min_pts <value>              Smallest number of PTs "
+                  "(default 1)\n");
+  fprintf(stdout,
+          "  --max_pts <value>              Largest number of PTs, doubled "
+          "from min_pts (default 64, at most 128)\n");
+  fprintf(stdout,
+          "  -h, --help                     Display this help message (no "
+          "argument required)\n");
+  fflush(stdout);
+}
+
+void
+print_benchmark_opts()
+{
+  fprintf(stderr, "Benchmark Configuration:\n\n");
+  fprintf(stderr, "ni_mode: %s\n",
+          opts.ni_mode == MATCHING ? "MATCHING" : "NON MATCHING");
+  fprintf(stderr, "completion: %s\n",
+          FULL == opts.event_type ? "EQ per PT" : "CT per PT");
+  fprintf(stderr, "locality: %s\n",
+          INTRA_NODE == locality ? "INTRA_NODE" : "INTER_NODE");
+  fprintf(stderr, "iterations: %i\n", opts.iterations);
+  fprintf(stderr, "warmup: %i\n", opts.warmup);
+  fprintf(stderr, "window_size: %i\n", opts.window_size);
+  fprintf(stderr, "msg_size: %lu\n", opts.msg_size);
+  fprintf(stderr, "min_pts: %i\n", opts.min_pts);
+  fprintf(stderr, "max_pts: %i\n\n", opts.max_pts);
+  fflush(stderr);
+}
+
+int
+main(int argc, char* argv[])
+{
+  int eret = -1;
+
+  static const struct option long_opts[] = {
+      {"matching", no_argument, NULL, 'm'},
+      {"full", no_argument, NULL, 'f'},
+      {"iterations", required_argument, NULL, 'i'},
+      {"warmup", required_argument, NULL, 'x'},
+      {"msg_size", required_argument, NULL, 1},
+      {"window_size", required_argument, NULL, 'w'},
+      {"pts", required_argument, NULL, 'p'},
+      {"min_pts", required_argument, NULL, 2},
+      {"max_pts", required_argument, NULL, 3},
+      {"help", no_argument, NULL, 'h'}};
+
+  const char* const short_opts = "mfi:x:w:p:h";
+
+  opts.ni_mode = NON_MATCHING;
+  opts.event_type = COUNTING;
+  opts.iterations = 10;
+  opts.warmup = 10;
+  opts.window_size = 256;
+  opts.msg_size = 8;
+  opts.min_pts = 1;
+  opts.max_pts = 64;
+
+  while(1)
+  {
+    const int opt = getopt_long(argc, argv, short_opts, long_opts, NULL);
+
+    if(-1 == opt)
+      break;
+
+    switch(opt)
+    {
+    case 'm':
+      opts.ni_mode = MATCHING;
+      break;
+    case 'f':
+      opts.event_type = FULL;
+      break;
+    case 'i':
+      opts.iterations = atoi(optarg);
+      break;
+    case 'x':
+      opts.warmup = atoi(optarg);
+      break;
+    case 1:
+      opts.msg_size = atol(optarg);
+      break;
+    case 'w':
+      opts.window_size = atoi(optarg);
+      break;
+    case 'p':
+      opts.min_pts = atoi(optarg);
+      opts.max_pts = opts.min_pts;
+      break;
+    case 2:
+      opts.min_pts = atoi(optarg);
+      break;
+    case 3:
+      opts.max_pts = atoi(optarg);
+      break;
+    case 'h':
+      print_help_message();
+      exit(EXIT_SUCCESS);
+    case '?':
+      print_help_message();
+      exit(EXIT_FAILURE);
+    default:
+      print_help_message();
+      exit(EXIT_FAILURE);
+    }
+  } // end while
+
+  if(1 > opts.min_pts || opts.min_pts > opts.max_pts ||
+     MAX_PTS < opts.max_pts || 1 > opts.window_size)
+  {
+    print_help_message();
+    exit(EXIT_FAILURE);
+  }
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+  if(2 != num_ranks)
+  {
+    fprintf(stdout, "Benchmark requires exactly two processes\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  locality = get_peer_locality((rank + 1) % 2);
+
+  if(0 == rank)
+    print_benchmark_opts();
+
+  PtlInit();
+
+  eret = init_p4_ctx(&ctx, opts.ni_mode);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "init failed with %i\n", eret);
+    goto END;
+  }
+
+  eret = exchange_ni_address(&ctx, rank);
+  if(0 > eret)
+  {
+    fprintf(stderr, " exchange failed\n");
+    goto END;
+  }
+
+  eret = run_multipt_benchmark();
+
+END:
+  destroy_p4_ctx(&ctx);
+  PtlFini();
+  MPI_Finalize();
+  return eret;
+}
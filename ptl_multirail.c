@@ -0,0 +1,492 @@
+#include "common.h"
+#include "util.h"
+#include <getopt.h>
+
+static int rank;
+static int num_ranks;
+static benchmark_opts_t opts;
+static locality_t locality;
+
+/*
+ * Striping over several NIs. Every rank opens num_nis stripes, each on its
+ * own interface from --ifaces or all on the default interface, and exposes
+ * the same buffers through every one of them. Stripes on the same interface
+ * get the same NI back from PtlNIInit; each stripe still has its own PT
+ * index, EQ, CT and MD on it, so there nis counts stripes, not NIs. A
+ * message is cut into chunk_size pieces that are put through the stripes
+ * picked by the schedule: round-robin, or the stripe with the fewest bytes
+ * still unacknowledged (its CT counts acked bytes). The bandwidth is measured
+ * with the first 1 .. num_nis stripes.
+ */
+#define MULTIRAIL_INDEX 38
+#define MAX_NIS 16
+
+static p4_ctx_t ctx[MAX_NIS];
+static ptl_interface_t ifaces[MAX_NIS];
+static ptl_index_t pt_index[MAX_NIS];
+static ptl_size_t issued[MAX_NIS];
+static int next_ni;
+
+static const char*
+schedule_name(const stripe_schedule_t schedule)
+{
+  switch(schedule)
+  {
+  case STRIPE_ROUND_ROBIN:
+    return "round_robin";
+  case STRIPE_LEAST_LOADED:
+    return "least_loaded";
+  }
+  return "unknown";
+}
+
+static int
+parse_iface_list(const char* const list)
+{
+  const char* s = list;
+  char* end;
+  int count = 0;
+
+  while('\0' != *s && count < MAX_NIS)
+  {
+    const long value = strtol(s, &end, 10);
+    if(end == s || 0 > value)
+      return -1;
+    ifaces[count++] = value;
+    s = ',' == *end ? end + 1 : end;
+  }
+  return '\0' == *s ? count : -1;
+}
+
+static int
+pick_ni(const int nis)
+{
+  ptl_ct_event_t ct_event;
+  ptl_size_t least = 0;
+  int ni = 0;
+
+  if(STRIPE_ROUND_ROBIN == opts.schedule)
+  {
+    ni = next_ni;
+    next_ni = (next_ni + 1) % nis;
+    return ni;
+  }
+
+  for(int k = 0; k < nis; ++k)
+  {
+    int eret = PtlCTGet(ctx[k].ct_h, &ct_event);
+    if(PTL_OK != eret || ct_event.failure > 0)
+    {
+      fprintf(stderr, "PtlCTGet failed\n");
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+    const ptl_size_t outstanding = issued[k] - ct_event.success;
+    if(0 == k || outstanding < least)
+    {
+      least = outstanding;
+      ni = k;
+    }
+  }
+  return ni;
+}
+
+static void
+put_striped(ptl_handle_md_t* const md_h, const ptl_size_t offset,
+            const size_t msg_size, const int nis)
+{
+  ptl_match_bits_t match_bits = opts.ni_mode == MATCHING ? 0xDEADBEEF : 0;
+
+  for(ptl_size_t done = 0; done < msg_size; done += opts.chunk_size)
+  {
+    const ptl_size_t length =
+        msg_size - done < opts.chunk_size ? msg_size - done : opts.chunk_size;
+    const int k = pick_ni(nis);
+
+    int eret = PtlPut(md_h[k], offset + done, length, PTL_ACK_REQ,
+                      ctx[k].peer_addr, pt_index[k], match_bits, offset + done,
+                      NULL, 0);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "PtlPut failed with %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+    issued[k] += length;
+  }
+}
+
+static void
+wait_for_nis(const int nis)
+{
+  ptl_ct_event_t ct_event;
+
+  for(int k = 0; k < nis; ++k)
+  {
+    int eret = PtlCTWait(ctx[k].ct_h, issued[k], &ct_event);
+    if(PTL_OK != eret || ct_event.failure > 0)
+    {
+      fprintf(stderr, "PtlCTWait failed\n");
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+  }
+}
+
+/*
+ * Put bandwidth of window_size messages of msg_size bytes striped over the
+ * first nis NIs. Returns the median bandwidth in MB/s on rank 0.
+ */
+static double
+run_striped(const size_t msg_size, const int nis, double* const bandwidth)
+{
+  const size_t bytes = opts.window_size * msg_size;
+  ptl_handle_md_t md_h[MAX_NIS];
+  ptl_handle_le_t le_h[MAX_NIS];
+  ptl_handle_me_t me_h[MAX_NIS];
+  ptl_ct_event_t zero = {.success = 0, .failure = 0};
+  void* buffer = NULL;
+  int eret = -1;
+
+  if(0 > alloc_buffer_init(&buffer, bytes))
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+
+  for(int k = 0; k < nis; ++k)
+  {
+    if(1 == rank)
+    {
+      if(MATCHING == opts.ni_mode)
+        eret = p4_me_insert_persistent(&ctx[k], &me_h[k], buffer, bytes,
+                                       pt_index[k]);
+      else
+        eret = p4_le_insert(&ctx[k], &le_h[k], buffer, bytes, pt_index[k]);
+    }
+    else
+    {
+      // acknowledged bytes, so that the CT also measures the load of an NI
+      ptl_md_t md = {.start = buffer,
+                     .length = bytes,
+                     .options = PTL_MD_EVENT_CT_ACK | PTL_MD_EVENT_CT_BYTES |
+                                PTL_MD_EVENT_SUCCESS_DISABLE,
+                     .eq_handle = PTL_EQ_NONE,
+                     .ct_handle = ctx[k].ct_h};
+      eret = PtlMDBind(ctx[k].ni_h, &md, &md_h[k]);
+    }
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "NI %i setup failed with %i\n", k, eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  if(0 == rank)
+  {
+    for(int i = 0; i < opts.iterations + opts.warmup; ++i)
+    {
+      for(int k = 0; k < nis; ++k)
+      {
+        issued[k] = 0;
+        PtlCTSet(ctx[k].ct_h, zero);
+      }
+      next_ni = 0;
+
+      const double t0 = MPI_Wtime();
+      for(int w = 0; w < opts.window_size; ++w)
+        put_striped(md_h, w * msg_size, msg_size, nis);
+      wait_for_nis(nis);
+      const double t = MPI_Wtime() - t0;
+
+      if(i >= opts.warmup)
+        bandwidth[i - opts.warmup] = bytes * 1e-6 / t;
+    }
+
+    for(int i = 0; i < opts.iterations; ++i)
+      fprintf(stdout, "put,%i,%lu,%lu,%s,%.4f,%s\n", nis, msg_size,
+              opts.chunk_size, schedule_name(opts.schedule), bandwidth[i],
+              INTRA_NODE == locality ? "intra" : "inter");
+    fflush(stdout);
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  for(int k = 0; k < nis; ++k)
+  {
+    if(0 == rank)
+      PtlMDRelease(md_h[k]);
+    else if(MATCHING == opts.ni_mode)
+      p4_me_remove(me_h[k]);
+    else
+      p4_le_remove(le_h[k]);
+  }
+  free(buffer);
+
+  return 0 == rank ? median(bandwidth, opts.iterations) : 0.0;
+}
+
+int
+run_multirail_benchmark()
+{
+  double single = 0.0;
+  double* bandwidth = malloc(opts.iterations * sizeof(double));
+  if(NULL == bandwidth)
+    return -1;
+
+  if(0 == rank)
+  {
+    fprintf(stdout, "func,nis,msg_size,chunk_size,schedule,bandwidth,"
+                    "locality\n");
+    fprintf(stderr, "nis,msg_size,bandwidth,speedup,efficiency\n");
+  }
+
+  for(size_t msg_size = opts.min_msg_size; msg_size <= opts.max_msg_size;
+      msg_size *= 2)
+  {
+    for(int nis = 1; nis <= opts.num_nis; ++nis)
+    {
+      const double med = run_striped(msg_size, nis, bandwidth);
+      if(1 == nis)
+        single = med;
+      if(0 == rank)
+        fprintf(stderr, "%i,%lu,%.4f,%.3f,%.3f\n", nis, msg_size, med,
+                med / single, med / (nis * single));
+    }
+  }
+  if(0 == rank)
+    fflush(stderr);
+
+  free(bandwidth);
+  return 0;
+}
+
+void
+print_help_message()
+{
+  fprintf(stdout, "Usage: [options]\n");
+  fprintf(stdout, "Options:\n");
+  fprintf(stdout, "  -m, --matching                 Enable matching mode (no "
+                  "argument required)\n");
+  fprintf(stdout,
+          "  -i, --iterations <value>       Specify the number of iterations "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  -x, --warmup <value>           Specify the number of warmup "
+          "iterations (required argument)\n");
+  fprintf(stdout, "  --msg_size <value>             Specify the message size "
+                  "(required argument)\n");
+  fprintf(stdout,
+          "  --min_msg_size <value>         Specify the minimum message size "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  --max_msg_size <value>         Specify the maximum message size "
+          "(required argument)\n");
+  fprintf(stdout, "  -w, --window_size <value>      Specify the window size "
+                  "(required argument)\n");
+  fprintf(stdout,
+          "  -n, --nis <value>              Number of NIs to stripe over "
+          "(default 2)\n");
+  fprintf(stdout,
+          "  --ifaces <list>                Comma separated interface of "
+          "every NI (default: all share the default interface)\n");
+  fprintf(stdout, "  -k, --chunk_size <value>       Stripe chunk size in bytes "
+                  "(default 65536)\n");
+  fprintf(stdout,
+          "  -s, --schedule <value>         Chunk schedule: round_robin, "
+          "least_loaded (default round_robin)\n");
+  fprintf(stdout,
+          "  -h, --help                     Display this help message (no "
+          "argument required)\n");
+  fflush(stdout);
+}
+
+void
+print_benchmark_opts()
+{
+  fprintf(stderr, "Benchmark Configuration:\n\n");
+  fprintf(stderr, "ni_mode: %s\n",
+          opts.ni_mode == MATCHING ? "MATCHING" : "NON MATCHING");
+  fprintf(stderr, "locality: %s\n",
+          INTRA_NODE == locality ? "INTRA_NODE" : "INTER_NODE");
+  fprintf(stderr, "iterations: %i\n", opts.iterations);
+  fprintf(stderr, "warmup: %i\n", opts.warmup);
+  fprintf(stderr, "window_size: %i\n", opts.window_size);
+  fprintf(stderr, "min_msg_size: %lu\n", opts.min_msg_size);
+  fprintf(stderr, "max_msg_size: %lu\n", opts.max_msg_size);
+  fprintf(stderr, "nis: %i\n", opts.num_nis);
+  fprintf(stderr, "ifaces:");
+  for(int k = 0; k < opts.num_nis; ++k)
+  {
+    if(PTL_IFACE_DEFAULT == ifaces[k])
+      fprintf(stderr, " default");
+    else
+      fprintf(stderr, " %u", ifaces[k]);
+  }
+  fprintf(stderr, "\nchunk_size: %lu\n", opts.chunk_size);
+  fprintf(stderr, "schedule: %s\n\n", schedule_name(opts.schedule));
+  fflush(stderr);
+}
+
+int
+main(int argc, char* argv[])
+{
+  int eret = -1;
+  int num_ifaces = 0;
+  int opened = 0;
+
+  static const struct option long_opts[] = {
+      {"matching", no_argument, NULL, 'm'},
+      {"iterations", required_argument, NULL, 'i'},
+      {"warmup", required_argument, NULL, 'x'},
+      {"msg_size", required_argument, NULL, 1},
+      {"min_msg_size", required_argument, NULL, 2},
+      {"max_msg_size", required_argument, NULL, 3},
+      {"window_size", required_argument, NULL, 'w'},
+      {"nis", required_argument, NULL, 'n'},
+      {"ifaces", required_argument, NULL, 4},
+      {"chunk_size", required_argument, NULL, 'k'},
+      {"schedule", required_argument, NULL, 's'},
+      {"help", no_argument, NULL, 'h'}};
+
+  const char* const short_opts = "mi:x:w:n:k:s:h";
+
+  opts.ni_mode = NON_MATCHING;
+  opts.iterations = 10;
+  opts.warmup = 10;
+  opts.window_size = 16;
+  opts.min_msg_size = 65536;
+  opts.max_msg_size = 4194304;
+  opts.num_nis = 2;
+  opts.chunk_size = 65536;
+  opts.schedule = STRIPE_ROUND_ROBIN;
+
+  while(1)
+  {
+    const int opt = getopt_long(argc, argv, short_opts, long_opts, NULL);
+
+    if(-1 == opt)
+      break;
+
+    switch(opt)
+    {
+    case 'm':
+      opts.ni_mode = MATCHING;
+      break;
+    case 'i':
+      opts.iterations = atoi(optarg);
+      break;
+    case 'x':
+      opts.warmup = atoi(optarg);
+      break;
+    case 1:
+      opts.msg_size = atol(optarg);
+      opts.min_msg_size = opts.msg_size;
+      opts.max_msg_size = opts.msg_size;
+      break;
+    case 2:
+      opts.min_msg_size = atol(optarg);
+      break;
+    case 3:
+      opts.max_msg_size = atol(optarg);
+      break;
+    case 'w':
+      opts.window_size = atoi(optarg);
+      break;
+    case 'n':
+      opts.num_nis = atoi(optarg);
+      break;
+    case 4:
+      num_ifaces = parse_iface_list(optarg);
+      if(0 >= num_ifaces)
+      {
+        print_help_message();
+        exit(EXIT_FAILURE);
+      }
+      opts.num_nis = num_ifaces;
+      break;
+    case 'k':
+      opts.chunk_size = atol(optarg);
+      break;
+    case 's':
+      if(0 == strcmp(optarg, "round_robin"))
+        opts.schedule = STRIPE_ROUND_ROBIN;
+      else if(0 == strcmp(optarg, "least_loaded"))
+        opts.schedule = STRIPE_LEAST_LOADED;
+      else
+      {
+        print_help_message();
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'h':
+      print_help_message();
+      exit(EXIT_SUCCESS);
+    case '?':
+      print_help_message();
+      exit(EXIT_FAILURE);
+    default:
+      print_help_message();
+      exit(EXIT_FAILURE);
+    }
+  } // end while
+
+  if(1 > opts.num_nis || MAX_NIS < opts.num_nis || 0 == opts.chunk_size)
+  {
+    print_help_message();
+    exit(EXIT_FAILURE);
+  }
+  // without --ifaces every stripe shares the NI of the default interface
+  for(int k = num_ifaces; k < opts.num_nis; ++k)
+    ifaces[k] = PTL_IFACE_DEFAULT;
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+  if(2 != num_ranks)
+  {
+    fprintf(stdout, "Benchmark requires exactly two processes\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  locality = get_peer_locality((rank + 1) % 2);
+
+  if(0 == rank)
+    print_benchmark_opts();
+
+  PtlInit();
+
+  for(int k = 0; k < opts.num_nis; ++k)
+  {
+    eret = init_p4_ctx_iface(&ctx[k], opts.ni_mode, ifaces[k]);
+    ++opened;
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "init of NI %i failed with %i\n", k, eret);
+      goto END;
+    }
+    eret = exchange_ni_address(&ctx[k], rank);
+    if(0 > eret)
+    {
+      fprintf(stderr, " exchange failed\n");
+      goto END;
+    }
+    eret = PtlPTAlloc(ctx[k].ni_h, 0, ctx[k].eq_h, MULTIRAIL_INDEX + k,
+                      &pt_index[k]);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "pt alloc failed with %i\n", eret);
+      goto END;
+    }
+  }
+
+  eret = run_multirail_benchmark();
+
+  for(int k = 0; k < opts.num_nis; ++k)
+    PtlPTFree(ctx[k].ni_h, pt_index[k]);
+
+END:
+  // one PtlNIFini per PtlNIInit, a shared NI goes away with its last stripe
+  for(int k = opened - 1; k >= 0; --k)
+    destroy_p4_ctx(&ctx[k]);
+  PtlFini();
+  MPI_Finalize();
+  return eret;
+}
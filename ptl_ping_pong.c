@@ -8,7 +8,9 @@
 static int rank;
 static int num_ranks;
 static p4_ctx_t ctx;
+static locality_t locality;
 static benchmark_opts_t opts;
+static timeline_t timeline;
 static char processor_name[MPI_MAX_PROCESSOR_NAME];
 int* cache_buffer;
 size_t cache_buffer_size;
@@ -24,8 +26,8 @@ run_triggered_ping_pong_benchmark()
   void* buffer = NULL;
 
   double t0;
-  double* rtt = malloc(opts.iterations * opts.warmup * sizeof(double));
-  double* setup = malloc(opts.iterations * opts.warmup * sizeof(double));
+  double* rtt = malloc((opts.iterations + opts.warmup) * sizeof(double));
+  double* setup = malloc((opts.iterations + opts.warmup) * sizeof(double));
 
   eret = p4_pt_alloc(&ctx, &index);
   if(PTL_OK != eret)
@@ -35,7 +37,7 @@ run_triggered_ping_pong_benchmark()
 
   if(0 == rank)
   {
-    fprintf(stdout, "n,func,msg_size,rtt,setup_time\n");
+    fprintf(stdout, "n,func,msg_size,rtt,setup_time,locality\n");
   }
 
   alloc_buffer_init(&buffer, opts.msg_size);
@@ -84,6 +86,9 @@ run_triggered_ping_pong_benchmark()
       assert(i == event.success);
 
       rtt[i - 1] = (MPI_Wtime() - t0) * 1e6;
+      if(NULL != opts.timeline_path && i > opts.warmup)
+        timeline_record(&timeline, "PtlTriggeredPut", opts.msg_size,
+                        rtt[i - 1] * 1e-6);
     }
   }
 
@@ -100,8 +105,9 @@ run_triggered_ping_pong_benchmark()
   {
     for(int i = opts.warmup; i < opts.iterations + opts.warmup; ++i)
     {
-      fprintf(stdout, "%i,PtlTriggeredPut,%lu,%.4f,%.4f\n", i - opts.warmup,
-              opts.msg_size, rtt[i], setup[i]);
+      fprintf(stdout, "%i,PtlTriggeredPut,%lu,%.4f,%.4f,%s\n",
+              i - opts.warmup, opts.msg_size, rtt[i], setup[i],
+              INTRA_NODE == locality ? "intra" : "inter");
     }
   }
 
@@ -125,7 +131,7 @@ run_ping_pong_benchmark()
   void* buffer = NULL;
 
   double t0;
-  double* time = malloc(opts.iterations * opts.warmup * sizeof(double));
+  double* time = malloc((opts.iterations + opts.warmup) * sizeof(double));
 
   eret = p4_pt_alloc(&ctx, &index);
   if(PTL_OK != eret)
@@ -135,7 +141,7 @@ run_ping_pong_benchmark()
 
   if(0 == rank)
   {
-    fprintf(stdout, "n,func,msg_size,rtt\n");
+    fprintf(stdout, "n,func,msg_size,rtt,locality\n");
   }
 
   alloc_buffer_init(&buffer, opts.msg_size);
@@ -168,6 +174,8 @@ run_ping_pong_benchmark()
       assert(i == event.success);
 
       time[i - 1] = (MPI_Wtime() - t0) * 1e6;
+      if(NULL != opts.timeline_path && i > opts.warmup)
+        timeline_record(&timeline, "PtlPut", opts.msg_size, time[i - 1] * 1e-6);
     }
     else
     {
@@ -196,8 +204,9 @@ run_ping_pong_benchmark()
   {
     for(int i = opts.warmup; i < opts.iterations + opts.warmup; ++i)
     {
-      fprintf(stdout, "%i,PtlPut,%lu,%.4f\n", i - opts.warmup, opts.msg_size,
-              time[i]);
+      fprintf(stdout, "%i,PtlPut,%lu,%.4f,%s\n", i - opts.warmup,
+              opts.msg_size, time[i],
+              INTRA_NODE == locality ? "intra" : "inter");
     }
   }
   MPI_Barrier(MPI_COMM_WORLD);
@@ -219,6 +228,15 @@ print_help_message()
          "(required argument).\n");
   printf("  -m, --msg_size <arg>      Specify the message size in bytes "
          "(required argument).\n");
+  printf("  -t, --triggered           Use PtlTriggeredPut on the responder.\n");
+  printf("  --timeline <file>         Record every round trip with the context "
+         "switches and interrupts of its interval and write them to <file>.\n");
+  printf("  --timeline_interval <arg> Round trips per interval (default "
+         "100).\n");
+  printf("  -p, --pids <arg>          Write the v2p cache pids setting before "
+         "the run.\n");
+  printf("  --pids_path <file>        Cache pids sysfs file (default "
+         "$PTLBENCH_V2P_CACHE_PIDS or the build default).\n");
   printf("  -h, --help                Display this help message and exit.\n");
 }
 
@@ -226,20 +244,27 @@ int
 main(int argc, char* argv[])
 {
   int eret = -1;
+  int cache_pids = -1;
   ptl_ct_event_t zct = {.failure = 0, .success = 0};
   static const struct option long_opts[] = {
       {"iterations", required_argument, NULL, 'i'},
       {"warmup", required_argument, NULL, 'w'},
       {"msg_size", required_argument, NULL, 'm'},
       {"triggered", no_argument, NULL, 't'},
+      {"timeline", required_argument, NULL, 1},
+      {"timeline_interval", required_argument, NULL, 2},
+      {"pids", required_argument, NULL, 'p'},
+      {"pids_path", required_argument, NULL, 3},
       {"help", no_argument, NULL, 'h'}};
 
-  const char* const short_opts = "i:w:m:th";
+  const char* const short_opts = "i:w:m:tp:h";
 
   opts.iterations = 5000;
   opts.msg_size = 512;
   opts.cache_size = _16MiB;
   opts.warmup = 100;
+  opts.timeline_path = NULL;
+  opts.timeline_interval = 100;
   int triggered = 0;
 
   while(1)
@@ -267,6 +292,18 @@ main(int argc, char* argv[])
     case 't':
       triggered = 1;
       break;
+    case 1:
+      opts.timeline_path = optarg;
+      break;
+    case 2:
+      opts.timeline_interval = atoi(optarg);
+      break;
+    case 'p':
+      cache_pids = atoi(optarg);
+      break;
+    case 3:
+      set_cache_regions_path(optarg);
+      break;
     case 'h':
       print_help_message();
       exit(EXIT_SUCCESS);
@@ -291,6 +328,8 @@ main(int argc, char* argv[])
     MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
   }
 
+  locality = get_peer_locality((rank + 1) % 2);
+
   PtlInit();
   eret = init_p4_ctx(&ctx, PTL_NI_NO_MATCHING);
   if(PTL_OK != eret)
@@ -306,7 +345,23 @@ main(int argc, char* argv[])
     goto END;
   cache_buffer_size = opts.cache_size / sizeof(int);
 
-  set_cache_regions(1);
+  // the v2p cache pids setting is only touched on request and restored at exit
+  if(0 <= cache_pids)
+  {
+    save_cache_regions();
+    MPI_Barrier(MPI_COMM_WORLD);
+    set_cache_regions(cache_pids);
+    MPI_Barrier(MPI_COMM_WORLD);
+  }
+
+  if(1 == rank)
+    opts.timeline_path = NULL;
+  if(NULL != opts.timeline_path &&
+     0 > timeline_init(&timeline, opts.iterations, opts.timeline_interval))
+  {
+    fprintf(stderr, "Failed to allocate the timeline\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
 
   if(triggered)
     run_triggered_ping_pong_benchmark();
@@ -314,6 +369,11 @@ main(int argc, char* argv[])
     run_ping_pong_benchmark();
 
 END:
+  if(NULL != opts.timeline_path)
+  {
+    timeline_dump(&timeline, opts.timeline_path);
+    timeline_free(&timeline);
+  }
   free(cache_buffer);
   destroy_p4_ctx(&ctx);
   PtlFini();
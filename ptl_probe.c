@@ -0,0 +1,475 @@
+#include "common.h"
+#include "util.h"
+#include <getopt.h>
+
+static int rank;
+static int num_ranks;
+static benchmark_opts_t opts;
+static p4_ctx_t ctx;
+static locality_t locality;
+
+/*
+ * Probe cost on the unexpected list. Rank 1 puts list_length messages with
+ * tags 0 .. list_length - 1 to rank 0, where only an overflow ME is posted,
+ * so each message leaves an unexpected header in arrival order. Rank 0 then
+ * probes with PtlMESearch for the tag at the head, the middle or the tail of
+ * the list or for a tag that is not there, like MPI_Iprobe (PTL_SEARCH_ONLY)
+ * and MPI_Improbe (PTL_SEARCH_DELETE) would. A probe is timed up to its
+ * event. A hit with PTL_SEARCH_DELETE takes the header off the list, so the
+ * list is emptied and filled again before the next probe.
+ */
+#define PROBE_INDEX 36
+#define NUM_POSITIONS 4
+
+static const char* const position_names[NUM_POSITIONS] = {"head", "middle",
+                                                          "tail", "miss"};
+
+static void* overflow_buffer;
+static ptl_handle_md_t send_md;
+static ptl_handle_me_t overflow_me;
+static ptl_size_t arrived;
+
+static ptl_match_bits_t
+position_tag(const int position, const int list_length)
+{
+  switch(position)
+  {
+  case 0:
+    return 0;
+  case 1:
+    return list_length / 2;
+  case 2:
+    return list_length - 1;
+  }
+  return list_length;
+}
+
+static void
+wait_for_event(ptl_event_t* const event)
+{
+  int eret = PtlEQWait(ctx.eq_h, event);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "PtlEQWait failed with %i\n", eret);
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+}
+
+/*
+ * One PtlMESearch for the given tag from rank 1. Returns the time until the
+ * search event (a miss or a PTL_SEARCH_ONLY hit) or the overflow event (a
+ * PTL_SEARCH_DELETE hit) has been delivered.
+ */
+static double
+search(const ptl_match_bits_t tag, const ptl_search_op_t op,
+       const int expect_hit)
+{
+  ptl_event_t event;
+  ptl_me_t me = {.start = NULL,
+                 .length = 0,
+                 .options = PTL_ME_OP_PUT | PTL_ME_USE_ONCE,
+                 .ct_handle = PTL_CT_NONE,
+                 .uid = PTL_UID_ANY,
+                 .match_id = ctx.peer_addr,
+                 .match_bits = tag,
+                 .ignore_bits = 0,
+                 .min_free = 0};
+
+  const double t0 = MPI_Wtime();
+  int eret = PtlMESearch(ctx.ni_h, PROBE_INDEX, &me, op, NULL);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "PtlMESearch failed with %i\n", eret);
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+  wait_for_event(&event);
+  const double t1 = MPI_Wtime();
+
+  if(expect_hit != (PTL_NI_OK == event.ni_fail_type) ||
+     (expect_hit && tag != event.match_bits))
+  {
+    fprintf(stderr, "Search for tag %lu returned event %i (%i)\n", tag,
+            event.type, event.ni_fail_type);
+    MPI_Abort(MPI_COMM_WORLD, -1);
+  }
+  return t1 - t0;
+}
+
+/*
+ * Takes the remaining count headers off the list with one wildcard search.
+ */
+static void
+clear_list(const int count)
+{
+  ptl_event_t event;
+  ptl_me_t me = {.start = NULL,
+                 .length = 0,
+                 .options = PTL_ME_OP_PUT,
+                 .ct_handle = PTL_CT_NONE,
+                 .uid = PTL_UID_ANY,
+                 .match_id = {.phys = {.nid = PTL_NID_ANY, .pid = PTL_PID_ANY}},
+                 .match_bits = 0,
+                 .ignore_bits = ~0ULL,
+                 .min_free = 0};
+
+  if(0 == count)
+    return;
+
+  int eret =
+      PtlMESearch(ctx.ni_h, PROBE_INDEX, &me, PTL_SEARCH_DELETE, NULL);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "PtlMESearch failed with %i\n", eret);
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+  for(int i = 0; i < count; ++i)
+  {
+    wait_for_event(&event);
+    if(PTL_EVENT_PUT_OVERFLOW != event.type)
+    {
+      fprintf(stderr, "Unexpected event %i\n", event.type);
+      MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+  }
+}
+
+/*
+ * Called by both ranks: rank 1 puts list_length tagged messages, rank 0
+ * waits until all of them are on the unexpected list.
+ */
+static void
+fill_list(const int list_length)
+{
+  ptl_ct_event_t ct_event;
+
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  if(1 == rank)
+  {
+    for(int i = 0; i < list_length; ++i)
+    {
+      int eret = PtlPut(send_md, 0, opts.msg_size, PTL_NO_ACK_REQ,
+                        ctx.peer_addr, PROBE_INDEX, i, 0, NULL, 0);
+      if(PTL_OK != eret)
+      {
+        fprintf(stderr, "PtlPut failed with %i\n", eret);
+        MPI_Abort(MPI_COMM_WORLD, eret);
+      }
+    }
+    return;
+  }
+
+  arrived += list_length;
+  int eret = PtlCTWait(ctx.ct_h, arrived, &ct_event);
+  if(PTL_OK != eret || ct_event.failure > 0)
+  {
+    fprintf(stderr, "PtlCTWait failed\n");
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+}
+
+static double
+report(const char* const func, const int list_length, const int position,
+       double* const time)
+{
+  for(int i = 0; i < opts.iterations; ++i)
+    fprintf(stdout, "%s,%i,%s,%.4f,%s\n", func, list_length,
+            position_names[position], time[i] * 1e6,
+            INTRA_NODE == locality ? "intra" : "inter");
+  fflush(stdout);
+  return median(time, opts.iterations);
+}
+
+/*
+ * Probes a list of list_length headers at every position, first without
+ * and then with taking the header off the list. Fills med with the median
+ * latencies of rank 0.
+ */
+static void
+run_probe(const int list_length, double* const time, double* const med)
+{
+  const int iterations = opts.iterations + opts.warmup;
+
+  fill_list(list_length);
+
+  if(0 == rank)
+  {
+    for(int p = 0; p < NUM_POSITIONS; ++p)
+    {
+      const ptl_match_bits_t tag = position_tag(p, list_length);
+      for(int i = 0; i < iterations; ++i)
+      {
+        const double t = search(tag, PTL_SEARCH_ONLY, NUM_POSITIONS - 1 > p);
+        if(i >= opts.warmup)
+          time[i - opts.warmup] = t;
+      }
+      med[p] = report("search_only", list_length, p, time);
+    }
+  }
+
+  for(int p = 0; p < NUM_POSITIONS; ++p)
+  {
+    const ptl_match_bits_t tag = position_tag(p, list_length);
+    const int hit = NUM_POSITIONS - 1 > p;
+    for(int i = 0; i < iterations; ++i)
+    {
+      if(0 == rank)
+      {
+        const double t = search(tag, PTL_SEARCH_DELETE, hit);
+        if(i >= opts.warmup)
+          time[i - opts.warmup] = t;
+      }
+      // a miss leaves the list as it was
+      if(hit)
+      {
+        if(0 == rank)
+          clear_list(list_length - 1);
+        fill_list(list_length);
+      }
+    }
+    if(0 == rank)
+      med[NUM_POSITIONS + p] =
+          report("search_delete", list_length, p, time);
+  }
+
+  if(0 == rank)
+    clear_list(list_length);
+  MPI_Barrier(MPI_COMM_WORLD);
+}
+
+int
+run_probe_benchmark()
+{
+  double med[2 * NUM_POSITIONS];
+  double* time = malloc(opts.iterations * sizeof(double));
+  if(NULL == time)
+    return -1;
+
+  if(0 == rank)
+  {
+    fprintf(stdout, "func,list_length,position,latency,locality\n");
+    fprintf(stderr, "list_length,only_head,only_middle,only_tail,only_miss,"
+                    "delete_head,delete_middle,delete_tail,delete_miss\n");
+  }
+
+  for(int list_length = opts.min_list_length;
+      list_length <= opts.max_list_length; list_length *= 2)
+  {
+    run_probe(list_length, time, med);
+    if(0 == rank)
+    {
+      fprintf(stderr, "%i", list_length);
+      for(int p = 0; p < 2 * NUM_POSITIONS; ++p)
+        fprintf(stderr, ",%.4f", med[p] * 1e6);
+      fprintf(stderr, "\n");
+    }
+  }
+  if(0 == rank)
+    fflush(stderr);
+
+  free(time);
+  return 0;
+}
+
+static int
+setup_probe()
+{
+  ptl_index_t index;
+  int eret = -1;
+
+  if(0 > alloc_buffer_init(&overflow_buffer, opts.msg_size))
+    return -1;
+
+  // overflow arrivals are only counted, the EQ carries the search events
+  eret = PtlPTAlloc(ctx.ni_h, 0, ctx.eq_h, PROBE_INDEX, &index);
+  if(PTL_OK != eret)
+    return eret;
+
+  eret = p4_md_alloc_ct(&ctx, &send_md, overflow_buffer, opts.msg_size);
+  if(PTL_OK != eret)
+    return eret;
+
+  ptl_me_t me = {.start = overflow_buffer,
+                 .length = opts.msg_size,
+                 .options = PTL_ME_OP_PUT | PTL_ME_EVENT_LINK_DISABLE |
+                            PTL_ME_EVENT_COMM_DISABLE |
+                            PTL_ME_EVENT_CT_COMM,
+                 .ct_handle = ctx.ct_h,
+                 .uid = PTL_UID_ANY,
+                 .match_id = {.phys = {.nid = PTL_NID_ANY, .pid = PTL_PID_ANY}},
+                 .match_bits = 0,
+                 .ignore_bits = ~0ULL,
+                 .min_free = 0};
+
+  return PtlMEAppend(ctx.ni_h, PROBE_INDEX, &me, PTL_OVERFLOW_LIST, NULL,
+                     &overflow_me);
+}
+
+static void
+free_probe()
+{
+  PtlMEUnlink(overflow_me);
+  p4_md_free(send_md);
+  PtlPTFree(ctx.ni_h, PROBE_INDEX);
+  free(overflow_buffer);
+}
+
+void
+print_help_message()
+{
+  fprintf(stdout, "Usage: [options]\n");
+  fprintf(stdout, "Options:\n");
+  fprintf(stdout,
+          "  -i, --iterations <value>       Specify the number of iterations "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  -x, --warmup <value>           Specify the number of warmup "
+          "iterations (required argument)\n");
+  fprintf(stdout, "  --msg_size <value>             Specify the message size "
+                  "(required argument)\n");
+  fprintf(stdout,
+          "  --list_length <value>          Number of unexpected messages "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  --min_list_length <value>      Smallest number of unexpected "
+          "messages (default 1)\n");
+  fprintf(stdout,
+          "  --max_list_length <value>      Largest number of unexpected "
+          "messages (default 1024)\n");
+  fprintf(stdout,
+          "  -h, --help                     Display this help message (no "
+          "argument required)\n");
+  fflush(stdout);
+}
+
+void
+print_benchmark_opts()
+{
+  fprintf(stderr, "Benchmark Configuration:\n\n");
+  fprintf(stderr, "locality: %s\n",
+          INTRA_NODE == locality ? "INTRA_NODE" : "INTER_NODE");
+  fprintf(stderr, "iterations: %i\n", opts.iterations);
+  fprintf(stderr, "warmup: %i\n", opts.warmup);
+  fprintf(stderr, "msg_size: %lu\n", opts.msg_size);
+  fprintf(stderr, "min_list_length: %i\n", opts.min_list_length);
+  fprintf(stderr, "max_list_length: %i\n\n", opts.max_list_length);
+  fflush(stderr);
+}
+
+int
+main(int argc, char* argv[])
+{
+  int eret = -1;
+
+  static const struct option long_opts[] = {
+      {"iterations", required_argument, NULL, 'i'},
+      {"warmup", required_argument, NULL, 'x'},
+      {"msg_size", required_argument, NULL, 1},
+      {"min_list_length", required_argument, NULL, 2},
+      {"max_list_length", required_argument, NULL, 3},
+      {"list_length", required_argument, NULL, 4},
+      {"help", no_argument, NULL, 'h'}};
+
+  const char* const short_opts = "i:x:h";
+
+  opts.ni_mode = MATCHING;
+  opts.iterations = 100;
+  opts.warmup = 10;
+  opts.msg_size = 8;
+  opts.min_list_length = 1;
+  opts.max_list_length = 1024;
+
+  while(1)
+  {
+    const int opt = getopt_long(argc, argv, short_opts, long_opts, NULL);
+
+    if(-1 == opt)
+      break;
+
+    switch(opt)
+    {
+    case 'i':
+      opts.iterations = atoi(optarg);
+      break;
+    case 'x':
+      opts.warmup = atoi(optarg);
+      break;
+    case 1:
+      opts.msg_size = atol(optarg);
+      break;
+    case 2:
+      opts.min_list_length = atoi(optarg);
+      break;
+    case 3:
+      opts.max_list_length = atoi(optarg);
+      break;
+    case 4:
+      opts.min_list_length = atoi(optarg);
+      opts.max_list_length = opts.min_list_length;
+      break;
+    case 'h':
+      print_help_message();
+      exit(EXIT_SUCCESS);
+    case '?':
+      print_help_message();
+      exit(EXIT_FAILURE);
+    default:
+      print_help_message();
+      exit(EXIT_FAILURE);
+    }
+  } // end while
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+  if(2 != num_ranks)
+  {
+    fprintf(stdout, "Benchmark requires exactly two processes\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  // emptying the list raises one event per header, they must fit the EQ
+  if(1 > opts.min_list_length || 4096 <= opts.max_list_length)
+  {
+    fprintf(stdout, "list_length must be in [1, 4095]\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  locality = get_peer_locality((rank + 1) % 2);
+
+  if(0 == rank)
+    print_benchmark_opts();
+
+  PtlInit();
+
+  eret = init_p4_ctx(&ctx, opts.ni_mode);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "init failed with %i\n", eret);
+    goto END;
+  }
+
+  eret = exchange_ni_address(&ctx, rank);
+  if(0 > eret)
+  {
+    fprintf(stderr, " exchange failed\n");
+    goto END;
+  }
+
+  eret = setup_probe();
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "probe setup failed with %i\n", eret);
+    goto END;
+  }
+
+  eret = run_probe_benchmark();
+  free_probe();
+
+END:
+  destroy_p4_ctx(&ctx);
+  PtlFini();
+  MPI_Finalize();
+  return eret;
+}
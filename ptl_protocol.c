@@ -0,0 +1,591 @@
+#include "common.h"
+#include "util.h"
+#include <getopt.h>
+
+static int rank;
+static int num_ranks;
+static benchmark_opts_t opts;
+static p4_ctx_t ctx;
+static locality_t locality;
+
+/*
+ * Emulation of an MPI point-to-point layer on a matching NI. Receives are
+ * use-once MEs on DATA_INDEX matching the tag, two overflow slabs catch
+ * messages that arrive before their receive is posted. Eager messages carry
+ * the payload, a rendezvous sends a zero-byte RTS (RTS_BIT set, length in
+ * hdr_data), the receiver gets the payload from the ME the sender exposed on
+ * RNDV_INDEX and releases the sender with a FIN on FIN_INDEX.
+ */
+#define DATA_INDEX 30
+#define RNDV_INDEX 31
+#define FIN_INDEX 32
+#define RAW_INDEX 33
+
+#define RTS_BIT (1ULL << 63)
+#define OVERFLOW_SLAB_SIZE (64 * MiB)
+
+static void* send_buffer;
+static void* recv_buffer;
+static void* overflow_slab[2];
+static size_t overflow_size;
+static ptl_handle_md_t send_md;
+static ptl_handle_md_t recv_md;
+static ptl_handle_me_t overflow_me[2];
+static int overflow_linked[2];
+static ptl_handle_me_t fin_me;
+static ptl_handle_me_t raw_me;
+static ptl_handle_ct_t raw_ct;
+static ptl_size_t fin_count;
+static ptl_size_t raw_count;
+static ptl_match_bits_t next_tag;
+
+static const char*
+protocol_name(const protocol_t protocol)
+{
+  switch(protocol)
+  {
+  case RAW_PUT:
+    return "raw_put";
+  case EAGER:
+    return "eager";
+  case RENDEZVOUS:
+    return "rendezvous";
+  case AUTO_PROTOCOL:
+    return "protocol";
+  }
+  return "unknown";
+}
+
+static void
+me_append(const ptl_index_t index, void* const start, const ptl_size_t length,
+          const unsigned int options, const ptl_match_bits_t match_bits,
+          const ptl_match_bits_t ignore_bits, const ptl_handle_ct_t ct_h,
+          const ptl_list_t list, ptl_handle_me_t* const me_h)
+{
+  ptl_me_t me = {.start = start,
+                 .length = length,
+                 .options = options | PTL_ME_EVENT_LINK_DISABLE,
+                 .ct_handle = ct_h,
+                 .uid = PTL_UID_ANY,
+                 .match_id = {.phys = {.nid = PTL_NID_ANY, .pid = PTL_PID_ANY}},
+                 .match_bits = match_bits,
+                 .ignore_bits = ignore_bits,
+                 .min_free = 0};
+
+  if(PTL_ME_MANAGE_LOCAL & options)
+    me.min_free = opts.max_msg_size;
+
+  int eret = PtlMEAppend(ctx.ni_h, index, &me, list, NULL, me_h);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "PtlMEAppend failed with %i\n", eret);
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+}
+
+/*
+ * The user pointer of a slab ME points at its overflow_slab slot, so that
+ * the unlink and free events tell which slab they are about.
+ */
+static void
+append_overflow_slab(const int slab)
+{
+  ptl_me_t me = {.start = overflow_slab[slab],
+                 .length = overflow_size,
+                 .options = PTL_ME_OP_PUT | PTL_ME_MANAGE_LOCAL |
+                            PTL_ME_EVENT_LINK_DISABLE,
+                 .ct_handle = PTL_CT_NONE,
+                 .uid = PTL_UID_ANY,
+                 .match_id = {.phys = {.nid = PTL_NID_ANY, .pid = PTL_PID_ANY}},
+                 .match_bits = 0,
+                 .ignore_bits = ~0ULL,
+                 .min_free = opts.max_msg_size};
+
+  int eret = PtlMEAppend(ctx.ni_h, DATA_INDEX, &me, PTL_OVERFLOW_LIST,
+                         &overflow_slab[slab], &overflow_me[slab]);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "PtlMEAppend failed with %i\n", eret);
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+  overflow_linked[slab] = 1;
+}
+
+/*
+ * Waits for the next event of the given type. A full overflow slab unlinks
+ * itself while the other one takes over; its memory may only be reused, and
+ * the slab appended again, once PTL_EVENT_AUTO_FREE reports that no
+ * unexpected header points into it any more.
+ */
+static void
+wait_for_event(const ptl_event_kind_t type, ptl_event_t* const event)
+{
+  while(1)
+  {
+    int eret = PtlEQWait(ctx.eq_h, event);
+    if(PTL_OK != eret || PTL_NI_OK != event->ni_fail_type)
+    {
+      fprintf(stderr, "PtlEQWait failed\n");
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+    if(PTL_EVENT_AUTO_UNLINK == event->type)
+    {
+      overflow_linked[(void**)event->user_ptr - overflow_slab] = 0;
+      continue;
+    }
+    if(PTL_EVENT_AUTO_FREE == event->type)
+    {
+      append_overflow_slab((void**)event->user_ptr - overflow_slab);
+      continue;
+    }
+    if(type == event->type)
+      return;
+    fprintf(stderr, "Unexpected event %i\n", event->type);
+    MPI_Abort(MPI_COMM_WORLD, -1);
+  }
+}
+
+static void
+post_recv(const ptl_match_bits_t tag)
+{
+  ptl_handle_me_t me_h;
+  me_append(DATA_INDEX, recv_buffer, opts.max_msg_size,
+            PTL_ME_OP_PUT | PTL_ME_USE_ONCE | PTL_ME_EVENT_UNLINK_DISABLE, tag,
+            RTS_BIT, PTL_CT_NONE, PTL_PRIORITY_LIST, &me_h);
+}
+
+static void
+put_or_abort(const ptl_size_t length, const ptl_index_t index,
+             const ptl_match_bits_t match_bits, const ptl_hdr_data_t hdr_data)
+{
+  int eret = PtlPut(send_md, 0, length, PTL_NO_ACK_REQ, ctx.peer_addr, index,
+                    match_bits, 0, NULL, hdr_data);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "PtlPut failed with %i\n", eret);
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+}
+
+static void
+send_msg(const ptl_match_bits_t tag, const size_t msg_size,
+         const protocol_t protocol)
+{
+  ptl_handle_me_t me_h;
+  ptl_ct_event_t ct_event;
+
+  if(EAGER == protocol ||
+     (AUTO_PROTOCOL == protocol && msg_size <= opts.eager_limit))
+  {
+    put_or_abort(msg_size, DATA_INDEX, tag, msg_size);
+    return;
+  }
+
+  // expose the payload, announce it and wait until the receiver pulled it
+  me_append(RNDV_INDEX, send_buffer, msg_size,
+            PTL_ME_OP_GET | PTL_ME_USE_ONCE | PTL_ME_EVENT_COMM_DISABLE |
+                PTL_ME_EVENT_UNLINK_DISABLE,
+            tag, 0, PTL_CT_NONE, PTL_PRIORITY_LIST, &me_h);
+  put_or_abort(0, DATA_INDEX, tag | RTS_BIT, msg_size);
+
+  int eret = PtlCTWait(ctx.ct_h, ++fin_count, &ct_event);
+  if(PTL_OK != eret || ct_event.failure > 0)
+  {
+    fprintf(stderr, "PtlCTWait failed\n");
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+}
+
+static void
+recv_msg(const ptl_match_bits_t tag)
+{
+  ptl_event_t event;
+
+  if(opts.unexpected)
+  {
+    // the header lands in the slab first, the late receive then claims it
+    wait_for_event(PTL_EVENT_PUT, &event);
+    post_recv(tag);
+    wait_for_event(PTL_EVENT_PUT_OVERFLOW, &event);
+    if(!(event.match_bits & RTS_BIT))
+      memcpy(recv_buffer, event.start, event.mlength);
+  }
+  else
+    wait_for_event(PTL_EVENT_PUT, &event);
+
+  if(event.match_bits & RTS_BIT)
+  {
+    int eret = PtlGet(recv_md, 0, event.hdr_data, ctx.peer_addr, RNDV_INDEX,
+                      tag, 0, NULL);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "PtlGet failed with %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+    wait_for_event(PTL_EVENT_REPLY, &event);
+    put_or_abort(0, FIN_INDEX, 0, 0);
+  }
+}
+
+static void
+raw_round(const size_t msg_size)
+{
+  ptl_ct_event_t ct_event;
+
+  if(0 == rank)
+    put_or_abort(msg_size, RAW_INDEX, 0, 0);
+  int eret = PtlCTWait(raw_ct, ++raw_count, &ct_event);
+  if(PTL_OK != eret || ct_event.failure > 0)
+  {
+    fprintf(stderr, "PtlCTWait failed\n");
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+  if(1 == rank)
+    put_or_abort(msg_size, RAW_INDEX, 0, 0);
+}
+
+/*
+ * Ping-pong with one protocol: rank 0 sends, rank 1 answers with a message of
+ * the same size. Receives are pre-posted before the matching send can leave
+ * unless --unexpected is given. Returns the median half round trip.
+ */
+static double
+run_ping_pong(const size_t msg_size, const protocol_t protocol,
+              double* const time)
+{
+  const int iterations = opts.iterations + opts.warmup;
+  const ptl_match_bits_t first_tag = next_tag;
+  double t0;
+
+  next_tag += iterations;
+
+  if(RAW_PUT != protocol && !opts.unexpected && 1 == rank)
+    post_recv(first_tag);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  for(int i = 0; i < iterations; ++i)
+  {
+    const ptl_match_bits_t tag = first_tag + i;
+
+    if(RAW_PUT != protocol && !opts.unexpected && 0 == rank)
+      post_recv(tag);
+
+    t0 = MPI_Wtime();
+    if(RAW_PUT == protocol)
+      raw_round(msg_size);
+    else if(0 == rank)
+    {
+      send_msg(tag, msg_size, protocol);
+      recv_msg(tag);
+    }
+    else
+    {
+      recv_msg(tag);
+      if(!opts.unexpected && i + 1 < iterations)
+        post_recv(tag + 1);
+      send_msg(tag, msg_size, protocol);
+    }
+    if(i >= opts.warmup)
+      time[i - opts.warmup] = (MPI_Wtime() - t0) / 2;
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  if(0 == rank)
+  {
+    for(int i = 0; i < opts.iterations; ++i)
+      fprintf(stdout, "%s,%lu,%.4f,%s\n", protocol_name(protocol), msg_size,
+              time[i] * 1e6, INTRA_NODE == locality ? "intra" : "inter");
+    fflush(stdout);
+  }
+  return median(time, opts.iterations);
+}
+
+static int
+setup_protocol()
+{
+  ptl_index_t index;
+  int eret = -1;
+
+  overflow_size = OVERFLOW_SLAB_SIZE;
+  if(overflow_size < 4 * opts.max_msg_size)
+    overflow_size = 4 * opts.max_msg_size;
+
+  if(0 > alloc_buffer_init(&send_buffer, opts.max_msg_size) ||
+     0 > alloc_buffer_init(&recv_buffer, opts.max_msg_size) ||
+     0 > alloc_buffer_init(&overflow_slab[0], overflow_size) ||
+     0 > alloc_buffer_init(&overflow_slab[1], overflow_size))
+    return -1;
+
+  // DATA_INDEX raises full events, the other indices only count
+  eret = PtlPTAlloc(ctx.ni_h, 0, ctx.eq_h, DATA_INDEX, &index);
+  if(PTL_OK == eret)
+    eret = PtlPTAlloc(ctx.ni_h, 0, PTL_EQ_NONE, RNDV_INDEX, &index);
+  if(PTL_OK == eret)
+    eret = PtlPTAlloc(ctx.ni_h, 0, PTL_EQ_NONE, FIN_INDEX, &index);
+  if(PTL_OK == eret)
+    eret = PtlPTAlloc(ctx.ni_h, 0, PTL_EQ_NONE, RAW_INDEX, &index);
+  if(PTL_OK == eret)
+    eret = PtlCTAlloc(ctx.ni_h, &raw_ct);
+  if(PTL_OK != eret)
+    return eret;
+
+  ptl_md_t md = {.start = send_buffer,
+                 .length = opts.max_msg_size,
+                 .options = PTL_MD_EVENT_SUCCESS_DISABLE,
+                 .eq_handle = PTL_EQ_NONE,
+                 .ct_handle = PTL_CT_NONE};
+  eret = PtlMDBind(ctx.ni_h, &md, &send_md);
+  if(PTL_OK != eret)
+    return eret;
+
+  md.start = recv_buffer;
+  md.options = 0;
+  md.eq_handle = ctx.eq_h;
+  eret = PtlMDBind(ctx.ni_h, &md, &recv_md);
+  if(PTL_OK != eret)
+    return eret;
+
+  append_overflow_slab(0);
+  append_overflow_slab(1);
+  me_append(FIN_INDEX, NULL, 0,
+            PTL_ME_OP_PUT | PTL_ME_EVENT_CT_COMM | PTL_ME_EVENT_COMM_DISABLE |
+                PTL_ME_EVENT_UNLINK_DISABLE,
+            0, ~0ULL, ctx.ct_h, PTL_PRIORITY_LIST, &fin_me);
+  me_append(RAW_INDEX, recv_buffer, opts.max_msg_size,
+            PTL_ME_OP_PUT | PTL_ME_EVENT_CT_COMM | PTL_ME_EVENT_COMM_DISABLE |
+                PTL_ME_EVENT_UNLINK_DISABLE,
+            0, ~0ULL, raw_ct, PTL_PRIORITY_LIST, &raw_me);
+  return PTL_OK;
+}
+
+static void
+free_protocol()
+{
+  PtlMEUnlink(raw_me);
+  PtlMEUnlink(fin_me);
+  for(int slab = 0; slab < 2; ++slab)
+  {
+    if(overflow_linked[slab])
+      PtlMEUnlink(overflow_me[slab]);
+  }
+  PtlMDRelease(recv_md);
+  PtlMDRelease(send_md);
+  PtlCTFree(raw_ct);
+  PtlPTFree(ctx.ni_h, RAW_INDEX);
+  PtlPTFree(ctx.ni_h, FIN_INDEX);
+  PtlPTFree(ctx.ni_h, RNDV_INDEX);
+  PtlPTFree(ctx.ni_h, DATA_INDEX);
+  free(overflow_slab[0]);
+  free(overflow_slab[1]);
+  free(recv_buffer);
+  free(send_buffer);
+}
+
+int
+run_protocol_benchmark()
+{
+  const protocol_t protocols[] = {RAW_PUT, EAGER, RENDEZVOUS, AUTO_PROTOCOL};
+  double med[4];
+  size_t crossover = 0;
+  double* time = malloc(opts.iterations * sizeof(double));
+  if(NULL == time)
+    return -1;
+
+  if(0 == rank)
+  {
+    fprintf(stdout, "func,msg_size,latency,locality\n");
+    fprintf(stderr, "msg_size,raw_put,eager,rendezvous,protocol,overhead\n");
+  }
+
+  for(size_t msg_size = opts.min_msg_size; msg_size <= opts.max_msg_size;
+      msg_size *= 2)
+  {
+    for(int p = 0; p < 4; ++p)
+      med[p] = run_ping_pong(msg_size, protocols[p], time);
+
+    // the first size at which the rendezvous is not slower than eager
+    if(0 == crossover && med[2] <= med[1])
+      crossover = msg_size;
+    if(0 == rank)
+      fprintf(stderr, "%lu,%.4f,%.4f,%.4f,%.4f,%.4f\n", msg_size,
+              med[0] * 1e6, med[1] * 1e6, med[2] * 1e6, med[3] * 1e6,
+              (med[3] - med[0]) * 1e6);
+  }
+
+  if(0 == rank)
+  {
+    if(0 < crossover)
+      fprintf(stderr, "eager/rendezvous crossover: %lu bytes\n", crossover);
+    else
+      fprintf(stderr, "eager/rendezvous crossover: above %lu bytes\n",
+              opts.max_msg_size);
+    fflush(stderr);
+  }
+  free(time);
+  return 0;
+}
+
+void
+print_help_message()
+{
+  fprintf(stdout, "Usage: [options]\n");
+  fprintf(stdout, "Options:\n");
+  fprintf(stdout,
+          "  -i, --iterations <value>       Specify the number of iterations "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  -x, --warmup <value>           Specify the number of warmup "
+          "iterations (required argument)\n");
+  fprintf(stdout, "  --msg_size <value>             Specify the message size "
+                  "(required argument)\n");
+  fprintf(stdout,
+          "  --min_msg_size <value>         Specify the minimum message size "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  --max_msg_size <value>         Specify the maximum message size "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  -e, --eager_limit <value>      Largest message sent eagerly by "
+          "the protocol rows (default 8192)\n");
+  fprintf(stdout,
+          "  -u, --unexpected               Post every receive only after its "
+          "message arrived in the overflow slab (no argument required)\n");
+  fprintf(stdout,
+          "  -h, --help                     Display this help message (no "
+          "argument required)\n");
+  fflush(stdout);
+}
+
+void
+print_benchmark_opts()
+{
+  fprintf(stderr, "Benchmark Configuration:\n\n");
+  fprintf(stderr, "locality: %s\n",
+          INTRA_NODE == locality ? "INTRA_NODE" : "INTER_NODE");
+  fprintf(stderr, "iterations: %i\n", opts.iterations);
+  fprintf(stderr, "warmup: %i\n", opts.warmup);
+  fprintf(stderr, "min_msg_size: %lu\n", opts.min_msg_size);
+  fprintf(stderr, "max_msg_size: %lu\n", opts.max_msg_size);
+  fprintf(stderr, "eager_limit: %lu\n", opts.eager_limit);
+  fprintf(stderr, "receives: %s\n\n",
+          opts.unexpected ? "UNEXPECTED" : "PRE-POSTED");
+  fflush(stderr);
+}
+
+int
+main(int argc, char* argv[])
+{
+  int eret = -1;
+
+  static const struct option long_opts[] = {
+      {"iterations", required_argument, NULL, 'i'},
+      {"warmup", required_argument, NULL, 'x'},
+      {"msg_size", required_argument, NULL, 1},
+      {"min_msg_size", required_argument, NULL, 2},
+      {"max_msg_size", required_argument, NULL, 3},
+      {"eager_limit", required_argument, NULL, 'e'},
+      {"unexpected", no_argument, NULL, 'u'},
+      {"help", no_argument, NULL, 'h'}};
+
+  const char* const short_opts = "i:x:e:uh";
+
+  opts.ni_mode = MATCHING;
+  opts.iterations = 100;
+  opts.warmup = 10;
+  opts.min_msg_size = 1;
+  opts.max_msg_size = 4194304;
+  opts.eager_limit = 8192;
+
+  while(1)
+  {
+    const int opt = getopt_long(argc, argv, short_opts, long_opts, NULL);
+
+    if(-1 == opt)
+      break;
+
+    switch(opt)
+    {
+    case 'i':
+      opts.iterations = atoi(optarg);
+      break;
+    case 'x':
+      opts.warmup = atoi(optarg);
+      break;
+    case 1:
+      opts.msg_size = atol(optarg);
+      opts.min_msg_size = opts.msg_size;
+      opts.max_msg_size = opts.msg_size;
+      break;
+    case 2:
+      opts.min_msg_size = atol(optarg);
+      break;
+    case 3:
+      opts.max_msg_size = atol(optarg);
+      break;
+    case 'e':
+      opts.eager_limit = atol(optarg);
+      break;
+    case 'u':
+      opts.unexpected = 1;
+      break;
+    case 'h':
+      print_help_message();
+      exit(EXIT_SUCCESS);
+    case '?':
+      print_help_message();
+      exit(EXIT_FAILURE);
+    default:
+      print_help_message();
+      exit(EXIT_FAILURE);
+    }
+  } // end while
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+  if(2 != num_ranks)
+  {
+    fprintf(stdout, "Benchmark requires exactly two processes\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  locality = get_peer_locality((rank + 1) % 2);
+
+  if(0 == rank)
+    print_benchmark_opts();
+
+  PtlInit();
+
+  eret = init_p4_ctx(&ctx, opts.ni_mode);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "init failed with %i\n", eret);
+    goto END;
+  }
+
+  eret = exchange_ni_address(&ctx, rank);
+  if(0 > eret)
+  {
+    fprintf(stderr, " exchange failed\n");
+    goto END;
+  }
+
+  eret = setup_protocol();
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "protocol setup failed with %i\n", eret);
+    goto END;
+  }
+
+  eret = run_protocol_benchmark();
+  free_protocol();
+
+END:
+  destroy_p4_ctx(&ctx);
+  PtlFini();
+  MPI_Finalize();
+  return eret;
+}
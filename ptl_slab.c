@@ -0,0 +1,519 @@
+#include "common.h"
+#include "util.h"
+#include <getopt.h>
+#include <stdint.h>
+
+static int rank;
+static int num_ranks;
+static benchmark_opts_t opts;
+static p4_ctx_t ctx;
+static locality_t locality;
+
+/*
+ * Eager receive buffers two ways. Rank 1 streams windows of small puts to
+ * rank 0, which either posts one use-once ME per message, each as large as
+ * the biggest eager message, or keeps a few large locally managed slabs on
+ * the list that the NI packs the messages into. A slab with less than
+ * eager_limit bytes left unlinks itself (PTL_EVENT_AUTO_UNLINK) and is
+ * appended again right away; a runtime would copy the messages out first.
+ */
+#define SLAB_INDEX 35
+
+typedef struct
+{
+  double rate;
+  double repost;
+  ptl_size_t turnovers;
+  double turnover_cost;
+  double efficiency;
+} recv_stats_t;
+
+static void* send_buffer;
+static void* slot_buffer;
+static void* slabs;
+static ptl_handle_md_t send_md;
+static ptl_handle_me_t* slab_me;
+static ptl_size_t* slab_used;
+static ptl_size_t consumed_bytes;
+static ptl_size_t turnovers;
+static double repost_time;
+
+static void
+append_slab(const int i)
+{
+  int eret =
+      p4_me_insert_slab(&ctx, &slab_me[i], (char*)slabs + i * opts.slab_size,
+                        opts.slab_size, SLAB_INDEX, opts.eager_limit,
+                        (void*)(uintptr_t)i);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "PtlMEAppend failed with %i\n", eret);
+    MPI_Abort(MPI_COMM_WORLD, eret);
+  }
+}
+
+static void
+post_use_once()
+{
+  ptl_handle_me_t me_h;
+  ptl_me_t me = {.length = opts.eager_limit,
+                 .options = PTL_ME_OP_PUT | PTL_ME_USE_ONCE |
+                            PTL_ME_EVENT_LINK_DISABLE |
+                            PTL_ME_EVENT_UNLINK_DISABLE,
+                 .ct_handle = PTL_CT_NONE,
+                 .uid = PTL_UID_ANY,
+                 .match_id = {.phys = {.nid = PTL_NID_ANY, .pid = PTL_PID_ANY}},
+                 .match_bits = 0,
+                 .ignore_bits = ~0ULL,
+                 .min_free = 0};
+
+  for(int i = 0; i < opts.window_size; ++i)
+  {
+    me.start = (char*)slot_buffer + i * opts.eager_limit;
+    int eret =
+        PtlMEAppend(ctx.ni_h, SLAB_INDEX, &me, PTL_PRIORITY_LIST, NULL, &me_h);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "PtlMEAppend failed with %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+  }
+  consumed_bytes += opts.window_size * opts.eager_limit;
+}
+
+/*
+ * Books one event. A put records how far its slab is filled, an auto unlink
+ * retires the slab and appends it again. Returns 1 for a put.
+ */
+static int
+process_event(const ptl_event_t* const event, const int use_slabs)
+{
+  if(PTL_NI_OK != event->ni_fail_type)
+  {
+    fprintf(stderr, "Event %i failed with %i\n", event->type,
+            event->ni_fail_type);
+    MPI_Abort(MPI_COMM_WORLD, -1);
+  }
+  if(PTL_EVENT_PUT == event->type)
+  {
+    if(use_slabs)
+    {
+      const int i = (uintptr_t)event->user_ptr;
+      slab_used[i] = (char*)event->start + event->mlength -
+                     ((char*)slabs + i * opts.slab_size);
+    }
+    return 1;
+  }
+  if(use_slabs && PTL_EVENT_AUTO_UNLINK == event->type)
+  {
+    const int i = (uintptr_t)event->user_ptr;
+    const double t0 = MPI_Wtime();
+    append_slab(i);
+    repost_time += MPI_Wtime() - t0;
+    consumed_bytes += opts.slab_size;
+    slab_used[i] = 0;
+    ++turnovers;
+    return 0;
+  }
+  fprintf(stderr, "Unexpected event %i\n", event->type);
+  MPI_Abort(MPI_COMM_WORLD, -1);
+  return 0;
+}
+
+/*
+ * Waits for a window of puts and picks up slabs that unlinked with the last
+ * put of the window. Returns the time from the first to the last arrival.
+ */
+static double
+receive_window(const int use_slabs)
+{
+  ptl_event_t event;
+  double first = 0.0;
+  double last = 0.0;
+  int received = 0;
+  int eret = -1;
+
+  while(received < opts.window_size)
+  {
+    eret = PtlEQWait(ctx.eq_h, &event);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "PtlEQWait failed with %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+    if(process_event(&event, use_slabs))
+    {
+      last = MPI_Wtime();
+      if(0 == received++)
+        first = last;
+    }
+  }
+  while(PTL_OK == PtlEQGet(ctx.eq_h, &event))
+    process_event(&event, use_slabs);
+  return last - first;
+}
+
+static void
+send_window(const size_t msg_size)
+{
+  for(int i = 0; i < opts.window_size; ++i)
+  {
+    int eret = PtlPut(send_md, 0, msg_size, PTL_NO_ACK_REQ, ctx.peer_addr,
+                      SLAB_INDEX, 0, 0, NULL, 0);
+    if(PTL_OK != eret)
+    {
+      fprintf(stderr, "PtlPut failed with %i\n", eret);
+      MPI_Abort(MPI_COMM_WORLD, eret);
+    }
+  }
+}
+
+/*
+ * Streams iterations + warmup windows of msg_size puts into use-once MEs or
+ * slabs. Every slab run starts from freshly appended, empty slabs. Rows give
+ * the time per message, the message rate and the re-post time per message.
+ */
+static void
+run_receive(const size_t msg_size, const int use_slabs, double* const time,
+            double* const repost, recv_stats_t* const stats)
+{
+  const int iterations = opts.iterations + opts.warmup;
+  const int window = opts.window_size;
+  double total_repost = 0.0;
+
+  consumed_bytes = 0;
+  turnovers = 0;
+  if(0 == rank && use_slabs)
+  {
+    for(int i = 0; i < opts.num_slabs; ++i)
+    {
+      slab_used[i] = 0;
+      append_slab(i);
+    }
+  }
+
+  for(int i = 0; i < iterations; ++i)
+  {
+    repost_time = 0.0;
+    if(0 == rank && !use_slabs)
+    {
+      const double t0 = MPI_Wtime();
+      post_use_once();
+      repost_time = MPI_Wtime() - t0;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    if(1 == rank)
+      send_window(msg_size);
+    else
+    {
+      const double elapsed = receive_window(use_slabs);
+      total_repost += repost_time;
+      if(i >= opts.warmup)
+      {
+        time[i - opts.warmup] = elapsed / (window - 1);
+        repost[i - opts.warmup] = repost_time / window;
+      }
+    }
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  if(0 != rank)
+    return;
+
+  if(use_slabs)
+  {
+    for(int i = 0; i < opts.num_slabs; ++i)
+    {
+      consumed_bytes += slab_used[i];
+      PtlMEUnlink(slab_me[i]);
+    }
+  }
+
+  for(int i = 0; i < opts.iterations; ++i)
+    fprintf(stdout, "%s,%lu,%i,%lu,%.4f,%.1f,%.4f,%s\n",
+            use_slabs ? "slab" : "use_once", msg_size, window,
+            use_slabs ? opts.slab_size : opts.eager_limit, time[i] * 1e6,
+            1.0 / time[i], repost[i] * 1e6,
+            INTRA_NODE == locality ? "intra" : "inter");
+  fflush(stdout);
+
+  stats->turnovers = turnovers;
+  stats->turnover_cost =
+      0 < turnovers ? total_repost / turnovers : 0.0;
+  stats->efficiency =
+      (double)iterations * window * msg_size / (double)consumed_bytes;
+  stats->repost = median(repost, opts.iterations);
+  stats->rate = 1.0 / median(time, opts.iterations);
+}
+
+int
+run_slab_benchmark()
+{
+  recv_stats_t use_once;
+  recv_stats_t slab;
+  double* time = malloc(opts.iterations * sizeof(double));
+  double* repost = malloc(opts.iterations * sizeof(double));
+  if(NULL == time || NULL == repost)
+    return -1;
+
+  if(0 == rank)
+  {
+    fprintf(stdout, "func,msg_size,window_size,buffer_size,latency,rate,"
+                    "repost,locality\n");
+    fprintf(stderr, "msg_size,use_once_rate,slab_rate,use_once_repost,"
+                    "slab_repost,turnovers,turnover_cost,use_once_efficiency,"
+                    "slab_efficiency\n");
+  }
+
+  for(size_t msg_size = opts.min_msg_size; msg_size <= opts.max_msg_size;
+      msg_size *= 2)
+  {
+    run_receive(msg_size, 0, time, repost, &use_once);
+    run_receive(msg_size, 1, time, repost, &slab);
+
+    if(0 == rank)
+      fprintf(stderr, "%lu,%.1f,%.1f,%.4f,%.4f,%lu,%.4f,%.4f,%.4f\n",
+              msg_size, use_once.rate, slab.rate, use_once.repost * 1e6,
+              slab.repost * 1e6, slab.turnovers, slab.turnover_cost * 1e6,
+              use_once.efficiency, slab.efficiency);
+  }
+  if(0 == rank)
+    fflush(stderr);
+
+  free(repost);
+  free(time);
+  return 0;
+}
+
+static int
+setup_slab()
+{
+  ptl_index_t index;
+  int eret = -1;
+
+  if(0 > alloc_buffer_init(&send_buffer, opts.max_msg_size) ||
+     0 > alloc_buffer_init(&slot_buffer,
+                           opts.window_size * opts.eager_limit) ||
+     0 > alloc_buffer_init(&slabs, opts.num_slabs * opts.slab_size))
+    return -1;
+
+  slab_me = malloc(opts.num_slabs * sizeof(ptl_handle_me_t));
+  slab_used = malloc(opts.num_slabs * sizeof(ptl_size_t));
+  if(NULL == slab_me || NULL == slab_used)
+    return -1;
+
+  eret = PtlPTAlloc(ctx.ni_h, 0, ctx.eq_h, SLAB_INDEX, &index);
+  if(PTL_OK != eret)
+    return eret;
+
+  return p4_md_alloc_ct(&ctx, &send_md, send_buffer, opts.max_msg_size);
+}
+
+static void
+free_slab()
+{
+  p4_md_free(send_md);
+  PtlPTFree(ctx.ni_h, SLAB_INDEX);
+  free(slab_used);
+  free(slab_me);
+  free(slabs);
+  free(slot_buffer);
+  free(send_buffer);
+}
+
+void
+print_help_message()
+{
+  fprintf(stdout, "Usage: [options]\n");
+  fprintf(stdout, "Options:\n");
+  fprintf(stdout,
+          "  -i, --iterations <value>       Specify the number of iterations "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  -x, --warmup <value>           Specify the number of warmup "
+          "iterations (required argument)\n");
+  fprintf(stdout, "  -w, --window_size <value>      Specify the window size "
+                  "(required argument)\n");
+  fprintf(stdout, "  --msg_size <value>             Specify the message size "
+                  "(required argument)\n");
+  fprintf(stdout,
+          "  --min_msg_size <value>         Specify the minimum message size "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  --max_msg_size <value>         Specify the maximum message size "
+          "(required argument)\n");
+  fprintf(stdout,
+          "  -e, --eager_limit <value>      Size of a use-once buffer and "
+          "min_free of a slab (default 8192)\n");
+  fprintf(stdout,
+          "  -b, --slab_size <value>        Size of one locally managed slab "
+          "(default 1048576)\n");
+  fprintf(stdout,
+          "  -n, --slabs <value>            Number of slabs kept on the list "
+          "(default 4)\n");
+  fprintf(stdout,
+          "  -h, --help                     Display this help message (no "
+          "argument required)\n");
+  fflush(stdout);
+}
+
+void
+print_benchmark_opts()
+{
+  fprintf(stderr, "Benchmark Configuration:\n\n");
+  fprintf(stderr, "locality: %s\n",
+          INTRA_NODE == locality ? "INTRA_NODE" : "INTER_NODE");
+  fprintf(stderr, "iterations: %i\n", opts.iterations);
+  fprintf(stderr, "warmup: %i\n", opts.warmup);
+  fprintf(stderr, "window_size: %i\n", opts.window_size);
+  fprintf(stderr, "min_msg_size: %lu\n", opts.min_msg_size);
+  fprintf(stderr, "max_msg_size: %lu\n", opts.max_msg_size);
+  fprintf(stderr, "eager_limit: %lu\n", opts.eager_limit);
+  fprintf(stderr, "slab_size: %lu\n", opts.slab_size);
+  fprintf(stderr, "slabs: %i\n\n", opts.num_slabs);
+  fflush(stderr);
+}
+
+int
+main(int argc, char* argv[])
+{
+  int eret = -1;
+
+  static const struct option long_opts[] = {
+      {"iterations", required_argument, NULL, 'i'},
+      {"warmup", required_argument, NULL, 'x'},
+      {"window_size", required_argument, NULL, 'w'},
+      {"msg_size", required_argument, NULL, 1},
+      {"min_msg_size", required_argument, NULL, 2},
+      {"max_msg_size", required_argument, NULL, 3},
+      {"eager_limit", required_argument, NULL, 'e'},
+      {"slab_size", required_argument, NULL, 'b'},
+      {"slabs", required_argument, NULL, 'n'},
+      {"help", no_argument, NULL, 'h'}};
+
+  const char* const short_opts = "i:x:w:e:b:n:h";
+
+  opts.ni_mode = MATCHING;
+  opts.iterations = 100;
+  opts.warmup = 10;
+  opts.window_size = 256;
+  opts.min_msg_size = 8;
+  opts.max_msg_size = 8192;
+  opts.eager_limit = 8192;
+  opts.slab_size = MiB;
+  opts.num_slabs = 4;
+
+  while(1)
+  {
+    const int opt = getopt_long(argc, argv, short_opts, long_opts, NULL);
+
+    if(-1 == opt)
+      break;
+
+    switch(opt)
+    {
+    case 'i':
+      opts.iterations = atoi(optarg);
+      break;
+    case 'x':
+      opts.warmup = atoi(optarg);
+      break;
+    case 'w':
+      opts.window_size = atoi(optarg);
+      break;
+    case 1:
+      opts.msg_size = atol(optarg);
+      opts.min_msg_size = opts.msg_size;
+      opts.max_msg_size = opts.msg_size;
+      break;
+    case 2:
+      opts.min_msg_size = atol(optarg);
+      break;
+    case 3:
+      opts.max_msg_size = atol(optarg);
+      break;
+    case 'e':
+      opts.eager_limit = atol(optarg);
+      break;
+    case 'b':
+      opts.slab_size = atol(optarg);
+      break;
+    case 'n':
+      opts.num_slabs = atoi(optarg);
+      break;
+    case 'h':
+      print_help_message();
+      exit(EXIT_SUCCESS);
+    case '?':
+      print_help_message();
+      exit(EXIT_FAILURE);
+    default:
+      print_help_message();
+      exit(EXIT_FAILURE);
+    }
+  } // end while
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+  if(2 != num_ranks)
+  {
+    fprintf(stdout, "Benchmark requires exactly two processes\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  // the slabs still on the list must hold a whole window, and a window must
+  // fit the EQ together with the auto unlink events it causes
+  if(opts.max_msg_size > opts.eager_limit || 2 > opts.window_size ||
+     2048 < opts.window_size || 2 > opts.num_slabs ||
+     opts.slab_size <= opts.eager_limit ||
+     opts.window_size * opts.max_msg_size >
+         (opts.num_slabs - 1) * (opts.slab_size - opts.eager_limit))
+  {
+    fprintf(stdout, "Invalid configuration: max_msg_size must not exceed "
+                    "eager_limit, window_size must be in [2, 2048] and the "
+                    "slabs but one must hold a window\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  locality = get_peer_locality((rank + 1) % 2);
+
+  if(0 == rank)
+    print_benchmark_opts();
+
+  PtlInit();
+
+  eret = init_p4_ctx(&ctx, opts.ni_mode);
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "init failed with %i\n", eret);
+    goto END;
+  }
+
+  eret = exchange_ni_address(&ctx, rank);
+  if(0 > eret)
+  {
+    fprintf(stderr, " exchange failed\n");
+    goto END;
+  }
+
+  eret = setup_slab();
+  if(PTL_OK != eret)
+  {
+    fprintf(stderr, "slab setup failed with %i\n", eret);
+    goto END;
+  }
+
+  eret = run_slab_benchmark();
+  free_slab();
+
+END:
+  destroy_p4_ctx(&ctx);
+  PtlFini();
+  MPI_Finalize();
+  return eret;
+}
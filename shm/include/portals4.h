@@ -0,0 +1,335 @@
+#ifndef __PORTALS4_H__
+#define __PORTALS4_H__
+/*
+ * Subset of the Portals4 API (spec 4.x) used by PtlBench, implemented by the
+ * portals_shm stand-in over shared memory between processes on one host.
+ * Only physical addressing is supported and atomics are not implemented.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint64_t ptl_size_t;
+typedef uint32_t ptl_index_t;
+typedef uint64_t ptl_match_bits_t;
+typedef uint64_t ptl_hdr_data_t;
+typedef uint32_t ptl_time_t;
+typedef uint32_t ptl_interface_t;
+typedef uint32_t ptl_nid_t;
+typedef uint32_t ptl_pid_t;
+typedef uint32_t ptl_rank_t;
+typedef uint32_t ptl_uid_t;
+typedef uint32_t ptl_sr_index_t;
+typedef int64_t ptl_sr_value_t;
+
+typedef uint32_t ptl_handle_any_t;
+typedef ptl_handle_any_t ptl_handle_ni_t;
+typedef ptl_handle_any_t ptl_handle_eq_t;
+typedef ptl_handle_any_t ptl_handle_ct_t;
+typedef ptl_handle_any_t ptl_handle_md_t;
+typedef ptl_handle_any_t ptl_handle_le_t;
+typedef ptl_handle_any_t ptl_handle_me_t;
+
+typedef union {
+  struct
+  {
+    ptl_nid_t nid;
+    ptl_pid_t pid;
+  } phys;
+  ptl_rank_t rank;
+} ptl_process_t;
+
+/* return codes */
+enum {
+  PTL_OK = 0,
+  PTL_ARG_INVALID,
+  PTL_CT_NONE_REACHED,
+  PTL_EQ_DROPPED,
+  PTL_EQ_EMPTY,
+  PTL_FAIL,
+  PTL_IGNORED,
+  PTL_IN_USE,
+  PTL_INTERRUPTED,
+  PTL_LIST_TOO_LONG,
+  PTL_NO_INIT,
+  PTL_NO_SPACE,
+  PTL_PID_IN_USE,
+  PTL_PT_FULL,
+  PTL_PT_EQ_NEEDED,
+  PTL_PT_IN_USE,
+  PTL_STATUS_LAST
+};
+
+#define PTL_INVALID_HANDLE ((ptl_handle_any_t)0xFFFFFFFF)
+#define PTL_EQ_NONE ((ptl_handle_eq_t)0x3FFFFFFF)
+#define PTL_CT_NONE ((ptl_handle_ct_t)0x5FFFFFFF)
+
+#define PTL_IFACE_DEFAULT ((ptl_interface_t)0xFFFFFFFF)
+#define PTL_PID_ANY ((ptl_pid_t)0xFFFFFFFF)
+#define PTL_NID_ANY ((ptl_nid_t)0xFFFFFFFF)
+#define PTL_RANK_ANY ((ptl_rank_t)0xFFFFFFFF)
+#define PTL_UID_ANY ((ptl_uid_t)0xFFFFFFFF)
+#define PTL_PT_ANY ((ptl_index_t)0xFFFFFFFF)
+#define PTL_SIZE_MAX ((ptl_size_t)UINT64_MAX)
+#define PTL_TIME_FOREVER ((ptl_time_t)0xFFFFFFFF)
+
+/* PtlNIInit() options */
+#define PTL_NI_MATCHING (1U << 0)
+#define PTL_NI_NO_MATCHING (1U << 1)
+#define PTL_NI_LOGICAL (1U << 2)
+#define PTL_NI_PHYSICAL (1U << 3)
+
+/* ptl_ni_limits_t features */
+#define PTL_TARGET_BIND_INACCESSIBLE (1U << 0)
+#define PTL_TOTAL_DATA_ORDERING (1U << 1)
+#define PTL_COHERENT_ATOMICS (1U << 2)
+
+/* PtlPTAlloc() options */
+#define PTL_PT_ONLY_USE_ONCE (1U << 0)
+#define PTL_PT_ONLY_TRUNCATE (1U << 1)
+#define PTL_PT_FLOWCTRL (1U << 2)
+
+/* ptl_md_t options */
+#define PTL_MD_EVENT_SUCCESS_DISABLE (1U << 0)
+#define PTL_MD_EVENT_SEND_DISABLE (1U << 1)
+#define PTL_MD_EVENT_CT_SEND (1U << 2)
+#define PTL_MD_EVENT_CT_REPLY (1U << 3)
+#define PTL_MD_EVENT_CT_ACK (1U << 4)
+#define PTL_MD_EVENT_CT_BYTES (1U << 5)
+#define PTL_MD_UNORDERED (1U << 6)
+#define PTL_MD_VOLATILE (1U << 7)
+#define PTL_IOVEC (1U << 8)
+
+/* ptl_le_t / ptl_me_t options */
+#define PTL_ME_OP_PUT (1U << 0)
+#define PTL_ME_OP_GET (1U << 1)
+#define PTL_ME_USE_ONCE (1U << 2)
+#define PTL_ME_ACK_DISABLE (1U << 3)
+#define PTL_ME_UNEXPECTED_HDR_DISABLE (1U << 4)
+#define PTL_ME_IS_ACCESSIBLE (1U << 5)
+#define PTL_ME_EVENT_COMM_DISABLE (1U << 6)
+#define PTL_ME_EVENT_FLOWCTRL_DISABLE (1U << 7)
+#define PTL_ME_EVENT_SUCCESS_DISABLE (1U << 8)
+#define PTL_ME_EVENT_OVER_DISABLE (1U << 9)
+#define PTL_ME_EVENT_UNLINK_DISABLE (1U << 10)
+#define PTL_ME_EVENT_LINK_DISABLE (1U << 11)
+#define PTL_ME_EVENT_CT_COMM (1U << 12)
+#define PTL_ME_EVENT_CT_OVERFLOW (1U << 13)
+#define PTL_ME_EVENT_CT_BYTES (1U << 14)
+#define PTL_ME_MANAGE_LOCAL (1U << 15)
+#define PTL_ME_NO_TRUNCATE (1U << 16)
+#define PTL_ME_MAY_ALIGN (1U << 17)
+
+#define PTL_LE_OP_PUT PTL_ME_OP_PUT
+#define PTL_LE_OP_GET PTL_ME_OP_GET
+#define PTL_LE_USE_ONCE PTL_ME_USE_ONCE
+#define PTL_LE_ACK_DISABLE PTL_ME_ACK_DISABLE
+#define PTL_LE_UNEXPECTED_HDR_DISABLE PTL_ME_UNEXPECTED_HDR_DISABLE
+#define PTL_LE_IS_ACCESSIBLE PTL_ME_IS_ACCESSIBLE
+#define PTL_LE_EVENT_COMM_DISABLE PTL_ME_EVENT_COMM_DISABLE
+#define PTL_LE_EVENT_FLOWCTRL_DISABLE PTL_ME_EVENT_FLOWCTRL_DISABLE
+#define PTL_LE_EVENT_SUCCESS_DISABLE PTL_ME_EVENT_SUCCESS_DISABLE
+#define PTL_LE_EVENT_OVER_DISABLE PTL_ME_EVENT_OVER_DISABLE
+#define PTL_LE_EVENT_UNLINK_DISABLE PTL_ME_EVENT_UNLINK_DISABLE
+#define PTL_LE_EVENT_LINK_DISABLE PTL_ME_EVENT_LINK_DISABLE
+#define PTL_LE_EVENT_CT_COMM PTL_ME_EVENT_CT_COMM
+#define PTL_LE_EVENT_CT_OVERFLOW PTL_ME_EVENT_CT_OVERFLOW
+#define PTL_LE_EVENT_CT_BYTES PTL_ME_EVENT_CT_BYTES
+
+typedef struct
+{
+  int max_entries;
+  int max_unexpected_headers;
+  int max_mds;
+  int max_eqs;
+  int max_cts;
+  int max_pt_index;
+  int max_iovecs;
+  int max_list_size;
+  int max_triggered_ops;
+  ptl_size_t max_msg_size;
+  ptl_size_t max_atomic_size;
+  ptl_size_t max_fetch_atomic_size;
+  ptl_size_t max_waw_ordered_size;
+  ptl_size_t max_war_ordered_size;
+  ptl_size_t max_volatile_size;
+  unsigned int features;
+} ptl_ni_limits_t;
+
+typedef struct
+{
+  void* start;
+  ptl_size_t length;
+  unsigned int options;
+  ptl_handle_eq_t eq_handle;
+  ptl_handle_ct_t ct_handle;
+} ptl_md_t;
+
+typedef struct
+{
+  void* start;
+  ptl_size_t length;
+  ptl_handle_ct_t ct_handle;
+  ptl_uid_t uid;
+  unsigned int options;
+} ptl_le_t;
+
+typedef struct
+{
+  void* start;
+  ptl_size_t length;
+  ptl_handle_ct_t ct_handle;
+  ptl_uid_t uid;
+  unsigned int options;
+  ptl_process_t match_id;
+  ptl_match_bits_t match_bits;
+  ptl_match_bits_t ignore_bits;
+  ptl_size_t min_free;
+} ptl_me_t;
+
+typedef enum { PTL_PRIORITY_LIST, PTL_OVERFLOW_LIST } ptl_list_t;
+typedef enum { PTL_SEARCH_ONLY, PTL_SEARCH_DELETE } ptl_search_op_t;
+typedef enum {
+  PTL_ACK_REQ,
+  PTL_NO_ACK_REQ,
+  PTL_CT_ACK_REQ,
+  PTL_OC_ACK_REQ
+} ptl_ack_req_t;
+
+typedef enum {
+  PTL_EVENT_GET,
+  PTL_EVENT_GET_OVERFLOW,
+  PTL_EVENT_PUT,
+  PTL_EVENT_PUT_OVERFLOW,
+  PTL_EVENT_ATOMIC,
+  PTL_EVENT_ATOMIC_OVERFLOW,
+  PTL_EVENT_FETCH_ATOMIC,
+  PTL_EVENT_FETCH_ATOMIC_OVERFLOW,
+  PTL_EVENT_REPLY,
+  PTL_EVENT_SEND,
+  PTL_EVENT_ACK,
+  PTL_EVENT_PT_DISABLED,
+  PTL_EVENT_LINK,
+  PTL_EVENT_AUTO_UNLINK,
+  PTL_EVENT_AUTO_FREE,
+  PTL_EVENT_SEARCH
+} ptl_event_kind_t;
+
+typedef enum {
+  PTL_NI_OK,
+  PTL_NI_UNDELIVERABLE,
+  PTL_NI_PT_DISABLED,
+  PTL_NI_DROPPED,
+  PTL_NI_PERM_VIOLATION,
+  PTL_NI_OP_VIOLATION,
+  PTL_NI_SEGV,
+  PTL_NI_NO_MATCH
+} ptl_ni_fail_t;
+
+typedef struct
+{
+  void* start;
+  void* user_ptr;
+  ptl_hdr_data_t hdr_data;
+  ptl_match_bits_t match_bits;
+  ptl_size_t rlength;
+  ptl_size_t mlength;
+  ptl_size_t remote_offset;
+  ptl_uid_t uid;
+  ptl_process_t initiator;
+  ptl_event_kind_t type;
+  ptl_list_t ptl_list;
+  ptl_index_t pt_index;
+  ptl_ni_fail_t ni_fail_type;
+  int atomic_operation;
+  int atomic_type;
+} ptl_event_t;
+
+typedef struct
+{
+  ptl_size_t success;
+  ptl_size_t failure;
+} ptl_ct_event_t;
+
+int PtlInit(void);
+void PtlFini(void);
+
+int PtlNIInit(ptl_interface_t iface, unsigned int options, ptl_pid_t pid,
+              const ptl_ni_limits_t* desired, ptl_ni_limits_t* actual,
+              ptl_handle_ni_t* ni_handle);
+int PtlNIFini(ptl_handle_ni_t ni_handle);
+int PtlGetPhysId(ptl_handle_ni_t ni_handle, ptl_process_t* id);
+int PtlGetId(ptl_handle_ni_t ni_handle, ptl_process_t* id);
+int PtlGetUid(ptl_handle_ni_t ni_handle, ptl_uid_t* uid);
+int PtlHandleIsEqual(ptl_handle_any_t handle1, ptl_handle_any_t handle2);
+
+int PtlPTAlloc(ptl_handle_ni_t ni_handle, unsigned int options,
+               ptl_handle_eq_t eq_handle, ptl_index_t pt_index_req,
+               ptl_index_t* pt_index);
+int PtlPTFree(ptl_handle_ni_t ni_handle, ptl_index_t pt_index);
+int PtlPTDisable(ptl_handle_ni_t ni_handle, ptl_index_t pt_index);
+int PtlPTEnable(ptl_handle_ni_t ni_handle, ptl_index_t pt_index);
+
+int PtlMDBind(ptl_handle_ni_t ni_handle, const ptl_md_t* md,
+              ptl_handle_md_t* md_handle);
+int PtlMDRelease(ptl_handle_md_t md_handle);
+
+int PtlLEAppend(ptl_handle_ni_t ni_handle, ptl_index_t pt_index,
+                const ptl_le_t* le, ptl_list_t ptl_list, void* user_ptr,
+                ptl_handle_le_t* le_handle);
+int PtlLEUnlink(ptl_handle_le_t le_handle);
+int PtlLESearch(ptl_handle_ni_t ni_handle, ptl_index_t pt_index,
+                const ptl_le_t* le, ptl_search_op_t ptl_search_op,
+                void* user_ptr);
+int PtlMEAppend(ptl_handle_ni_t ni_handle, ptl_index_t pt_index,
+                const ptl_me_t* me, ptl_list_t ptl_list, void* user_ptr,
+                ptl_handle_me_t* me_handle);
+int PtlMEUnlink(ptl_handle_me_t me_handle);
+int PtlMESearch(ptl_handle_ni_t ni_handle, ptl_index_t pt_index,
+                const ptl_me_t* me, ptl_search_op_t ptl_search_op,
+                void* user_ptr);
+
+int PtlEQAlloc(ptl_handle_ni_t ni_handle, ptl_size_t count,
+               ptl_handle_eq_t* eq_handle);
+int PtlEQFree(ptl_handle_eq_t eq_handle);
+int PtlEQGet(ptl_handle_eq_t eq_handle, ptl_event_t* event);
+int PtlEQWait(ptl_handle_eq_t eq_handle, ptl_event_t* event);
+int PtlEQPoll(const ptl_handle_eq_t* eq_handles, unsigned int size,
+              ptl_time_t timeout, ptl_event_t* event, unsigned int* which);
+
+int PtlCTAlloc(ptl_handle_ni_t ni_handle, ptl_handle_ct_t* ct_handle);
+int PtlCTFree(ptl_handle_ct_t ct_handle);
+int PtlCTCancelTriggered(ptl_handle_ct_t ct_handle);
+int PtlCTGet(ptl_handle_ct_t ct_handle, ptl_ct_event_t* event);
+int PtlCTWait(ptl_handle_ct_t ct_handle, ptl_size_t test,
+              ptl_ct_event_t* event);
+int PtlCTPoll(const ptl_handle_ct_t* ct_handles, const ptl_size_t* tests,
+              unsigned int size, ptl_time_t timeout, ptl_ct_event_t* event,
+              unsigned int* which);
+int PtlCTSet(ptl_handle_ct_t ct_handle, ptl_ct_event_t new_ct);
+int PtlCTInc(ptl_handle_ct_t ct_handle, ptl_ct_event_t increment);
+
+int PtlPut(ptl_handle_md_t md_handle, ptl_size_t local_offset,
+           ptl_size_t length, ptl_ack_req_t ack_req, ptl_process_t target_id,
+           ptl_index_t pt_index, ptl_match_bits_t match_bits,
+           ptl_size_t remote_offset, void* user_ptr, ptl_hdr_data_t hdr_data);
+int PtlGet(ptl_handle_md_t md_handle, ptl_size_t local_offset,
+           ptl_size_t length, ptl_process_t target_id, ptl_index_t pt_index,
+           ptl_match_bits_t match_bits, ptl_size_t remote_offset,
+           void* user_ptr);
+
+int PtlTriggeredPut(ptl_handle_md_t md_handle, ptl_size_t local_offset,
+                    ptl_size_t length, ptl_ack_req_t ack_req,
+                    ptl_process_t target_id, ptl_index_t pt_index,
+                    ptl_match_bits_t match_bits, ptl_size_t remote_offset,
+                    void* user_ptr, ptl_hdr_data_t hdr_data,
+                    ptl_handle_ct_t trig_ct_handle, ptl_size_t threshold);
+int PtlTriggeredGet(ptl_handle_md_t md_handle, ptl_size_t local_offset,
+                    ptl_size_t length, ptl_process_t target_id,
+                    ptl_index_t pt_index, ptl_match_bits_t match_bits,
+                    ptl_size_t remote_offset, void* user_ptr,
+                    ptl_handle_ct_t trig_ct_handle, ptl_size_t threshold);
+int PtlTriggeredCTInc(ptl_handle_ct_t ct_handle, ptl_ct_event_t increment,
+                      ptl_handle_ct_t trig_ct_handle, ptl_size_t threshold);
+int PtlTriggeredCTSet(ptl_handle_ct_t ct_handle, ptl_ct_event_t new_ct,
+                      ptl_handle_ct_t trig_ct_handle, ptl_size_t threshold);
+#endif
@@ -0,0 +1,504 @@
+#define _GNU_SOURCE
+#include "ptl_shm.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#define SHM_QUEUE_MAGIC 0x50544C53484D3031UL
+
+shm_ni_t shm_nis[SHM_MAX_NIS];
+static int init_count = 0;
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void ni_teardown(shm_ni_t* ni, ptl_handle_ni_t ni_handle);
+
+void
+shm_relax(void)
+{
+  sched_yield();
+}
+
+int
+shm_table_grow(void** table, int* count, size_t elem_size)
+{
+  int new_count = *count ? *count * 2 : 64;
+  void* tmp = realloc(*table, new_count * elem_size);
+  if(NULL == tmp)
+    return -1;
+  memset((char*)tmp + *count * elem_size, 0, (new_count - *count) * elem_size);
+  *table = tmp;
+  *count = new_count;
+  return 0;
+}
+
+shm_ni_t*
+shm_ni_from_handle(ptl_handle_any_t handle, shm_obj_kind_t kind)
+{
+  if(PtlHandleIsEqual(handle, PTL_INVALID_HANDLE) ||
+     SHM_HANDLE_KIND(handle) != kind)
+    return NULL;
+  shm_ni_t* ni = &shm_nis[SHM_HANDLE_NI(handle)];
+  return ni->in_use ? ni : NULL;
+}
+
+static void
+queue_name(char* name, size_t len, ptl_process_t id)
+{
+  snprintf(name, len, "/ptlshm.%u.%u.%u", (unsigned)getuid(), id.phys.nid,
+           id.phys.pid);
+}
+
+static shm_queue_t*
+queue_map(const char* name, int create)
+{
+  int fd = shm_open(name, create ? O_CREAT | O_RDWR | O_TRUNC : O_RDWR, 0600);
+  if(0 > fd)
+    return NULL;
+  if(create && 0 != ftruncate(fd, sizeof(shm_queue_t)))
+  {
+    close(fd);
+    return NULL;
+  }
+  shm_queue_t* queue = mmap(NULL, sizeof(shm_queue_t), PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+  close(fd);
+  if(MAP_FAILED == queue)
+    return NULL;
+  if(create)
+  {
+    for(uint64_t i = 0; i < SHM_QUEUE_SLOTS; ++i)
+      atomic_store_explicit(&queue->slots[i].seq, i, memory_order_relaxed);
+    atomic_store(&queue->head, 0);
+    atomic_store(&queue->tail, 0);
+    queue->owner = getpid();
+    atomic_thread_fence(memory_order_release);
+    queue->magic = SHM_QUEUE_MAGIC;
+  }
+  else if(SHM_QUEUE_MAGIC != queue->magic)
+  {
+    munmap(queue, sizeof(shm_queue_t));
+    return NULL;
+  }
+  return queue;
+}
+
+void
+shm_queue_push(shm_queue_t* queue, const shm_msg_t* msg)
+{
+  uint64_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  shm_slot_t* slot;
+
+  while(1)
+  {
+    slot = &queue->slots[pos % SHM_QUEUE_SLOTS];
+    uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    int64_t dif = (int64_t)seq - (int64_t)pos;
+    if(0 == dif)
+    {
+      if(atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+                                               memory_order_relaxed,
+                                               memory_order_relaxed))
+        break;
+    }
+    else
+    {
+      /* queue full: the consumer has to drain before we can continue */
+      if(0 > dif)
+        shm_relax();
+      pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    }
+  }
+  slot->msg = *msg;
+  atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
+
+static int
+queue_pop(shm_queue_t* queue, shm_msg_t* msg)
+{
+  uint64_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  shm_slot_t* slot = &queue->slots[pos % SHM_QUEUE_SLOTS];
+  uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+  if(seq != pos + 1)
+    return 0;
+  *msg = slot->msg;
+  atomic_store_explicit(&queue->head, pos + 1, memory_order_relaxed);
+  atomic_store_explicit(&slot->seq, pos + SHM_QUEUE_SLOTS,
+                        memory_order_release);
+  return 1;
+}
+
+shm_queue_t*
+shm_peer_queue(shm_ni_t* ni, ptl_process_t target)
+{
+  if(target.phys.nid == ni->id.phys.nid && target.phys.pid == ni->id.phys.pid)
+    return ni->queue;
+
+  for(int i = 0; i < ni->num_peers; ++i)
+  {
+    if(ni->peers[i].nid == target.phys.nid &&
+       ni->peers[i].pid == target.phys.pid)
+      return ni->peers[i].queue;
+  }
+
+  char name[64];
+  queue_name(name, sizeof(name), target);
+  shm_queue_t* queue = queue_map(name, 0);
+  if(NULL == queue)
+    return NULL;
+
+  shm_peer_t* tmp = realloc(ni->peers, (ni->num_peers + 1) * sizeof(*tmp));
+  if(NULL == tmp)
+  {
+    munmap(queue, sizeof(shm_queue_t));
+    return NULL;
+  }
+  ni->peers = tmp;
+  ni->peers[ni->num_peers].nid = target.phys.nid;
+  ni->peers[ni->num_peers].pid = target.phys.pid;
+  ni->peers[ni->num_peers].queue = queue;
+  ni->num_peers++;
+  return queue;
+}
+
+static void*
+progress_thread(void* arg)
+{
+  shm_ni_t* ni = arg;
+  shm_msg_t msg;
+
+  while(!atomic_load_explicit(&ni->stop, memory_order_relaxed))
+  {
+    if(queue_pop(ni->queue, &msg))
+      shm_handle_message(ni, &msg);
+    else
+      shm_relax();
+  }
+  return NULL;
+}
+
+int
+PtlInit(void)
+{
+  pthread_mutex_lock(&init_lock);
+  if(0 == init_count++)
+  {
+    /* peers copy payloads with process_vm_readv/writev */
+    prctl(PR_SET_PTRACER, PR_SET_PTRACER_ANY, 0, 0, 0);
+  }
+  pthread_mutex_unlock(&init_lock);
+  return PTL_OK;
+}
+
+void
+PtlFini(void)
+{
+  pthread_mutex_lock(&init_lock);
+  if(0 < init_count && 0 == --init_count)
+  {
+    for(int i = 0; i < SHM_MAX_NIS; ++i)
+    {
+      if(shm_nis[i].in_use)
+        ni_teardown(&shm_nis[i], SHM_HANDLE(SHM_OBJ_NI, i, 0));
+    }
+  }
+  pthread_mutex_unlock(&init_lock);
+}
+
+static void
+fill_limits(ptl_ni_limits_t* actual)
+{
+  if(NULL == actual)
+    return;
+  ptl_ni_limits_t limits = {.max_entries = 1 << 20,
+                            .max_unexpected_headers = 1 << 20,
+                            .max_mds = 1 << 20,
+                            .max_eqs = 1 << 20,
+                            .max_cts = 1 << 20,
+                            .max_pt_index = SHM_MAX_PT_INDEX,
+                            .max_iovecs = 0,
+                            .max_list_size = 1 << 20,
+                            .max_triggered_ops = 1 << 20,
+                            .max_msg_size = PTL_SIZE_MAX,
+                            .max_atomic_size = 0,
+                            .max_fetch_atomic_size = 0,
+                            .max_waw_ordered_size = PTL_SIZE_MAX,
+                            .max_war_ordered_size = PTL_SIZE_MAX,
+                            .max_volatile_size = PTL_SIZE_MAX,
+                            .features = PTL_TARGET_BIND_INACCESSIBLE |
+                                        PTL_TOTAL_DATA_ORDERING};
+  *actual = limits;
+}
+
+int
+PtlNIInit(ptl_interface_t iface, unsigned int options, ptl_pid_t pid,
+          const ptl_ni_limits_t* desired, ptl_ni_limits_t* actual,
+          ptl_handle_ni_t* ni_handle)
+{
+  int slot = -1;
+  int matching = (options & PTL_NI_MATCHING) ? 1 : 0;
+
+  /* the limits of the stand-in are fixed */
+  (void)desired;
+
+  if(0 == init_count)
+    return PTL_NO_INIT;
+  if(NULL == ni_handle)
+    return PTL_ARG_INVALID;
+  if(options & PTL_NI_LOGICAL)
+    return PTL_ARG_INVALID;
+
+  pthread_mutex_lock(&init_lock);
+  for(int i = 0; i < SHM_MAX_NIS; ++i)
+  {
+    if(shm_nis[i].in_use && iface == shm_nis[i].iface &&
+       matching == shm_nis[i].matching)
+    {
+      ++shm_nis[i].refs;
+      pthread_mutex_unlock(&init_lock);
+      fill_limits(actual);
+      *ni_handle = SHM_HANDLE(SHM_OBJ_NI, i, 0);
+      return PTL_OK;
+    }
+  }
+  for(int i = 0; i < SHM_MAX_NIS; ++i)
+  {
+    if(!shm_nis[i].in_use)
+    {
+      slot = i;
+      break;
+    }
+  }
+  if(0 > slot)
+  {
+    pthread_mutex_unlock(&init_lock);
+    return PTL_NO_SPACE;
+  }
+
+  shm_ni_t* ni = &shm_nis[slot];
+  memset(ni, 0, sizeof(*ni));
+  ni->matching = matching;
+  ni->iface = iface;
+  ni->refs = 1;
+  ni->id.phys.nid = PTL_IFACE_DEFAULT == iface ? 0 : iface;
+  ni->id.phys.pid = PTL_PID_ANY == pid
+                        ? ((ptl_pid_t)(getpid() & 0xFFFFFF) << 4) | slot
+                        : pid;
+  queue_name(ni->queue_name, sizeof(ni->queue_name), ni->id);
+  ni->queue = queue_map(ni->queue_name, 1);
+  if(NULL == ni->queue)
+  {
+    pthread_mutex_unlock(&init_lock);
+    return PTL_PID_IN_USE;
+  }
+  for(int i = 0; i <= SHM_MAX_PT_INDEX; ++i)
+    ni->pt[i].eq_h = PTL_EQ_NONE;
+  pthread_mutex_init(&ni->lock, NULL);
+  atomic_store(&ni->stop, 0);
+  ni->in_use = 1;
+
+  if(0 != pthread_create(&ni->progress, NULL, progress_thread, ni))
+  {
+    ni->in_use = 0;
+    munmap(ni->queue, sizeof(shm_queue_t));
+    shm_unlink(ni->queue_name);
+    pthread_mutex_unlock(&init_lock);
+    return PTL_FAIL;
+  }
+  pthread_mutex_unlock(&init_lock);
+
+  fill_limits(actual);
+  *ni_handle = SHM_HANDLE(SHM_OBJ_NI, slot, 0);
+  return PTL_OK;
+}
+
+/* releases everything of the NI, called with init_lock held */
+static void
+ni_teardown(shm_ni_t* ni, ptl_handle_ni_t ni_handle)
+{
+  atomic_store(&ni->stop, 1);
+  pthread_join(ni->progress, NULL);
+
+  for(int i = 0; i <= SHM_MAX_PT_INDEX; ++i)
+  {
+    if(ni->pt[i].in_use)
+      PtlPTFree(ni_handle, i);
+  }
+  for(int i = 0; i < ni->num_entries; ++i)
+    free(ni->entries[i]);
+  for(int i = 0; i < ni->num_eqs; ++i)
+    free(ni->eqs[i].ring);
+  for(int i = 0; i < ni->num_cts; ++i)
+  {
+    while(NULL != ni->cts[i].triggered)
+    {
+      shm_trig_t* next = ni->cts[i].triggered->next;
+      free(ni->cts[i].triggered);
+      ni->cts[i].triggered = next;
+    }
+  }
+  for(int i = 0; i < ni->num_peers; ++i)
+    munmap(ni->peers[i].queue, sizeof(shm_queue_t));
+
+  free(ni->entries);
+  free(ni->eqs);
+  free(ni->cts);
+  free(ni->mds);
+  free(ni->peers);
+  munmap(ni->queue, sizeof(shm_queue_t));
+  shm_unlink(ni->queue_name);
+  pthread_mutex_destroy(&ni->lock);
+  ni->in_use = 0;
+}
+
+int
+PtlNIFini(ptl_handle_ni_t ni_handle)
+{
+  shm_ni_t* ni = shm_ni_from_handle(ni_handle, SHM_OBJ_NI);
+  if(NULL == ni)
+    return PTL_ARG_INVALID;
+
+  /* the references are shared with PtlNIInit */
+  pthread_mutex_lock(&init_lock);
+  if(0 == --ni->refs)
+    ni_teardown(ni, ni_handle);
+  pthread_mutex_unlock(&init_lock);
+  return PTL_OK;
+}
+
+int
+PtlGetPhysId(ptl_handle_ni_t ni_handle, ptl_process_t* id)
+{
+  shm_ni_t* ni = shm_ni_from_handle(ni_handle, SHM_OBJ_NI);
+  if(NULL == ni || NULL == id)
+    return PTL_ARG_INVALID;
+  *id = ni->id;
+  return PTL_OK;
+}
+
+int
+PtlGetId(ptl_handle_ni_t ni_handle, ptl_process_t* id)
+{
+  return PtlGetPhysId(ni_handle, id);
+}
+
+int
+PtlGetUid(ptl_handle_ni_t ni_handle, ptl_uid_t* uid)
+{
+  if(NULL == shm_ni_from_handle(ni_handle, SHM_OBJ_NI) || NULL == uid)
+    return PTL_ARG_INVALID;
+  *uid = getuid();
+  return PTL_OK;
+}
+
+int
+PtlHandleIsEqual(ptl_handle_any_t handle1, ptl_handle_any_t handle2)
+{
+  return handle1 == handle2;
+}
+
+int
+PtlPTAlloc(ptl_handle_ni_t ni_handle, unsigned int options,
+           ptl_handle_eq_t eq_handle, ptl_index_t pt_index_req,
+           ptl_index_t* pt_index)
+{
+  int eret = PTL_OK;
+  shm_ni_t* ni = shm_ni_from_handle(ni_handle, SHM_OBJ_NI);
+  if(NULL == ni || NULL == pt_index)
+    return PTL_ARG_INVALID;
+  if((options & PTL_PT_FLOWCTRL) && PtlHandleIsEqual(eq_handle, PTL_EQ_NONE))
+    return PTL_PT_EQ_NEEDED;
+
+  pthread_mutex_lock(&ni->lock);
+  if(PTL_PT_ANY == pt_index_req)
+  {
+    eret = PTL_PT_FULL;
+    for(ptl_index_t i = 0; i <= SHM_MAX_PT_INDEX; ++i)
+    {
+      if(!ni->pt[i].in_use)
+      {
+        pt_index_req = i;
+        eret = PTL_OK;
+        break;
+      }
+    }
+  }
+  else if(SHM_MAX_PT_INDEX < pt_index_req)
+    eret = PTL_ARG_INVALID;
+  else if(ni->pt[pt_index_req].in_use)
+    eret = PTL_PT_IN_USE;
+
+  if(PTL_OK == eret)
+  {
+    shm_pt_t* pt = &ni->pt[pt_index_req];
+    memset(pt, 0, sizeof(*pt));
+    pt->in_use = 1;
+    pt->enabled = 1;
+    pt->options = options;
+    pt->eq_h = eq_handle;
+    *pt_index = pt_index_req;
+  }
+  pthread_mutex_unlock(&ni->lock);
+  return eret;
+}
+
+int
+PtlPTFree(ptl_handle_ni_t ni_handle, ptl_index_t pt_index)
+{
+  shm_ni_t* ni = shm_ni_from_handle(ni_handle, SHM_OBJ_NI);
+  if(NULL == ni || SHM_MAX_PT_INDEX < pt_index)
+    return PTL_ARG_INVALID;
+
+  pthread_mutex_lock(&ni->lock);
+  shm_pt_t* pt = &ni->pt[pt_index];
+  if(!pt->in_use)
+  {
+    pthread_mutex_unlock(&ni->lock);
+    return PTL_ARG_INVALID;
+  }
+  while(NULL != pt->priority)
+    shm_entry_unlink(ni, pt->priority);
+  while(NULL != pt->overflow)
+    shm_entry_unlink(ni, pt->overflow);
+  while(NULL != pt->unexpected)
+  {
+    shm_unexpected_t* next = pt->unexpected->next;
+    free(pt->unexpected);
+    pt->unexpected = next;
+  }
+  pt->in_use = 0;
+  pthread_mutex_unlock(&ni->lock);
+  return PTL_OK;
+}
+
+static int
+pt_set_enabled(ptl_handle_ni_t ni_handle, ptl_index_t pt_index, int enabled)
+{
+  shm_ni_t* ni = shm_ni_from_handle(ni_handle, SHM_OBJ_NI);
+  if(NULL == ni || SHM_MAX_PT_INDEX < pt_index)
+    return PTL_ARG_INVALID;
+
+  pthread_mutex_lock(&ni->lock);
+  int eret = ni->pt[pt_index].in_use ? PTL_OK : PTL_ARG_INVALID;
+  if(PTL_OK == eret)
+    ni->pt[pt_index].enabled = enabled;
+  pthread_mutex_unlock(&ni->lock);
+  return eret;
+}
+
+int
+PtlPTDisable(ptl_handle_ni_t ni_handle, ptl_index_t pt_index)
+{
+  return pt_set_enabled(ni_handle, pt_index, 0);
+}
+
+int
+PtlPTEnable(ptl_handle_ni_t ni_handle, ptl_index_t pt_index)
+{
+  return pt_set_enabled(ni_handle, pt_index, 1);
+}
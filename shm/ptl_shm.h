@@ -0,0 +1,230 @@
+#ifndef __PTL_SHM_H__
+#define __PTL_SHM_H__
+#include "portals4.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+/*
+ * Handles encode the object kind, the owning NI and the slot in that NI's
+ * object table: [31:28] kind, [27:24] NI, [23:0] slot.
+ */
+#define SHM_MAX_NIS 16
+#define SHM_MAX_PT_INDEX 255
+#define SHM_QUEUE_SLOTS 16384
+
+typedef enum {
+  SHM_OBJ_NI = 1,
+  SHM_OBJ_EQ,
+  SHM_OBJ_CT,
+  SHM_OBJ_MD,
+  SHM_OBJ_LE,
+  SHM_OBJ_ME
+} shm_obj_kind_t;
+
+#define SHM_HANDLE(kind, ni, slot)                                             \
+  ((ptl_handle_any_t)(((uint32_t)(kind) << 28) | ((uint32_t)(ni) << 24) |      \
+                      ((uint32_t)(slot)&0xFFFFFF)))
+#define SHM_HANDLE_KIND(h) (((uint32_t)(h) >> 28) & 0xF)
+#define SHM_HANDLE_NI(h) (((uint32_t)(h) >> 24) & 0xF)
+#define SHM_HANDLE_SLOT(h) ((uint32_t)(h)&0xFFFFFF)
+
+/* messages exchanged between NIs through the target's incoming queue */
+typedef enum {
+  SHM_MSG_PUT = 1,
+  SHM_MSG_GET,
+  SHM_MSG_PUT_RESP,
+  SHM_MSG_GET_RESP
+} shm_msg_kind_t;
+
+typedef struct
+{
+  uint32_t kind;
+  uint32_t ni_fail_type;
+  ptl_process_t initiator;
+  pid_t os_pid;
+  ptl_uid_t uid;
+  ptl_index_t pt_index;
+  ptl_list_t ptl_list;
+  ptl_ack_req_t ack_req;
+  ptl_handle_md_t md_h;
+  ptl_match_bits_t match_bits;
+  ptl_hdr_data_t hdr_data;
+  ptl_size_t remote_offset;
+  ptl_size_t local_offset;
+  ptl_size_t rlength;
+  ptl_size_t mlength;
+  uint64_t addr;
+  uint64_t user_ptr;
+  uint32_t ack_disabled;
+} shm_msg_t;
+
+typedef struct
+{
+  _Atomic uint64_t seq;
+  shm_msg_t msg;
+} shm_slot_t;
+
+/* bounded multi-producer / single-consumer queue living in shared memory */
+typedef struct
+{
+  uint64_t magic;
+  pid_t owner;
+  _Atomic uint64_t head;
+  char pad0[64];
+  _Atomic uint64_t tail;
+  char pad1[64];
+  shm_slot_t slots[SHM_QUEUE_SLOTS];
+} shm_queue_t;
+
+typedef struct shm_entry
+{
+  struct shm_entry* next;
+  struct shm_entry* prev;
+  uint32_t slot;
+  int is_me;
+  ptl_index_t pt_index;
+  ptl_list_t list;
+  ptl_me_t me;
+  ptl_size_t local_offset;
+  void* user_ptr;
+  uint64_t serial;
+} shm_entry_t;
+
+/*
+ * header of a message that was deposited into the overflow list; owner is
+ * the serial of that entry, auto_free is set once it has unlinked itself
+ */
+typedef struct shm_unexpected
+{
+  struct shm_unexpected* next;
+  shm_msg_t hdr;
+  void* start;
+  void* user_ptr;
+  uint64_t owner;
+  int auto_free;
+} shm_unexpected_t;
+
+typedef struct
+{
+  int in_use;
+  int enabled;
+  unsigned int options;
+  ptl_handle_eq_t eq_h;
+  shm_entry_t* priority;
+  shm_entry_t* overflow;
+  shm_unexpected_t* unexpected;
+} shm_pt_t;
+
+typedef struct
+{
+  int in_use;
+  ptl_event_t* ring;
+  ptl_size_t count;
+  ptl_size_t head;
+  ptl_size_t tail;
+  int dropped;
+} shm_eq_t;
+
+typedef enum {
+  SHM_TRIG_PUT = 1,
+  SHM_TRIG_GET,
+  SHM_TRIG_CT_INC,
+  SHM_TRIG_CT_SET
+} shm_trig_kind_t;
+
+typedef struct shm_trig
+{
+  struct shm_trig* next;
+  shm_trig_kind_t kind;
+  ptl_size_t threshold;
+  ptl_handle_md_t md_h;
+  ptl_size_t local_offset;
+  ptl_size_t length;
+  ptl_ack_req_t ack_req;
+  ptl_process_t target_id;
+  ptl_index_t pt_index;
+  ptl_match_bits_t match_bits;
+  ptl_size_t remote_offset;
+  void* user_ptr;
+  ptl_hdr_data_t hdr_data;
+  ptl_handle_ct_t ct_h;
+  ptl_ct_event_t ct_value;
+} shm_trig_t;
+
+typedef struct
+{
+  int in_use;
+  ptl_ct_event_t ev;
+  shm_trig_t* triggered;
+} shm_ct_t;
+
+typedef struct
+{
+  int in_use;
+  ptl_md_t md;
+} shm_md_t;
+
+typedef struct
+{
+  ptl_nid_t nid;
+  ptl_pid_t pid;
+  shm_queue_t* queue;
+} shm_peer_t;
+
+/* repeated PtlNIInit calls for the same interface share one NI */
+typedef struct
+{
+  int in_use;
+  int refs;
+  int matching;
+  ptl_interface_t iface;
+  ptl_process_t id;
+  pthread_mutex_t lock;
+  pthread_t progress;
+  atomic_int stop;
+  shm_queue_t* queue;
+  char queue_name[64];
+
+  shm_pt_t pt[SHM_MAX_PT_INDEX + 1];
+  shm_eq_t* eqs;
+  int num_eqs;
+  shm_ct_t* cts;
+  int num_cts;
+  shm_md_t* mds;
+  int num_mds;
+  shm_entry_t** entries;
+  int num_entries;
+  uint64_t next_serial;
+
+  shm_peer_t* peers;
+  int num_peers;
+} shm_ni_t;
+
+extern shm_ni_t shm_nis[SHM_MAX_NIS];
+
+/* ptl_shm.c */
+shm_ni_t* shm_ni_from_handle(ptl_handle_any_t handle, shm_obj_kind_t kind);
+int shm_table_grow(void** table, int* count, size_t elem_size);
+shm_queue_t* shm_peer_queue(shm_ni_t* ni, ptl_process_t target);
+void shm_queue_push(shm_queue_t* queue, const shm_msg_t* msg);
+void shm_relax(void);
+
+/* ptl_shm_list.c */
+int shm_eq_post(shm_ni_t* ni, ptl_handle_eq_t eq_h, const ptl_event_t* ev);
+void shm_ct_add(shm_ni_t* ni, ptl_handle_ct_t ct_h, ptl_size_t success,
+                ptl_size_t failure, shm_trig_t** fired);
+void shm_ct_assign(shm_ni_t* ni, ptl_handle_ct_t ct_h, ptl_ct_event_t value,
+                   shm_trig_t** fired);
+int shm_me_matches(const shm_ni_t* ni, const ptl_me_t* me,
+                   const shm_msg_t* hdr);
+void shm_entry_unlink(shm_ni_t* ni, shm_entry_t* entry);
+void shm_overflow_unlinked(shm_ni_t* ni, shm_pt_t* pt,
+                           const shm_entry_t* entry);
+void shm_unexpected_release(shm_ni_t* ni, shm_pt_t* pt,
+                            shm_unexpected_t* unexp);
+
+/* ptl_shm_data.c */
+void shm_handle_message(shm_ni_t* ni, const shm_msg_t* msg);
+void shm_run_triggered(shm_trig_t* fired);
+#endif
@@ -0,0 +1,484 @@
+#define _GNU_SOURCE
+#include "ptl_shm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* move mlength bytes between a local buffer and the initiator's memory */
+static int
+copy_payload(const shm_msg_t* msg, void* local, const ptl_size_t mlength)
+{
+  void* remote = (void*)(uintptr_t)msg->addr;
+  if(0 == mlength)
+    return 0;
+  if(msg->os_pid == getpid())
+  {
+    if(SHM_MSG_PUT == msg->kind)
+      memcpy(local, remote, mlength);
+    else
+      memcpy(remote, local, mlength);
+    return 0;
+  }
+
+  ptl_size_t done = 0;
+  while(done < mlength)
+  {
+    struct iovec liov = {.iov_base = (char*)local + done,
+                         .iov_len = mlength - done};
+    struct iovec riov = {.iov_base = (char*)remote + done,
+                         .iov_len = mlength - done};
+    ssize_t n = SHM_MSG_PUT == msg->kind
+                    ? process_vm_readv(msg->os_pid, &liov, 1, &riov, 1, 0)
+                    : process_vm_writev(msg->os_pid, &liov, 1, &riov, 1, 0);
+    if(0 >= n)
+    {
+      perror("portals_shm: process_vm_readv/writev");
+      return -1;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+static shm_entry_t*
+find_entry(shm_ni_t* ni, shm_entry_t* list, const shm_msg_t* msg)
+{
+  for(shm_entry_t* entry = list; NULL != entry; entry = entry->next)
+  {
+    if(!shm_me_matches(ni, &entry->me, msg))
+      continue;
+    if(entry->me.options & PTL_ME_NO_TRUNCATE)
+    {
+      ptl_size_t offset = (entry->me.options & PTL_ME_MANAGE_LOCAL)
+                              ? entry->local_offset
+                              : msg->remote_offset;
+      if(entry->me.length < offset ||
+         entry->me.length - offset < msg->rlength)
+        continue;
+    }
+    return entry;
+  }
+  return NULL;
+}
+
+/* a flow-controlled PT is disabled as soon as its EQ cannot take an event */
+static int
+eq_exhausted(shm_ni_t* ni, ptl_handle_eq_t eq_h)
+{
+  if(PtlHandleIsEqual(eq_h, PTL_EQ_NONE))
+    return 0;
+  shm_eq_t* eq = &ni->eqs[SHM_HANDLE_SLOT(eq_h)];
+  return eq->tail - eq->head + 1 >= eq->count;
+}
+
+static ptl_ni_fail_t
+disable_pt(shm_ni_t* ni, shm_pt_t* pt, const shm_msg_t* msg)
+{
+  ptl_event_t ev = {.initiator = msg->initiator,
+                    .type = PTL_EVENT_PT_DISABLED,
+                    .pt_index = msg->pt_index,
+                    .ni_fail_type = PTL_NI_PT_DISABLED};
+  pt->enabled = 0;
+  shm_eq_post(ni, pt->eq_h, &ev);
+  return PTL_NI_PT_DISABLED;
+}
+
+static void
+deliver(shm_ni_t* ni, const shm_msg_t* msg, shm_msg_t* resp,
+        shm_trig_t** fired)
+{
+  if(SHM_MAX_PT_INDEX < msg->pt_index || !ni->pt[msg->pt_index].in_use)
+  {
+    resp->ni_fail_type = PTL_NI_DROPPED;
+    return;
+  }
+  shm_pt_t* pt = &ni->pt[msg->pt_index];
+  if(!pt->enabled)
+  {
+    resp->ni_fail_type = PTL_NI_PT_DISABLED;
+    return;
+  }
+
+  shm_entry_t* entry = find_entry(ni, pt->priority, msg);
+  if(NULL == entry)
+    entry = find_entry(ni, pt->overflow, msg);
+
+  int flowctrl = pt->options & PTL_PT_FLOWCTRL;
+  if(NULL == entry)
+  {
+    resp->ni_fail_type =
+        flowctrl ? disable_pt(ni, pt, msg) : PTL_NI_DROPPED;
+    return;
+  }
+  if(flowctrl && !(entry->me.options & PTL_ME_EVENT_FLOWCTRL_DISABLE) &&
+     eq_exhausted(ni, pt->eq_h))
+  {
+    resp->ni_fail_type = disable_pt(ni, pt, msg);
+    return;
+  }
+
+  ptl_me_t* me = &entry->me;
+  ptl_size_t offset = (me->options & PTL_ME_MANAGE_LOCAL)
+                          ? entry->local_offset
+                          : msg->remote_offset;
+  ptl_size_t avail = me->length > offset ? me->length - offset : 0;
+  ptl_size_t mlength = msg->rlength < avail ? msg->rlength : avail;
+  void* start = (char*)me->start + offset;
+
+  if(0 != copy_payload(msg, start, mlength))
+  {
+    resp->ni_fail_type = PTL_NI_SEGV;
+    return;
+  }
+
+  resp->mlength = mlength;
+  resp->remote_offset = offset;
+  resp->ptl_list = entry->list;
+  resp->ack_disabled = (me->options & PTL_ME_ACK_DISABLE) ? 1 : 0;
+  if(me->options & PTL_ME_MANAGE_LOCAL)
+    entry->local_offset += mlength;
+
+  if(!(me->options &
+       (PTL_ME_EVENT_COMM_DISABLE | PTL_ME_EVENT_SUCCESS_DISABLE)))
+  {
+    ptl_event_t ev = {
+        .start = start,
+        .user_ptr = entry->user_ptr,
+        .hdr_data = msg->hdr_data,
+        .match_bits = msg->match_bits,
+        .rlength = msg->rlength,
+        .mlength = mlength,
+        .remote_offset = offset,
+        .uid = msg->uid,
+        .initiator = msg->initiator,
+        .type = SHM_MSG_GET == msg->kind ? PTL_EVENT_GET : PTL_EVENT_PUT,
+        .ptl_list = entry->list,
+        .pt_index = msg->pt_index,
+        .ni_fail_type = PTL_NI_OK};
+    shm_eq_post(ni, pt->eq_h, &ev);
+  }
+  /* arrivals count as communication on either list; CT_OVERFLOW is for the
+   * priority entry that later claims the header */
+  if(me->options & PTL_ME_EVENT_CT_COMM)
+    shm_ct_add(ni, me->ct_handle,
+               (me->options & PTL_ME_EVENT_CT_BYTES) ? mlength : 1, 0, fired);
+
+  if(PTL_OVERFLOW_LIST == entry->list &&
+     !(me->options & PTL_ME_UNEXPECTED_HDR_DISABLE))
+  {
+    shm_unexpected_t* unexp = calloc(1, sizeof(shm_unexpected_t));
+    if(NULL != unexp)
+    {
+      shm_unexpected_t** it = &pt->unexpected;
+      unexp->hdr = *msg;
+      unexp->hdr.mlength = mlength;
+      unexp->hdr.remote_offset = offset;
+      unexp->start = start;
+      unexp->user_ptr = entry->user_ptr;
+      unexp->owner = entry->serial;
+      while(NULL != *it)
+        it = &(*it)->next;
+      *it = unexp;
+    }
+  }
+
+  int unlink = (me->options & PTL_ME_USE_ONCE) ||
+               ((me->options & PTL_ME_MANAGE_LOCAL) &&
+                me->length - entry->local_offset < me->min_free);
+  if(unlink)
+  {
+    if(!(me->options & PTL_ME_EVENT_UNLINK_DISABLE))
+    {
+      ptl_event_t ev = {.user_ptr = entry->user_ptr,
+                        .type = PTL_EVENT_AUTO_UNLINK,
+                        .ptl_list = entry->list,
+                        .pt_index = msg->pt_index,
+                        .ni_fail_type = PTL_NI_OK};
+      shm_eq_post(ni, pt->eq_h, &ev);
+    }
+    if(PTL_OVERFLOW_LIST == entry->list &&
+       !(me->options & PTL_ME_EVENT_UNLINK_DISABLE))
+      shm_overflow_unlinked(ni, pt, entry);
+    shm_entry_unlink(ni, entry);
+  }
+}
+
+static void
+complete(shm_ni_t* ni, const shm_msg_t* msg, shm_trig_t** fired)
+{
+  uint32_t slot = SHM_HANDLE_SLOT(msg->md_h);
+  if((int)slot >= ni->num_mds || !ni->mds[slot].in_use)
+    return;
+
+  ptl_md_t* md = &ni->mds[slot].md;
+  int ok = PTL_NI_OK == msg->ni_fail_type;
+  ptl_event_t ev = {.start = (char*)md->start + msg->local_offset,
+                    .user_ptr = (void*)(uintptr_t)msg->user_ptr,
+                    .hdr_data = msg->hdr_data,
+                    .match_bits = msg->match_bits,
+                    .rlength = msg->rlength,
+                    .mlength = msg->mlength,
+                    .remote_offset = msg->remote_offset,
+                    .uid = msg->uid,
+                    .initiator = msg->initiator,
+                    .ptl_list = msg->ptl_list,
+                    .pt_index = msg->pt_index,
+                    .ni_fail_type = msg->ni_fail_type};
+  int post = !ok || !(md->options & PTL_MD_EVENT_SUCCESS_DISABLE);
+  ptl_size_t bytes = (md->options & PTL_MD_EVENT_CT_BYTES) ? msg->mlength : 1;
+
+  if(SHM_MSG_GET_RESP == msg->kind)
+  {
+    ev.type = PTL_EVENT_REPLY;
+    if(post)
+      shm_eq_post(ni, md->eq_handle, &ev);
+    if(md->options & PTL_MD_EVENT_CT_REPLY)
+      shm_ct_add(ni, md->ct_handle, ok ? bytes : 0, !ok, fired);
+    return;
+  }
+
+  ev.type = PTL_EVENT_SEND;
+  if(post && !(md->options & PTL_MD_EVENT_SEND_DISABLE))
+    shm_eq_post(ni, md->eq_handle, &ev);
+  if(md->options & PTL_MD_EVENT_CT_SEND)
+    shm_ct_add(ni, md->ct_handle, ok ? bytes : 0, !ok, fired);
+
+  if(PTL_NO_ACK_REQ == msg->ack_req || msg->ack_disabled)
+    return;
+  ev.type = PTL_EVENT_ACK;
+  if(post && PTL_ACK_REQ == msg->ack_req)
+    shm_eq_post(ni, md->eq_handle, &ev);
+  if(md->options & PTL_MD_EVENT_CT_ACK)
+    shm_ct_add(ni, md->ct_handle, ok ? bytes : 0, !ok, fired);
+}
+
+void
+shm_handle_message(shm_ni_t* ni, const shm_msg_t* msg)
+{
+  shm_trig_t* fired = NULL;
+  shm_queue_t* queue = NULL;
+  shm_msg_t resp;
+
+  pthread_mutex_lock(&ni->lock);
+  if(SHM_MSG_PUT == msg->kind || SHM_MSG_GET == msg->kind)
+  {
+    resp = *msg;
+    resp.kind = SHM_MSG_PUT == msg->kind ? SHM_MSG_PUT_RESP : SHM_MSG_GET_RESP;
+    resp.ni_fail_type = PTL_NI_OK;
+    resp.mlength = 0;
+    resp.ptl_list = PTL_PRIORITY_LIST;
+    resp.ack_disabled = 0;
+    deliver(ni, msg, &resp, &fired);
+    resp.initiator = ni->id;
+    queue = shm_peer_queue(ni, msg->initiator);
+  }
+  else
+    complete(ni, msg, &fired);
+  pthread_mutex_unlock(&ni->lock);
+
+  shm_run_triggered(fired);
+  if(NULL != queue)
+    shm_queue_push(queue, &resp);
+}
+
+static int
+issue(shm_msg_kind_t kind, ptl_handle_md_t md_handle, ptl_size_t local_offset,
+      ptl_size_t length, ptl_ack_req_t ack_req, ptl_process_t target_id,
+      ptl_index_t pt_index, ptl_match_bits_t match_bits,
+      ptl_size_t remote_offset, void* user_ptr, ptl_hdr_data_t hdr_data)
+{
+  shm_ni_t* ni = shm_ni_from_handle(md_handle, SHM_OBJ_MD);
+  if(NULL == ni)
+    return PTL_ARG_INVALID;
+
+  pthread_mutex_lock(&ni->lock);
+  uint32_t slot = SHM_HANDLE_SLOT(md_handle);
+  if((int)slot >= ni->num_mds || !ni->mds[slot].in_use)
+  {
+    pthread_mutex_unlock(&ni->lock);
+    return PTL_ARG_INVALID;
+  }
+  ptl_md_t* md = &ni->mds[slot].md;
+  if(md->length < local_offset || md->length - local_offset < length)
+  {
+    pthread_mutex_unlock(&ni->lock);
+    return PTL_ARG_INVALID;
+  }
+
+  shm_msg_t msg = {.kind = kind,
+                   .ni_fail_type = PTL_NI_OK,
+                   .initiator = ni->id,
+                   .os_pid = getpid(),
+                   .uid = getuid(),
+                   .pt_index = pt_index,
+                   .ptl_list = PTL_PRIORITY_LIST,
+                   .ack_req = ack_req,
+                   .md_h = md_handle,
+                   .match_bits = match_bits,
+                   .hdr_data = hdr_data,
+                   .remote_offset = remote_offset,
+                   .local_offset = local_offset,
+                   .rlength = length,
+                   .addr = (uintptr_t)md->start + local_offset,
+                   .user_ptr = (uintptr_t)user_ptr};
+  shm_queue_t* queue = shm_peer_queue(ni, target_id);
+  pthread_mutex_unlock(&ni->lock);
+
+  if(NULL == queue)
+    return PTL_FAIL;
+  shm_queue_push(queue, &msg);
+  return PTL_OK;
+}
+
+int
+PtlPut(ptl_handle_md_t md_handle, ptl_size_t local_offset, ptl_size_t length,
+       ptl_ack_req_t ack_req, ptl_process_t target_id, ptl_index_t pt_index,
+       ptl_match_bits_t match_bits, ptl_size_t remote_offset, void* user_ptr,
+       ptl_hdr_data_t hdr_data)
+{
+  return issue(SHM_MSG_PUT, md_handle, local_offset, length, ack_req,
+               target_id, pt_index, match_bits, remote_offset, user_ptr,
+               hdr_data);
+}
+
+int
+PtlGet(ptl_handle_md_t md_handle, ptl_size_t local_offset, ptl_size_t length,
+       ptl_process_t target_id, ptl_index_t pt_index,
+       ptl_match_bits_t match_bits, ptl_size_t remote_offset, void* user_ptr)
+{
+  return issue(SHM_MSG_GET, md_handle, local_offset, length, PTL_NO_ACK_REQ,
+               target_id, pt_index, match_bits, remote_offset, user_ptr, 0);
+}
+
+/* run the operation now if the threshold is met, otherwise park it */
+static int
+trigger(shm_trig_t* op, ptl_handle_ct_t trig_ct_handle)
+{
+  shm_ni_t* ni = shm_ni_from_handle(trig_ct_handle, SHM_OBJ_CT);
+  if(NULL == ni)
+    return PTL_ARG_INVALID;
+
+  shm_trig_t* node = malloc(sizeof(shm_trig_t));
+  if(NULL == node)
+    return PTL_NO_SPACE;
+  *node = *op;
+  node->next = NULL;
+
+  pthread_mutex_lock(&ni->lock);
+  uint32_t slot = SHM_HANDLE_SLOT(trig_ct_handle);
+  if((int)slot >= ni->num_cts || !ni->cts[slot].in_use)
+  {
+    pthread_mutex_unlock(&ni->lock);
+    free(node);
+    return PTL_ARG_INVALID;
+  }
+  shm_ct_t* ct = &ni->cts[slot];
+  if(ct->ev.success >= node->threshold)
+  {
+    pthread_mutex_unlock(&ni->lock);
+    shm_run_triggered(node);
+    return PTL_OK;
+  }
+  shm_trig_t** it = &ct->triggered;
+  while(NULL != *it)
+    it = &(*it)->next;
+  *it = node;
+  pthread_mutex_unlock(&ni->lock);
+  return PTL_OK;
+}
+
+void
+shm_run_triggered(shm_trig_t* fired)
+{
+  while(NULL != fired)
+  {
+    shm_trig_t* op = fired;
+    fired = op->next;
+    switch(op->kind)
+    {
+    case SHM_TRIG_PUT:
+      PtlPut(op->md_h, op->local_offset, op->length, op->ack_req,
+             op->target_id, op->pt_index, op->match_bits, op->remote_offset,
+             op->user_ptr, op->hdr_data);
+      break;
+    case SHM_TRIG_GET:
+      PtlGet(op->md_h, op->local_offset, op->length, op->target_id,
+             op->pt_index, op->match_bits, op->remote_offset, op->user_ptr);
+      break;
+    case SHM_TRIG_CT_INC:
+      PtlCTInc(op->ct_h, op->ct_value);
+      break;
+    case SHM_TRIG_CT_SET:
+      PtlCTSet(op->ct_h, op->ct_value);
+      break;
+    }
+    free(op);
+  }
+}
+
+int
+PtlTriggeredPut(ptl_handle_md_t md_handle, ptl_size_t local_offset,
+                ptl_size_t length, ptl_ack_req_t ack_req,
+                ptl_process_t target_id, ptl_index_t pt_index,
+                ptl_match_bits_t match_bits, ptl_size_t remote_offset,
+                void* user_ptr, ptl_hdr_data_t hdr_data,
+                ptl_handle_ct_t trig_ct_handle, ptl_size_t threshold)
+{
+  shm_trig_t op = {.kind = SHM_TRIG_PUT,
+                   .threshold = threshold,
+                   .md_h = md_handle,
+                   .local_offset = local_offset,
+                   .length = length,
+                   .ack_req = ack_req,
+                   .target_id = target_id,
+                   .pt_index = pt_index,
+                   .match_bits = match_bits,
+                   .remote_offset = remote_offset,
+                   .user_ptr = user_ptr,
+                   .hdr_data = hdr_data};
+  return trigger(&op, trig_ct_handle);
+}
+
+int
+PtlTriggeredGet(ptl_handle_md_t md_handle, ptl_size_t local_offset,
+                ptl_size_t length, ptl_process_t target_id,
+                ptl_index_t pt_index, ptl_match_bits_t match_bits,
+                ptl_size_t remote_offset, void* user_ptr,
+                ptl_handle_ct_t trig_ct_handle, ptl_size_t threshold)
+{
+  shm_trig_t op = {.kind = SHM_TRIG_GET,
+                   .threshold = threshold,
+                   .md_h = md_handle,
+                   .local_offset = local_offset,
+                   .length = length,
+                   .target_id = target_id,
+                   .pt_index = pt_index,
+                   .match_bits = match_bits,
+                   .remote_offset = remote_offset,
+                   .user_ptr = user_ptr};
+  return trigger(&op, trig_ct_handle);
+}
+
+int
+PtlTriggeredCTInc(ptl_handle_ct_t ct_handle, ptl_ct_event_t increment,
+                  ptl_handle_ct_t trig_ct_handle, ptl_size_t threshold)
+{
+  shm_trig_t op = {.kind = SHM_TRIG_CT_INC,
+                   .threshold = threshold,
+                   .ct_h = ct_handle,
+                   .ct_value = increment};
+  return trigger(&op, trig_ct_handle);
+}
+
+int
+PtlTriggeredCTSet(ptl_handle_ct_t ct_handle, ptl_ct_event_t new_ct,
+                  ptl_handle_ct_t trig_ct_handle, ptl_size_t threshold)
+{
+  shm_trig_t op = {.kind = SHM_TRIG_CT_SET,
+                   .threshold = threshold,
+                   .ct_h = ct_handle,
+                   .ct_value = new_ct};
+  return trigger(&op, trig_ct_handle);
+}
@@ -0,0 +1,806 @@
+#include "ptl_shm.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static shm_eq_t*
+eq_get(shm_ni_t* ni, ptl_handle_eq_t eq_h)
+{
+  uint32_t slot = SHM_HANDLE_SLOT(eq_h);
+  if((int)slot >= ni->num_eqs || !ni->eqs[slot].in_use)
+    return NULL;
+  return &ni->eqs[slot];
+}
+
+static shm_ct_t*
+ct_get(shm_ni_t* ni, ptl_handle_ct_t ct_h)
+{
+  uint32_t slot = SHM_HANDLE_SLOT(ct_h);
+  if((int)slot >= ni->num_cts || !ni->cts[slot].in_use)
+    return NULL;
+  return &ni->cts[slot];
+}
+
+int
+shm_eq_post(shm_ni_t* ni, ptl_handle_eq_t eq_h, const ptl_event_t* ev)
+{
+  if(PtlHandleIsEqual(eq_h, PTL_EQ_NONE) ||
+     SHM_OBJ_EQ != SHM_HANDLE_KIND(eq_h))
+    return 0;
+  shm_eq_t* eq = eq_get(ni, eq_h);
+  if(NULL == eq)
+    return 0;
+  if(eq->tail - eq->head >= eq->count)
+  {
+    eq->dropped = 1;
+    return -1;
+  }
+  eq->ring[eq->tail % eq->count] = *ev;
+  eq->tail++;
+  return 0;
+}
+
+/* collect triggered operations whose threshold has been reached */
+static void
+ct_collect(shm_ct_t* ct, shm_trig_t** fired)
+{
+  shm_trig_t** it = &ct->triggered;
+  shm_trig_t** tail = fired;
+
+  while(NULL != *tail)
+    tail = &(*tail)->next;
+
+  while(NULL != *it)
+  {
+    if((*it)->threshold <= ct->ev.success)
+    {
+      shm_trig_t* op = *it;
+      *it = op->next;
+      op->next = NULL;
+      *tail = op;
+      tail = &op->next;
+    }
+    else
+      it = &(*it)->next;
+  }
+}
+
+void
+shm_ct_add(shm_ni_t* ni, ptl_handle_ct_t ct_h, ptl_size_t success,
+           ptl_size_t failure, shm_trig_t** fired)
+{
+  if(PtlHandleIsEqual(ct_h, PTL_CT_NONE) ||
+     SHM_OBJ_CT != SHM_HANDLE_KIND(ct_h))
+    return;
+  shm_ct_t* ct = ct_get(ni, ct_h);
+  if(NULL == ct)
+    return;
+  ct->ev.success += success;
+  ct->ev.failure += failure;
+  ct_collect(ct, fired);
+}
+
+void
+shm_ct_assign(shm_ni_t* ni, ptl_handle_ct_t ct_h, ptl_ct_event_t value,
+              shm_trig_t** fired)
+{
+  shm_ct_t* ct = ct_get(ni, ct_h);
+  if(NULL == ct)
+    return;
+  ct->ev = value;
+  ct_collect(ct, fired);
+}
+
+int
+shm_me_matches(const shm_ni_t* ni, const ptl_me_t* me, const shm_msg_t* hdr)
+{
+  unsigned int op = SHM_MSG_GET == hdr->kind ? PTL_ME_OP_GET : PTL_ME_OP_PUT;
+  if(!(me->options & op))
+    return 0;
+  if(!ni->matching)
+    return 1;
+  if(PTL_NID_ANY != me->match_id.phys.nid &&
+     me->match_id.phys.nid != hdr->initiator.phys.nid)
+    return 0;
+  if(PTL_PID_ANY != me->match_id.phys.pid &&
+     me->match_id.phys.pid != hdr->initiator.phys.pid)
+    return 0;
+  return 0 == ((hdr->match_bits ^ me->match_bits) & ~me->ignore_bits);
+}
+
+void
+shm_entry_unlink(shm_ni_t* ni, shm_entry_t* entry)
+{
+  shm_pt_t* pt = &ni->pt[entry->pt_index];
+  shm_entry_t** head =
+      PTL_PRIORITY_LIST == entry->list ? &pt->priority : &pt->overflow;
+
+  if(NULL != entry->prev)
+    entry->prev->next = entry->next;
+  else
+    *head = entry->next;
+  if(NULL != entry->next)
+    entry->next->prev = entry->prev;
+
+  ni->entries[entry->slot] = NULL;
+  free(entry);
+}
+
+int
+PtlMDBind(ptl_handle_ni_t ni_handle, const ptl_md_t* md,
+          ptl_handle_md_t* md_handle)
+{
+  int slot = -1;
+  shm_ni_t* ni = shm_ni_from_handle(ni_handle, SHM_OBJ_NI);
+  if(NULL == ni || NULL == md || NULL == md_handle)
+    return PTL_ARG_INVALID;
+
+  pthread_mutex_lock(&ni->lock);
+  for(int i = 0; i < ni->num_mds; ++i)
+  {
+    if(!ni->mds[i].in_use)
+    {
+      slot = i;
+      break;
+    }
+  }
+  if(0 > slot)
+  {
+    slot = ni->num_mds;
+    if(0 != shm_table_grow((void**)&ni->mds, &ni->num_mds, sizeof(shm_md_t)))
+    {
+      pthread_mutex_unlock(&ni->lock);
+      return PTL_NO_SPACE;
+    }
+  }
+  ni->mds[slot].in_use = 1;
+  ni->mds[slot].md = *md;
+  *md_handle = SHM_HANDLE(SHM_OBJ_MD, ni - shm_nis, slot);
+  pthread_mutex_unlock(&ni->lock);
+  return PTL_OK;
+}
+
+int
+PtlMDRelease(ptl_handle_md_t md_handle)
+{
+  shm_ni_t* ni = shm_ni_from_handle(md_handle, SHM_OBJ_MD);
+  if(NULL == ni)
+    return PTL_ARG_INVALID;
+
+  int eret = PTL_ARG_INVALID;
+  uint32_t slot = SHM_HANDLE_SLOT(md_handle);
+  pthread_mutex_lock(&ni->lock);
+  if((int)slot < ni->num_mds && ni->mds[slot].in_use)
+  {
+    ni->mds[slot].in_use = 0;
+    eret = PTL_OK;
+  }
+  pthread_mutex_unlock(&ni->lock);
+  return eret;
+}
+
+static void
+post_auto_free(shm_ni_t* ni, shm_pt_t* pt, void* user_ptr,
+               ptl_index_t pt_index)
+{
+  ptl_event_t ev = {.user_ptr = user_ptr,
+                    .type = PTL_EVENT_AUTO_FREE,
+                    .ptl_list = PTL_OVERFLOW_LIST,
+                    .pt_index = pt_index,
+                    .ni_fail_type = PTL_NI_OK};
+  shm_eq_post(ni, pt->eq_h, &ev);
+}
+
+/*
+ * An overflow entry that unlinked itself may only be reused once no
+ * unexpected header points into it any more; that is when AUTO_FREE is due.
+ * Like AUTO_UNLINK, it is not raised for PTL_ME_EVENT_UNLINK_DISABLE.
+ */
+void
+shm_overflow_unlinked(shm_ni_t* ni, shm_pt_t* pt, const shm_entry_t* entry)
+{
+  int pending = 0;
+  for(shm_unexpected_t* it = pt->unexpected; NULL != it; it = it->next)
+  {
+    if(entry->serial == it->owner)
+    {
+      it->auto_free = 1;
+      pending = 1;
+    }
+  }
+  if(!pending)
+    post_auto_free(ni, pt, entry->user_ptr, entry->pt_index);
+}
+
+/* frees a claimed header, which may be the last one of an unlinked entry */
+void
+shm_unexpected_release(shm_ni_t* ni, shm_pt_t* pt, shm_unexpected_t* unexp)
+{
+  int last = unexp->auto_free;
+  for(shm_unexpected_t* it = pt->unexpected; last && NULL != it;
+      it = it->next)
+  {
+    if(unexp->owner == it->owner)
+      last = 0;
+  }
+  if(last)
+    post_auto_free(ni, pt, unexp->user_ptr, unexp->hdr.pt_index);
+  free(unexp);
+}
+
+/* emit the *_OVERFLOW event for an unexpected header claimed by an entry */
+static void
+claim_unexpected(shm_ni_t* ni, shm_pt_t* pt, const ptl_me_t* me,
+                 const shm_unexpected_t* unexp, void* user_ptr,
+                 shm_trig_t** fired)
+{
+  if(!(me->options &
+       (PTL_ME_EVENT_COMM_DISABLE | PTL_ME_EVENT_OVER_DISABLE |
+        PTL_ME_EVENT_SUCCESS_DISABLE)))
+  {
+    ptl_event_t ev = {.start = unexp->start,
+                      .user_ptr = user_ptr,
+                      .hdr_data = unexp->hdr.hdr_data,
+                      .match_bits = unexp->hdr.match_bits,
+                      .rlength = unexp->hdr.rlength,
+                      .mlength = unexp->hdr.mlength,
+                      .remote_offset = unexp->hdr.remote_offset,
+                      .uid = unexp->hdr.uid,
+                      .initiator = unexp->hdr.initiator,
+                      .type = SHM_MSG_GET == unexp->hdr.kind
+                                  ? PTL_EVENT_GET_OVERFLOW
+                                  : PTL_EVENT_PUT_OVERFLOW,
+                      .ptl_list = PTL_PRIORITY_LIST,
+                      .pt_index = unexp->hdr.pt_index,
+                      .ni_fail_type = PTL_NI_OK};
+    shm_eq_post(ni, pt->eq_h, &ev);
+  }
+  if(me->options & PTL_ME_EVENT_CT_OVERFLOW)
+    shm_ct_add(ni, me->ct_handle,
+               (me->options & PTL_ME_EVENT_CT_BYTES) ? unexp->hdr.mlength : 1,
+               0, fired);
+}
+
+static int
+entry_append(ptl_handle_ni_t ni_handle, ptl_index_t pt_index,
+             const ptl_me_t* me, int is_me, ptl_list_t ptl_list,
+             void* user_ptr, ptl_handle_any_t* handle)
+{
+  int slot = -1;
+  shm_trig_t* fired = NULL;
+  shm_ni_t* ni = shm_ni_from_handle(ni_handle, SHM_OBJ_NI);
+  if(NULL == ni || NULL == handle || SHM_MAX_PT_INDEX < pt_index)
+    return PTL_ARG_INVALID;
+
+  pthread_mutex_lock(&ni->lock);
+  shm_pt_t* pt = &ni->pt[pt_index];
+  if(!pt->in_use)
+  {
+    pthread_mutex_unlock(&ni->lock);
+    return PTL_ARG_INVALID;
+  }
+
+  for(int i = 0; i < ni->num_entries; ++i)
+  {
+    if(NULL == ni->entries[i])
+    {
+      slot = i;
+      break;
+    }
+  }
+  if(0 > slot)
+  {
+    slot = ni->num_entries;
+    if(0 != shm_table_grow((void**)&ni->entries, &ni->num_entries,
+                           sizeof(shm_entry_t*)))
+    {
+      pthread_mutex_unlock(&ni->lock);
+      return PTL_NO_SPACE;
+    }
+  }
+  *handle = SHM_HANDLE(is_me ? SHM_OBJ_ME : SHM_OBJ_LE, ni - shm_nis, slot);
+
+  shm_entry_t* entry = calloc(1, sizeof(shm_entry_t));
+  if(NULL == entry)
+  {
+    pthread_mutex_unlock(&ni->lock);
+    return PTL_NO_SPACE;
+  }
+  entry->slot = slot;
+  entry->is_me = is_me;
+  entry->pt_index = pt_index;
+  entry->list = ptl_list;
+  entry->me = *me;
+  entry->user_ptr = user_ptr;
+  entry->serial = ++ni->next_serial;
+  ni->entries[slot] = entry;
+
+  shm_entry_t** it =
+      PTL_PRIORITY_LIST == ptl_list ? &pt->priority : &pt->overflow;
+  while(NULL != *it)
+  {
+    entry->prev = *it;
+    it = &(*it)->next;
+  }
+  *it = entry;
+
+  if(!(me->options & PTL_ME_EVENT_LINK_DISABLE))
+  {
+    ptl_event_t ev = {.user_ptr = user_ptr,
+                      .type = PTL_EVENT_LINK,
+                      .ptl_list = ptl_list,
+                      .pt_index = pt_index,
+                      .ni_fail_type = PTL_NI_OK};
+    shm_eq_post(ni, pt->eq_h, &ev);
+  }
+
+  /*
+   * Only a linked priority entry consumes matching unexpected headers, so
+   * the LINK event comes first and a use-once entry unlinks itself as on
+   * delivery.
+   */
+  for(shm_unexpected_t** un = &pt->unexpected;
+      PTL_PRIORITY_LIST == ptl_list && NULL != *un;)
+  {
+    if(!shm_me_matches(ni, me, &(*un)->hdr))
+    {
+      un = &(*un)->next;
+      continue;
+    }
+    shm_unexpected_t* unexp = *un;
+    *un = unexp->next;
+    claim_unexpected(ni, pt, me, unexp, user_ptr, &fired);
+    shm_unexpected_release(ni, pt, unexp);
+    if(me->options & PTL_ME_USE_ONCE)
+    {
+      if(!(me->options & PTL_ME_EVENT_UNLINK_DISABLE))
+      {
+        ptl_event_t ev = {.user_ptr = user_ptr,
+                          .type = PTL_EVENT_AUTO_UNLINK,
+                          .ptl_list = ptl_list,
+                          .pt_index = pt_index,
+                          .ni_fail_type = PTL_NI_OK};
+        shm_eq_post(ni, pt->eq_h, &ev);
+      }
+      shm_entry_unlink(ni, entry);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ni->lock);
+  shm_run_triggered(fired);
+  return PTL_OK;
+}
+
+static int
+entry_unlink(ptl_handle_any_t handle, shm_obj_kind_t kind)
+{
+  shm_ni_t* ni = shm_ni_from_handle(handle, kind);
+  if(NULL == ni)
+    return PTL_ARG_INVALID;
+
+  int eret = PTL_ARG_INVALID;
+  uint32_t slot = SHM_HANDLE_SLOT(handle);
+  pthread_mutex_lock(&ni->lock);
+  if((int)slot < ni->num_entries && NULL != ni->entries[slot])
+  {
+    shm_entry_unlink(ni, ni->entries[slot]);
+    eret = PTL_OK;
+  }
+  pthread_mutex_unlock(&ni->lock);
+  return eret;
+}
+
+static int
+entry_search(ptl_handle_ni_t ni_handle, ptl_index_t pt_index,
+             const ptl_me_t* me, ptl_search_op_t op, void* user_ptr)
+{
+  int found = 0;
+  shm_trig_t* fired = NULL;
+  shm_ni_t* ni = shm_ni_from_handle(ni_handle, SHM_OBJ_NI);
+  if(NULL == ni || NULL == me || SHM_MAX_PT_INDEX < pt_index)
+    return PTL_ARG_INVALID;
+
+  pthread_mutex_lock(&ni->lock);
+  shm_pt_t* pt = &ni->pt[pt_index];
+  if(!pt->in_use)
+  {
+    pthread_mutex_unlock(&ni->lock);
+    return PTL_ARG_INVALID;
+  }
+
+  shm_unexpected_t** it = &pt->unexpected;
+  while(NULL != *it)
+  {
+    if(!shm_me_matches(ni, me, &(*it)->hdr))
+    {
+      it = &(*it)->next;
+      continue;
+    }
+    found = 1;
+    if(PTL_SEARCH_ONLY == op)
+    {
+      ptl_event_t ev = {.start = (*it)->start,
+                        .user_ptr = user_ptr,
+                        .hdr_data = (*it)->hdr.hdr_data,
+                        .match_bits = (*it)->hdr.match_bits,
+                        .rlength = (*it)->hdr.rlength,
+                        .mlength = (*it)->hdr.mlength,
+                        .remote_offset = (*it)->hdr.remote_offset,
+                        .uid = (*it)->hdr.uid,
+                        .initiator = (*it)->hdr.initiator,
+                        .type = PTL_EVENT_SEARCH,
+                        .ptl_list = PTL_OVERFLOW_LIST,
+                        .pt_index = pt_index,
+                        .ni_fail_type = PTL_NI_OK};
+      shm_eq_post(ni, pt->eq_h, &ev);
+      break;
+    }
+    shm_unexpected_t* unexp = *it;
+    *it = unexp->next;
+    claim_unexpected(ni, pt, me, unexp, user_ptr, &fired);
+    shm_unexpected_release(ni, pt, unexp);
+    if(me->options & PTL_ME_USE_ONCE)
+      break;
+  }
+
+  if(!found)
+  {
+    ptl_event_t ev = {.user_ptr = user_ptr,
+                      .type = PTL_EVENT_SEARCH,
+                      .ptl_list = PTL_OVERFLOW_LIST,
+                      .pt_index = pt_index,
+                      .ni_fail_type = PTL_NI_NO_MATCH};
+    shm_eq_post(ni, pt->eq_h, &ev);
+  }
+  pthread_mutex_unlock(&ni->lock);
+  shm_run_triggered(fired);
+  return PTL_OK;
+}
+
+static void
+le_to_me(const ptl_le_t* le, ptl_me_t* me)
+{
+  memset(me, 0, sizeof(*me));
+  me->start = le->start;
+  me->length = le->length;
+  me->ct_handle = le->ct_handle;
+  me->uid = le->uid;
+  me->options = le->options;
+  me->match_id.phys.nid = PTL_NID_ANY;
+  me->match_id.phys.pid = PTL_PID_ANY;
+}
+
+int
+PtlLEAppend(ptl_handle_ni_t ni_handle, ptl_index_t pt_index,
+            const ptl_le_t* le, ptl_list_t ptl_list, void* user_ptr,
+            ptl_handle_le_t* le_handle)
+{
+  ptl_me_t me;
+  if(NULL == le)
+    return PTL_ARG_INVALID;
+  le_to_me(le, &me);
+  return entry_append(ni_handle, pt_index, &me, 0, ptl_list, user_ptr,
+                      le_handle);
+}
+
+int
+PtlLEUnlink(ptl_handle_le_t le_handle)
+{
+  return entry_unlink(le_handle, SHM_OBJ_LE);
+}
+
+int
+PtlLESearch(ptl_handle_ni_t ni_handle, ptl_index_t pt_index,
+            const ptl_le_t* le, ptl_search_op_t ptl_search_op, void* user_ptr)
+{
+  ptl_me_t me;
+  if(NULL == le)
+    return PTL_ARG_INVALID;
+  le_to_me(le, &me);
+  return entry_search(ni_handle, pt_index, &me, ptl_search_op, user_ptr);
+}
+
+int
+PtlMEAppend(ptl_handle_ni_t ni_handle, ptl_index_t pt_index,
+            const ptl_me_t* me, ptl_list_t ptl_list, void* user_ptr,
+            ptl_handle_me_t* me_handle)
+{
+  if(NULL == me)
+    return PTL_ARG_INVALID;
+  return entry_append(ni_handle, pt_index, me, 1, ptl_list, user_ptr,
+                      me_handle);
+}
+
+int
+PtlMEUnlink(ptl_handle_me_t me_handle)
+{
+  return entry_unlink(me_handle, SHM_OBJ_ME);
+}
+
+int
+PtlMESearch(ptl_handle_ni_t ni_handle, ptl_index_t pt_index,
+            const ptl_me_t* me, ptl_search_op_t ptl_search_op, void* user_ptr)
+{
+  return entry_search(ni_handle, pt_index, me, ptl_search_op, user_ptr);
+}
+
+int
+PtlEQAlloc(ptl_handle_ni_t ni_handle, ptl_size_t count,
+           ptl_handle_eq_t* eq_handle)
+{
+  int slot = -1;
+  shm_ni_t* ni = shm_ni_from_handle(ni_handle, SHM_OBJ_NI);
+  if(NULL == ni || NULL == eq_handle || 0 == count)
+    return PTL_ARG_INVALID;
+
+  ptl_event_t* ring = malloc(count * sizeof(ptl_event_t));
+  if(NULL == ring)
+    return PTL_NO_SPACE;
+
+  pthread_mutex_lock(&ni->lock);
+  for(int i = 0; i < ni->num_eqs; ++i)
+  {
+    if(!ni->eqs[i].in_use)
+    {
+      slot = i;
+      break;
+    }
+  }
+  if(0 > slot)
+  {
+    slot = ni->num_eqs;
+    if(0 != shm_table_grow((void**)&ni->eqs, &ni->num_eqs, sizeof(shm_eq_t)))
+    {
+      pthread_mutex_unlock(&ni->lock);
+      free(ring);
+      return PTL_NO_SPACE;
+    }
+  }
+  shm_eq_t* eq = &ni->eqs[slot];
+  memset(eq, 0, sizeof(*eq));
+  eq->in_use = 1;
+  eq->ring = ring;
+  eq->count = count;
+  *eq_handle = SHM_HANDLE(SHM_OBJ_EQ, ni - shm_nis, slot);
+  pthread_mutex_unlock(&ni->lock);
+  return PTL_OK;
+}
+
+int
+PtlEQFree(ptl_handle_eq_t eq_handle)
+{
+  shm_ni_t* ni = shm_ni_from_handle(eq_handle, SHM_OBJ_EQ);
+  if(NULL == ni)
+    return PTL_ARG_INVALID;
+
+  pthread_mutex_lock(&ni->lock);
+  shm_eq_t* eq = eq_get(ni, eq_handle);
+  if(NULL == eq)
+  {
+    pthread_mutex_unlock(&ni->lock);
+    return PTL_ARG_INVALID;
+  }
+  free(eq->ring);
+  eq->ring = NULL;
+  eq->in_use = 0;
+  pthread_mutex_unlock(&ni->lock);
+  return PTL_OK;
+}
+
+int
+PtlEQGet(ptl_handle_eq_t eq_handle, ptl_event_t* event)
+{
+  int eret = PTL_EQ_EMPTY;
+  shm_ni_t* ni = shm_ni_from_handle(eq_handle, SHM_OBJ_EQ);
+  if(NULL == ni || NULL == event)
+    return PTL_ARG_INVALID;
+
+  pthread_mutex_lock(&ni->lock);
+  shm_eq_t* eq = eq_get(ni, eq_handle);
+  if(NULL == eq)
+    eret = PTL_ARG_INVALID;
+  else if(eq->head != eq->tail)
+  {
+    *event = eq->ring[eq->head % eq->count];
+    eq->head++;
+    eret = eq->dropped ? PTL_EQ_DROPPED : PTL_OK;
+    eq->dropped = 0;
+  }
+  pthread_mutex_unlock(&ni->lock);
+  return eret;
+}
+
+int
+PtlEQWait(ptl_handle_eq_t eq_handle, ptl_event_t* event)
+{
+  int eret;
+  while(PTL_EQ_EMPTY == (eret = PtlEQGet(eq_handle, event)))
+    shm_relax();
+  return eret;
+}
+
+static double
+now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+int
+PtlEQPoll(const ptl_handle_eq_t* eq_handles, unsigned int size,
+          ptl_time_t timeout, ptl_event_t* event, unsigned int* which)
+{
+  double deadline = now_ms() + timeout;
+  while(1)
+  {
+    for(unsigned int i = 0; i < size; ++i)
+    {
+      int eret = PtlEQGet(eq_handles[i], event);
+      if(PTL_EQ_EMPTY != eret)
+      {
+        if(NULL != which)
+          *which = i;
+        return eret;
+      }
+    }
+    if(PTL_TIME_FOREVER != timeout && now_ms() >= deadline)
+      return PTL_EQ_EMPTY;
+    shm_relax();
+  }
+}
+
+int
+PtlCTAlloc(ptl_handle_ni_t ni_handle, ptl_handle_ct_t* ct_handle)
+{
+  int slot = -1;
+  shm_ni_t* ni = shm_ni_from_handle(ni_handle, SHM_OBJ_NI);
+  if(NULL == ni || NULL == ct_handle)
+    return PTL_ARG_INVALID;
+
+  pthread_mutex_lock(&ni->lock);
+  for(int i = 0; i < ni->num_cts; ++i)
+  {
+    if(!ni->cts[i].in_use)
+    {
+      slot = i;
+      break;
+    }
+  }
+  if(0 > slot)
+  {
+    slot = ni->num_cts;
+    if(0 != shm_table_grow((void**)&ni->cts, &ni->num_cts, sizeof(shm_ct_t)))
+    {
+      pthread_mutex_unlock(&ni->lock);
+      return PTL_NO_SPACE;
+    }
+  }
+  memset(&ni->cts[slot], 0, sizeof(shm_ct_t));
+  ni->cts[slot].in_use = 1;
+  *ct_handle = SHM_HANDLE(SHM_OBJ_CT, ni - shm_nis, slot);
+  pthread_mutex_unlock(&ni->lock);
+  return PTL_OK;
+}
+
+int
+PtlCTCancelTriggered(ptl_handle_ct_t ct_handle)
+{
+  shm_ni_t* ni = shm_ni_from_handle(ct_handle, SHM_OBJ_CT);
+  if(NULL == ni)
+    return PTL_ARG_INVALID;
+
+  pthread_mutex_lock(&ni->lock);
+  shm_ct_t* ct = ct_get(ni, ct_handle);
+  if(NULL == ct)
+  {
+    pthread_mutex_unlock(&ni->lock);
+    return PTL_ARG_INVALID;
+  }
+  while(NULL != ct->triggered)
+  {
+    shm_trig_t* next = ct->triggered->next;
+    free(ct->triggered);
+    ct->triggered = next;
+  }
+  pthread_mutex_unlock(&ni->lock);
+  return PTL_OK;
+}
+
+int
+PtlCTFree(ptl_handle_ct_t ct_handle)
+{
+  int eret = PtlCTCancelTriggered(ct_handle);
+  if(PTL_OK != eret)
+    return eret;
+
+  shm_ni_t* ni = shm_ni_from_handle(ct_handle, SHM_OBJ_CT);
+  pthread_mutex_lock(&ni->lock);
+  ni->cts[SHM_HANDLE_SLOT(ct_handle)].in_use = 0;
+  pthread_mutex_unlock(&ni->lock);
+  return PTL_OK;
+}
+
+int
+PtlCTGet(ptl_handle_ct_t ct_handle, ptl_ct_event_t* event)
+{
+  shm_ni_t* ni = shm_ni_from_handle(ct_handle, SHM_OBJ_CT);
+  if(NULL == ni || NULL == event)
+    return PTL_ARG_INVALID;
+
+  pthread_mutex_lock(&ni->lock);
+  shm_ct_t* ct = ct_get(ni, ct_handle);
+  if(NULL != ct)
+    *event = ct->ev;
+  pthread_mutex_unlock(&ni->lock);
+  return NULL == ct ? PTL_ARG_INVALID : PTL_OK;
+}
+
+int
+PtlCTWait(ptl_handle_ct_t ct_handle, ptl_size_t test, ptl_ct_event_t* event)
+{
+  int eret;
+  while(PTL_OK == (eret = PtlCTGet(ct_handle, event)))
+  {
+    if(event->success >= test || 0 < event->failure)
+      break;
+    shm_relax();
+  }
+  return eret;
+}
+
+int
+PtlCTPoll(const ptl_handle_ct_t* ct_handles, const ptl_size_t* tests,
+          unsigned int size, ptl_time_t timeout, ptl_ct_event_t* event,
+          unsigned int* which)
+{
+  double deadline = now_ms() + timeout;
+  while(1)
+  {
+    for(unsigned int i = 0; i < size; ++i)
+    {
+      int eret = PtlCTGet(ct_handles[i], event);
+      if(PTL_OK != eret)
+        return eret;
+      if(event->success >= tests[i] || 0 < event->failure)
+      {
+        if(NULL != which)
+          *which = i;
+        return PTL_OK;
+      }
+    }
+    if(PTL_TIME_FOREVER != timeout && now_ms() >= deadline)
+      return PTL_CT_NONE_REACHED;
+    shm_relax();
+  }
+}
+
+int
+PtlCTSet(ptl_handle_ct_t ct_handle, ptl_ct_event_t new_ct)
+{
+  shm_trig_t* fired = NULL;
+  shm_ni_t* ni = shm_ni_from_handle(ct_handle, SHM_OBJ_CT);
+  if(NULL == ni)
+    return PTL_ARG_INVALID;
+
+  pthread_mutex_lock(&ni->lock);
+  shm_ct_assign(ni, ct_handle, new_ct, &fired);
+  pthread_mutex_unlock(&ni->lock);
+  shm_run_triggered(fired);
+  return PTL_OK;
+}
+
+int
+PtlCTInc(ptl_handle_ct_t ct_handle, ptl_ct_event_t increment)
+{
+  shm_trig_t* fired = NULL;
+  shm_ni_t* ni = shm_ni_from_handle(ct_handle, SHM_OBJ_CT);
+  if(NULL == ni)
+    return PTL_ARG_INVALID;
+
+  pthread_mutex_lock(&ni->lock);
+  shm_ct_add(ni, ct_handle, increment.success, increment.failure, &fired);
+  pthread_mutex_unlock(&ni->lock);
+  shm_run_triggered(fired);
+  return PTL_OK;
+}
@@ -1,11 +1,27 @@
+#define _GNU_SOURCE
 #include "util.h"
 #include "common.h"
 #include <limits.h>
+#include <math.h>
+#include <sched.h>
+#include <sys/resource.h>
 
 #define REQUESTED_INDEX 99
 
+#ifndef V2P_CACHE_PIDS_PATH
+#define V2P_CACHE_PIDS_PATH "/sys/class/bxi/bxi0/v2p/cache_pids"
+#endif
+
 int
 init_p4_ctx(p4_ctx_t* const ctx, const ni_mode_t mode)
+{
+  return init_p4_ctx_iface(ctx, mode, PTL_IFACE_DEFAULT);
+}
+
+// like init_p4_ctx, on the given interface; may be called once per NI
+int
+init_p4_ctx_iface(p4_ctx_t* const ctx, const ni_mode_t mode,
+                  const ptl_interface_t iface)
 {
   int eret = -1;
   unsigned int ni_matching =
@@ -35,8 +51,8 @@ init_p4_ctx(p4_ctx_t* const ctx, const ni_mode_t mode)
   ctx->ct_h = PTL_INVALID_HANDLE;
   ctx->ni_h = PTL_INVALID_HANDLE;
 
-  eret = PtlNIInit(PTL_IFACE_DEFAULT, ni_matching | PTL_NI_PHYSICAL,
-                   PTL_PID_ANY, &ni_requested_limits, &ni_limits, &ctx->ni_h);
+  eret = PtlNIInit(iface, ni_matching | PTL_NI_PHYSICAL, PTL_PID_ANY,
+                   &ni_requested_limits, &ni_limits, &ctx->ni_h);
   if(PTL_OK != eret)
     return eret;
 
@@ -81,6 +97,54 @@ exchange_ni_address(p4_ctx_t* const ctx, const int my_rank)
   return 0;
 }
 
+int
+gather_ni_addresses(p4_ctx_t* const ctx, ptl_process_t* const peers)
+{
+  return MPI_Allgather(&ctx->my_addr, sizeof(ptl_process_t), MPI_BYTE, peers,
+                       sizeof(ptl_process_t), MPI_BYTE, MPI_COMM_WORLD);
+}
+
+static MPI_Comm node_comm = MPI_COMM_NULL;
+
+static void
+split_node_comm()
+{
+  if(MPI_COMM_NULL == node_comm)
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL,
+                        &node_comm);
+}
+
+locality_t
+get_peer_locality(const int peer)
+{
+  MPI_Group world_group, node_group;
+  int node_rank = MPI_UNDEFINED;
+
+  split_node_comm();
+  MPI_Comm_group(MPI_COMM_WORLD, &world_group);
+  MPI_Comm_group(node_comm, &node_group);
+  MPI_Group_translate_ranks(world_group, 1, &peer, node_group, &node_rank);
+  MPI_Group_free(&world_group);
+  MPI_Group_free(&node_group);
+
+  return MPI_UNDEFINED == node_rank ? INTER_NODE : INTRA_NODE;
+}
+
+locality_t
+get_job_locality()
+{
+  int node_size, world_size, all_local;
+
+  split_node_comm();
+  MPI_Comm_size(node_comm, &node_size);
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+  all_local = node_size == world_size;
+  MPI_Allreduce(MPI_IN_PLACE, &all_local, 1, MPI_INT, MPI_LAND,
+                MPI_COMM_WORLD);
+
+  return all_local ? INTRA_NODE : INTER_NODE;
+}
+
 int
 p4_pt_alloc(p4_ctx_t* const ctx, ptl_index_t* const index)
 {
@@ -323,14 +387,12 @@ p4_me_insert_persistent(p4_ctx_t* const ctx, ptl_handle_me_t* const me_h,
   return eret;
 }
 
-int
-__p4_me_insert(p4_ctx_t* const ctx, ptl_handle_me_t* const me_h, void* start,
+static int
+__p4_me_append(p4_ctx_t* const ctx, ptl_handle_me_t* const me_h, void* start,
                const ptl_size_t length, const ptl_index_t index,
                const ptl_handle_ct_t ct_handle,
-               const ptl_match_bits_t match_bits)
+               const ptl_match_bits_t match_bits, const unsigned int options)
 {
-  int eret = -1;
-  ptl_event_t event;
   ptl_process_t src;
 
   src.phys.nid = PTL_NID_ANY;
@@ -340,7 +402,7 @@ __p4_me_insert(p4_ctx_t* const ctx, ptl_handle_me_t* const me_h, void* start,
                  .length = length,
                  .options = PTL_ME_OP_GET | PTL_ME_OP_PUT |
                             PTL_ME_EVENT_UNLINK_DISABLE | PTL_ME_IS_ACCESSIBLE |
-                            PTL_ME_USE_ONCE,
+                            PTL_ME_USE_ONCE | options,
                  .ct_handle = ct_handle,
                  .uid = PTL_UID_ANY,
                  .match_id = src,
@@ -348,9 +410,13 @@ __p4_me_insert(p4_ctx_t* const ctx, ptl_handle_me_t* const me_h, void* start,
                  .ignore_bits = ~match_bits,
                  .min_free = 0};
 
-  eret = PtlMEAppend(ctx->ni_h, index, &me, PTL_PRIORITY_LIST, NULL, me_h);
-  if(PTL_OK != eret)
-    return eret;
+  return PtlMEAppend(ctx->ni_h, index, &me, PTL_PRIORITY_LIST, NULL, me_h);
+}
+
+static int
+__p4_wait_for_link(p4_ctx_t* const ctx)
+{
+  ptl_event_t event;
 
   PtlEQWait(ctx->eq_h, &event);
 
@@ -364,7 +430,23 @@ __p4_me_insert(p4_ctx_t* const ctx, ptl_handle_me_t* const me_h, void* start,
     fprintf(stderr, "ni_fail_type != PTL_NI_OK");
     return -1;
   }
-  return eret;
+  return PTL_OK;
+}
+
+int
+__p4_me_insert(p4_ctx_t* const ctx, ptl_handle_me_t* const me_h, void* start,
+               const ptl_size_t length, const ptl_index_t index,
+               const ptl_handle_ct_t ct_handle,
+               const ptl_match_bits_t match_bits)
+{
+  int eret = -1;
+
+  eret = __p4_me_append(ctx, me_h, start, length, index, ct_handle,
+                        match_bits, 0);
+  if(PTL_OK != eret)
+    return eret;
+
+  return __p4_wait_for_link(ctx);
 }
 
 int
@@ -385,6 +467,95 @@ p4_me_insert_list_use_once(p4_ctx_t* const ctx, ptl_handle_me_t* const me_h,
   return 0;
 }
 
+/*
+ * Posts the same list as p4_me_insert_list_use_once, with match bits counting
+ * up from match_bits. ME_POST_BATCHED appends every entry before draining the
+ * link events, ME_POST_NO_LINK suppresses them so posting never waits for the
+ * NIC. With a ct_handle the entries count on it instead of raising full
+ * events.
+ */
+int
+p4_me_insert_list_batched(p4_ctx_t* const ctx, ptl_handle_me_t* const me_h,
+                          void* const* start, ptl_size_t* const length,
+                          const int num_entries, const ptl_index_t index,
+                          const ptl_handle_ct_t ct_handle,
+                          const ptl_match_bits_t match_bits,
+                          const me_post_t post)
+{
+  int eret = -1;
+  unsigned int options = 0;
+
+  if(ME_POST_NO_LINK == post)
+    options |= PTL_ME_EVENT_LINK_DISABLE;
+  if(PTL_CT_NONE != ct_handle)
+    options |= PTL_ME_EVENT_CT_COMM | PTL_ME_EVENT_COMM_DISABLE;
+
+  for(int i = 0; i < num_entries; ++i)
+  {
+    eret = __p4_me_append(ctx, &me_h[i], start[i], length[i], index,
+                          ct_handle, match_bits + i, options);
+    if(PTL_OK == eret && ME_POST_SERIAL == post)
+      eret = __p4_wait_for_link(ctx);
+    if(PTL_OK != eret)
+      return -1;
+  }
+  if(ME_POST_BATCHED == post)
+  {
+    for(int i = 0; i < num_entries; ++i)
+    {
+      if(PTL_OK != __p4_wait_for_link(ctx))
+        return -1;
+    }
+  }
+  return 0;
+}
+
+const char*
+me_post_str(const me_post_t post)
+{
+  switch(post)
+  {
+  case ME_POST_SERIAL:
+    return "serial";
+  case ME_POST_BATCHED:
+    return "batched";
+  case ME_POST_NO_LINK:
+    return "nolink";
+  }
+  return "unknown";
+}
+
+/*
+ * Appends a locally managed ME (slab) that the NI packs incoming puts into.
+ * The ME unlinks itself with PTL_EVENT_AUTO_UNLINK once less than min_free
+ * bytes are left. No link event is raised, so the call can be made from an
+ * event loop that is draining the EQ; user_ptr comes back in every event.
+ */
+int
+p4_me_insert_slab(p4_ctx_t* const ctx, ptl_handle_me_t* const me_h,
+                  void* const start, const ptl_size_t length,
+                  const ptl_index_t index, const ptl_size_t min_free,
+                  void* const user_ptr)
+{
+  ptl_process_t src;
+
+  src.phys.nid = PTL_NID_ANY;
+  src.phys.pid = PTL_PID_ANY;
+
+  ptl_me_t me = {.start = start,
+                 .length = length,
+                 .options = PTL_ME_OP_PUT | PTL_ME_MANAGE_LOCAL |
+                            PTL_ME_EVENT_LINK_DISABLE,
+                 .ct_handle = PTL_CT_NONE,
+                 .uid = PTL_UID_ANY,
+                 .match_id = src,
+                 .match_bits = 0,
+                 .ignore_bits = ~0ULL,
+                 .min_free = min_free};
+
+  return PtlMEAppend(ctx->ni_h, index, &me, PTL_PRIORITY_LIST, user_ptr, me_h);
+}
+
 void
 p4_me_remove(ptl_handle_me_t me_h)
 {
@@ -412,21 +583,439 @@ invalidate_cache(int* const cache_buffer, const size_t elements)
   }
 }
 
+static const char* cache_pids_path = NULL;
+static int saved_cache_pids = -1;
+static int cache_pids_saved = 0;
+
+static const char*
+get_cache_regions_path()
+{
+  if(NULL != cache_pids_path)
+    return cache_pids_path;
+  const char* path = getenv("PTLBENCH_V2P_CACHE_PIDS");
+  return NULL != path ? path : V2P_CACHE_PIDS_PATH;
+}
+
+void
+set_cache_regions_path(const char* const path)
+{
+  cache_pids_path = path;
+}
+
+int
+get_cache_regions()
+{
+  int pids = -1;
+  const char* path = get_cache_regions_path();
+  FILE* fptr = fopen(path, "r");
+
+  if(NULL == fptr)
+    return -1;
+  if(1 != fscanf(fptr, "%i", &pids))
+    pids = -1;
+  fclose(fptr);
+  return pids;
+}
+
+static void
+restore_cache_regions()
+{
+  FILE* fptr = fopen(get_cache_regions_path(), "w");
+  if(NULL == fptr)
+    return;
+  fprintf(fptr, "%i", saved_cache_pids);
+  fclose(fptr);
+}
+
+// remembers the setting found before the first write and puts it back at exit;
+// ranks sharing a node must all save before any of them writes
+void
+save_cache_regions()
+{
+  if(cache_pids_saved)
+    return;
+  cache_pids_saved = 1;
+  saved_cache_pids = get_cache_regions();
+  if(0 <= saved_cache_pids)
+    atexit(restore_cache_regions);
+}
+
 int
 set_cache_regions(const int pids)
 {
   int eret = -1;
   FILE* fptr;
+  const char* path = get_cache_regions_path();
 
-  fptr = fopen("/sys/class/bxi/bxi0/v2p/cache_pids", "w");
+  save_cache_regions();
+  fptr = fopen(path, "w");
 
   if(fptr == NULL)
   {
-    fprintf(stderr, "The file is not opened. The program will "
-                    "now exit.");
+    fprintf(stderr, "Failed to open %s\n", path);
     return -1;
   }
 
   fprintf(fptr, "%i", pids);
   return fclose(fptr);
 }
+
+int
+parse_cache_pids_list(const char* const list, int* const pids,
+                      const int max_pids)
+{
+  int n = 0;
+  const char* p = list;
+  char* end;
+
+  while(n < max_pids && '\0' != *p)
+  {
+    pids[n++] = strtol(p, &end, 0);
+    if(end == p)
+      return -1;
+    p = ',' == *end ? end + 1 : end;
+  }
+  return n;
+}
+
+const char*
+calibration_op_str(const calibration_op_t op)
+{
+  switch(op)
+  {
+  case ZERO_BYTE_OP:
+    return "calib_zero_byte";
+  case CT_INC_OP:
+    return "calib_ct_inc";
+  case NULL_OP:
+    return "calib_null";
+  }
+  return "calib_unknown";
+}
+
+#define ADAPTIVE_MIN_SAMPLES 32
+#define MSER_BATCH 5
+#define Z_95 1.96
+
+static int
+compare_double(const void* a, const void* b)
+{
+  const double x = *(const double*)a;
+  const double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+/*
+ * MSER-5: the truncation point that minimises the standard error of the
+ * remaining batch means, searched over the first half of the batches. Returns
+ * the number of samples to drop, or -1 if the minimum lies on the end of that
+ * half, i.e. the series is not stationary yet.
+ */
+static long
+mser5_truncation(const double* const samples, const size_t count)
+{
+  const size_t batches = count / MSER_BATCH;
+  double sum = 0.0, sum_sq = 0.0;
+  double best = -1.0;
+  size_t best_d = 0;
+
+  if(batches < 2)
+    return -1;
+
+  // walk backwards so that the suffix sums are available for every d
+  for(size_t d = batches; d-- > 0;)
+  {
+    double mean = 0.0;
+    for(size_t k = 0; k < MSER_BATCH; ++k)
+      mean += samples[d * MSER_BATCH + k];
+    mean /= MSER_BATCH;
+    sum += mean;
+    sum_sq += mean * mean;
+
+    const double n = batches - d;
+    if(n < 2 || d > batches / 2)
+      continue;
+    const double mser = (sum_sq - sum * sum / n) / (n * n);
+    if(best < 0.0 || mser <= best)
+    {
+      best = mser;
+      best_d = d;
+    }
+  }
+  if(best < 0.0 || best_d == batches / 2)
+    return -1;
+  return (long)(best_d * MSER_BATCH);
+}
+
+static double
+relative_ci_width(const double* const samples, const size_t count,
+                  const ci_stat_t stat)
+{
+  if(CI_MEAN == stat)
+  {
+    double mean = 0.0, var = 0.0;
+    for(size_t i = 0; i < count; ++i)
+      mean += samples[i];
+    mean /= count;
+    for(size_t i = 0; i < count; ++i)
+      var += (samples[i] - mean) * (samples[i] - mean);
+    var /= count - 1;
+    return 2.0 * Z_95 * sqrt(var / count) / mean;
+  }
+
+  // distribution-free interval of the median from order statistics
+  double* sorted = malloc(count * sizeof(double));
+  if(NULL == sorted)
+    return INFINITY;
+  memcpy(sorted, samples, count * sizeof(double));
+  qsort(sorted, count, sizeof(double), compare_double);
+  const double half = Z_95 * sqrt((double)count) / 2.0;
+  long lo = (long)floor(count / 2.0 - half);
+  long hi = (long)ceil(count / 2.0 + half);
+  if(lo < 0)
+    lo = 0;
+  if(hi > (long)count - 1)
+    hi = count - 1;
+  const double median = sorted[count / 2];
+  const double width = (sorted[hi] - sorted[lo]) / median;
+  free(sorted);
+  return width;
+}
+
+// sorts the samples in place
+double
+median(double* const samples, const size_t count)
+{
+  if(0 == count)
+    return 0.0;
+  qsort(samples, count, sizeof(double), compare_double);
+  return samples[count / 2];
+}
+
+int
+adaptive_init(adaptive_sampler_t* const s, const size_t capacity,
+              const double target_width, const double time_budget,
+              const ci_stat_t stat)
+{
+  s->samples = malloc(capacity * sizeof(double));
+  if(NULL == s->samples)
+    return -1;
+  s->capacity = capacity;
+  s->target_width = target_width;
+  s->time_budget = time_budget;
+  s->stat = stat;
+  adaptive_reset(s);
+  return 0;
+}
+
+void
+adaptive_free(adaptive_sampler_t* const s)
+{
+  free(s->samples);
+  s->samples = NULL;
+}
+
+void
+adaptive_reset(adaptive_sampler_t* const s)
+{
+  s->count = 0;
+  s->warmup = 0;
+  s->next_check = ADAPTIVE_MIN_SAMPLES;
+  s->ci_width = INFINITY;
+  s->converged = 0;
+  s->deadline = MPI_Wtime() + s->time_budget;
+}
+
+void
+adaptive_add(adaptive_sampler_t* const s, const double sample)
+{
+  if(s->count < s->capacity)
+    s->samples[s->count++] = sample;
+}
+
+/*
+ * Re-evaluated after every quarter of growth so that the cost of sorting
+ * stays proportional to the number of samples taken.
+ */
+int
+adaptive_done(adaptive_sampler_t* const s)
+{
+  const int exhausted =
+      s->count >= s->capacity || MPI_Wtime() >= s->deadline;
+
+  if(s->count < s->next_check && !exhausted)
+    return 0;
+  s->next_check = s->count + (s->count / 4 > MSER_BATCH ? s->count / 4
+                                                         : MSER_BATCH);
+
+  const long warmup = mser5_truncation(s->samples, s->count);
+  s->warmup = 0 > warmup ? s->count / 2 : (size_t)warmup;
+  if(s->count - s->warmup >= 2)
+    s->ci_width = relative_ci_width(s->samples + s->warmup,
+                                    s->count - s->warmup, s->stat);
+  s->converged = 0 <= warmup &&
+                 s->count - s->warmup >= ADAPTIVE_MIN_SAMPLES &&
+                 s->ci_width <= s->target_width;
+  return s->converged || exhausted;
+}
+
+/*
+ * Sums /proc/interrupts over all sources, once for the CPU the caller runs on
+ * and once for all CPUs. Both stay 0 if the file is not readable.
+ */
+static void
+read_interrupts(FILE* const f, const int cpu, unsigned long* const on_cpu,
+                unsigned long* const total)
+{
+  char* line = NULL;
+  size_t len = 0;
+  int ncpus = 0;
+
+  *on_cpu = 0;
+  *total = 0;
+  if(NULL == f)
+    return;
+
+  rewind(f);
+  if(0 < getline(&line, &len, f))
+  {
+    for(char* c = strstr(line, "CPU"); NULL != c; c = strstr(c + 3, "CPU"))
+      ++ncpus;
+  }
+  while(0 < getline(&line, &len, f))
+  {
+    char* p = strchr(line, ':');
+    if(NULL == p)
+      continue;
+    ++p;
+    for(int c = 0; c < ncpus; ++c)
+    {
+      char* end;
+      const unsigned long v = strtoul(p, &end, 10);
+      if(end == p)
+        break;
+      if(c == cpu)
+        *on_cpu += v;
+      *total += v;
+      p = end;
+    }
+  }
+  free(line);
+}
+
+static void
+timeline_close_interval(timeline_t* const tl)
+{
+  struct rusage usage;
+  unsigned long irq_cpu, irq_total;
+  const int cpu = sched_getcpu();
+  const double now = MPI_Wtime();
+
+  getrusage(RUSAGE_SELF, &usage);
+  read_interrupts(tl->interrupts, cpu, &irq_cpu, &irq_total);
+
+  timeline_interval_t* const iv =
+      &tl->intervals[tl->interval_count % tl->num_intervals];
+  iv->start = tl->last_snapshot - tl->epoch;
+  iv->end = now - tl->epoch;
+  iv->cpu = cpu;
+  iv->nvcsw = usage.ru_nvcsw - tl->last_nvcsw;
+  iv->nivcsw = usage.ru_nivcsw - tl->last_nivcsw;
+  iv->irq_cpu = irq_cpu - tl->last_irq_cpu;
+  iv->irq_total = irq_total - tl->last_irq_total;
+  ++tl->interval_count;
+
+  tl->last_snapshot = now;
+  tl->last_nvcsw = usage.ru_nvcsw;
+  tl->last_nivcsw = usage.ru_nivcsw;
+  // a migration to another CPU shows up as one inflated irq_cpu delta
+  tl->last_irq_cpu = irq_cpu;
+  tl->last_irq_total = irq_total;
+}
+
+int
+timeline_init(timeline_t* const tl, const size_t capacity, const int interval)
+{
+  struct rusage usage;
+
+  memset(tl, 0, sizeof(*tl));
+  tl->capacity = capacity;
+  tl->interval = 0 < interval ? interval : 1;
+  // one interval more than the ring can span, plus the partial last one
+  tl->num_intervals = capacity / tl->interval + 2;
+  tl->samples = malloc(capacity * sizeof(timeline_sample_t));
+  tl->intervals = malloc(tl->num_intervals * sizeof(timeline_interval_t));
+  if(NULL == tl->samples || NULL == tl->intervals)
+  {
+    timeline_free(tl);
+    return -1;
+  }
+  // touch the ring now so that recording never faults
+  memset(tl->samples, 0, capacity * sizeof(timeline_sample_t));
+  memset(tl->intervals, 0, tl->num_intervals * sizeof(timeline_interval_t));
+
+  tl->interrupts = fopen("/proc/interrupts", "r");
+  getrusage(RUSAGE_SELF, &usage);
+  tl->last_nvcsw = usage.ru_nvcsw;
+  tl->last_nivcsw = usage.ru_nivcsw;
+  read_interrupts(tl->interrupts, sched_getcpu(), &tl->last_irq_cpu,
+                  &tl->last_irq_total);
+  tl->epoch = MPI_Wtime();
+  tl->last_snapshot = tl->epoch;
+  return 0;
+}
+
+void
+timeline_free(timeline_t* const tl)
+{
+  free(tl->samples);
+  free(tl->intervals);
+  if(NULL != tl->interrupts)
+    fclose(tl->interrupts);
+  tl->samples = NULL;
+  tl->intervals = NULL;
+  tl->interrupts = NULL;
+}
+
+void
+timeline_record(timeline_t* const tl, const char* const func,
+                const size_t msg_size, const double latency)
+{
+  timeline_sample_t* const s = &tl->samples[tl->count % tl->capacity];
+  s->timestamp = MPI_Wtime() - tl->epoch;
+  s->latency = latency;
+  s->msg_size = msg_size;
+  s->func = func;
+  s->interval = tl->interval_count;
+  ++tl->count;
+  if(0 == tl->count % tl->interval)
+    timeline_close_interval(tl);
+}
+
+int
+timeline_dump(timeline_t* const tl, const char* const path)
+{
+  FILE* const f = fopen(path, "w");
+  if(NULL == f)
+  {
+    fprintf(stderr, "Failed to open %s\n", path);
+    return -1;
+  }
+  if(0 != tl->count % tl->interval)
+    timeline_close_interval(tl);
+
+  fprintf(f, "n,timestamp,func,msg_size,latency,interval,cpu,nvcsw,nivcsw,"
+             "irq_cpu,irq_total\n");
+  const size_t first = tl->count > tl->capacity ? tl->count - tl->capacity : 0;
+  for(size_t n = first; n < tl->count; ++n)
+  {
+    const timeline_sample_t* const s = &tl->samples[n % tl->capacity];
+    const timeline_interval_t* const iv =
+        &tl->intervals[s->interval % tl->num_intervals];
+    fprintf(f, "%lu,%.9f,%s,%lu,%.4f,%lu,%i,%li,%li,%lu,%lu\n", n,
+            s->timestamp, s->func, s->msg_size, s->latency * 1e6, s->interval,
+            iv->cpu, iv->nvcsw, iv->nivcsw, iv->irq_cpu, iv->irq_total);
+  }
+  fclose(f);
+  return 0;
+}